@@ -6,7 +6,9 @@
  */
 
 #include "Context.hpp"
+#include "bitcoin/NetworkEngine.hpp"
 #include "bitcoin/cache/BlockCache.hpp"
+#include "bitcoin/cache/ServerCache.hpp"
 #include "exchange/ExchangeCache.hpp"
 
 namespace abcd {
@@ -15,8 +17,11 @@ std::unique_ptr<Context> gContext;
 
 Context::~Context()
 {
+    // The network uses the caches, so it must go first:
+    delete &network;
     delete &blockCache;
     delete &exchangeCache;
+    delete &serverCache;
 }
 
 Context::Context(const std::string &rootDir, const std::string &certPath,
@@ -27,10 +32,14 @@ Context::Context(const std::string &rootDir, const std::string &certPath,
     accountType_(accountType),
     hiddenBitsKey_(hiddenBitsKey),
     paths(rootDir, certPath),
-    blockCache(*new BlockCache(paths.blockCachePath())),
-    exchangeCache(*new ExchangeCache(paths.exchangeCachePath()))
+    blockCache(*new BlockCache(paths.blockCachePath(),
+                               paths.blockHeadersPath())),
+    exchangeCache(*new ExchangeCache(paths.exchangeCachePath())),
+    serverCache(*new ServerCache(paths.serverCachePath())),
+    network(*new NetworkEngine(blockCache, serverCache))
 {
     blockCache.load().log(); // Failure is fine
+    serverCache.load().log(); // Failure is fine
 }
 
 } // namespace abcd
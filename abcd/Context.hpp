@@ -15,6 +15,8 @@ namespace abcd {
 
 class BlockCache;
 class ExchangeCache;
+class NetworkEngine;
+class ServerCache;
 
 /**
  * An object holding app-wide information, such as paths.
@@ -41,6 +43,8 @@ public:
     RootPaths paths;
     BlockCache &blockCache;
     ExchangeCache &exchangeCache;
+    ServerCache &serverCache;
+    NetworkEngine &network;
 };
 
 /**
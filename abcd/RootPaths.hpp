@@ -57,10 +57,12 @@ public:
     // Individual files:
     const std::string &certPath() const { return certPath_; }
     std::string blockCachePath() const { return dir_ + "Blocks.json"; }
+    std::string blockHeadersPath() const { return dir_ + "Headers.bin"; }
     std::string exchangeCachePath() const { return dir_ + "Exchange.json"; }
     std::string feeCachePath() const { return dir_ + "Fees.json"; }
     std::string generalPath() const { return dir_ + "Servers.json"; }
     std::string questionsPath() const { return dir_ + "Questions.json"; }
+    std::string serverCachePath() const { return dir_ + "ServerStats.json"; }
     std::string logPath() const { return dir_ + "abc.log"; }
     std::string logPrevPath() const { return dir_ + "abc-prev.log"; }
 
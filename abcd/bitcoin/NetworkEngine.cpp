@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "NetworkEngine.hpp"
+#include "network/TrafficRecorder.hpp"
+#include "../util/Debug.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include <future>
+#include <vector>
+
+namespace abcd {
+
+// Weight of each new sample in the command latency average:
+constexpr double latencyWeight = 0.1;
+
+NetworkEngine::~NetworkEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    wakeup();
+    if (thread_.joinable())
+        thread_.join();
+
+    txu_.disconnect();
+    if (wakeWrite_ != wakeRead_)
+        close(wakeWrite_);
+    if (0 <= wakeRead_)
+        close(wakeRead_);
+}
+
+NetworkEngine::NetworkEngine(BlockCache &blocks, ServerCache &servers):
+    started_(false),
+    quit_(false),
+    wakeRead_(-1),
+    wakeWrite_(-1),
+    signalled_(false),
+    walletCount_(0),
+    connectionCount_(0),
+    watcherLoops_(0),
+    commandLatency_(0),
+    inflightStats_{0, 0},
+    warm_(false),
+    txu_(blocks, servers, ctx_, reactor_)
+{
+#ifdef __linux__
+    wakeRead_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    wakeWrite_ = wakeRead_;
+#else
+    int fds[2];
+    if (!pipe(fds))
+    {
+        // A full pipe already means "wake up", so writes must never block:
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        wakeRead_ = fds[0];
+        wakeWrite_ = fds[1];
+    }
+#endif
+    if (wakeRead_ < 0)
+    {
+        ABC_DebugLog("NetworkEngine: cannot create wakeup event");
+        return;
+    }
+
+    auto onWakeup = [this](short revents)
+    {
+        uint64_t buffer[32];
+        while (0 < read(wakeRead_, buffer, sizeof(buffer)))
+            ;
+    };
+    reactor_.watch(wakeRead_, POLLIN, onWakeup).log();
+}
+
+void
+NetworkEngine::connect(const std::string &walletId, Cache &cache)
+{
+    post([this, walletId, &cache]()
+    {
+        txu_.walletAdd(walletId, cache);
+        connected_.insert(walletId);
+        txu_.connect().log();
+    });
+}
+
+void
+NetworkEngine::warmup()
+{
+    post([this]()
+    {
+        warm_ = true;
+        txu_.connect().log();
+    });
+}
+
+void
+NetworkEngine::disconnect(const std::string &walletId)
+{
+    auto command = [this, walletId]()
+    {
+        txu_.walletRemove(walletId);
+        connected_.erase(walletId);
+        if (connected_.empty() && !warm_)
+            txu_.disconnect();
+    };
+
+    auto done = std::make_shared<std::promise<void>>();
+    auto future = done->get_future();
+    {
+        // If the thread never started, no wallet was ever added:
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable() || quit_)
+            return;
+
+        // The network thread itself can just do the work:
+        if (std::this_thread::get_id() == thread_.get_id())
+            return command();
+
+        // Posting under the lock means the thread can't quit
+        // without first running this command:
+        commands_.push(Command{[command, done]()
+        {
+            command();
+            done->set_value();
+        }, std::chrono::steady_clock::now()});
+    }
+    wakeup();
+    future.wait();
+}
+
+void
+NetworkEngine::sendTx(StatusCallback status, DataSlice tx)
+{
+    DataChunk data(tx.begin(), tx.end());
+    post([this, status, data]()
+    {
+        txu_.sendTx(status, data);
+    });
+}
+
+void
+NetworkEngine::record(const std::string &path)
+{
+    post([this, path]()
+    {
+        std::shared_ptr<TrafficRecorder> recorder;
+        if (!path.empty())
+        {
+            recorder = std::make_shared<TrafficRecorder>();
+            if (!recorder->open(path).log())
+                recorder.reset();
+        }
+        txu_.recorderSet(recorder);
+    });
+}
+
+void
+NetworkEngine::wakeup()
+{
+    // Once signalled, the thread will see everything posted before
+    // it clears the flag, so there is no need to signal twice:
+    if (signalled_.exchange(true))
+        return;
+
+    // A failed write means the event is already set, which is fine:
+    const uint64_t one = 1;
+    if (write(wakeWrite_, &one, sizeof(one)) < 0 && EAGAIN != errno)
+        ABC_DebugLog("NetworkEngine: wakeup failed");
+}
+
+void
+NetworkEngine::watcherLoopStarted()
+{
+    ++watcherLoops_;
+}
+
+void
+NetworkEngine::watcherLoopStopped()
+{
+    --watcherLoops_;
+}
+
+NetworkEngine::Counts
+NetworkEngine::counts() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Counts out;
+    out.wallets = walletCount_;
+    out.connections = connectionCount_;
+    out.threads = (thread_.joinable() ? 1 : 0) + watcherLoops_;
+    out.dedupeRatio = inflightStats_.ratio();
+    out.commandLatency = std::chrono::microseconds(commandLatency_.load());
+    return out;
+}
+
+void
+NetworkEngine::post(std::function<void ()> command)
+{
+    commands_.push(Command{std::move(command),
+                           std::chrono::steady_clock::now()});
+
+    if (!started_)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!thread_.joinable() && !quit_)
+            thread_ = std::thread([this]() { loop(); });
+        started_ = true;
+    }
+    wakeup();
+}
+
+void
+NetworkEngine::commandsRun()
+{
+    Command command;
+    while (commands_.pop(command))
+    {
+        // Track how long commands sit in the queue:
+        const auto waited = std::chrono::duration_cast<
+                            std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() -
+                                command.posted).count();
+        const auto average = commandLatency_.load();
+        commandLatency_ = average ?
+                          static_cast<int64_t>(average + latencyWeight *
+                                               (waited - average)) :
+                          waited;
+
+        command.run();
+    }
+}
+
+void
+NetworkEngine::loop()
+{
+    ABC_DebugLog("NetworkEngine: thread started");
+
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (quit_)
+                break;
+        }
+
+        // Clear the signal first, so later posts will signal again:
+        signalled_ = false;
+        commandsRun();
+
+        auto nextWakeup = txu_.wakeup();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            inflightStats_ = txu_.inflightStats();
+        }
+
+        // Report the engine's size as it changes:
+        if (walletCount_ != txu_.walletCount() ||
+                connectionCount_ != txu_.connectionCount())
+        {
+            walletCount_ = txu_.walletCount();
+            connectionCount_ = txu_.connectionCount();
+            ABC_DebugLog("NetworkEngine: %d wallets, %d connections, "
+                         "%d threads, %.0f%% of requests merged, "
+                         "%dus command latency",
+                         walletCount_.load(), connectionCount_.load(),
+                         1 + watcherLoops_.load(),
+                         100 * txu_.inflightStats().ratio(),
+                         static_cast<int>(commandLatency_.load()));
+        }
+
+        reactor_.run(nextWakeup).log();
+    }
+
+    // Someone may be waiting on a command posted before we quit:
+    commandsRun();
+
+    ABC_DebugLog("NetworkEngine: thread stopped");
+}
+
+} // namespace abcd
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * The process-wide blockchain networking thread.
+ */
+
+#ifndef ABCD_BITCOIN_NETWORK_ENGINE_HPP
+#define ABCD_BITCOIN_NETWORK_ENGINE_HPP
+
+#include "network/Reactor.hpp"
+#include "network/TxUpdater.hpp"
+#include "../util/MpscQueue.hpp"
+#include <zmq.hpp>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace abcd {
+
+class BlockCache;
+class Cache;
+class ServerCache;
+
+/**
+ * Runs a single TxUpdater on a single thread, syncing every wallet
+ * in the process over one shared pool of server connections.
+ * Each wallet keeps its own cache and callbacks.
+ * All methods are thread-safe.
+ */
+class NetworkEngine
+{
+public:
+    /**
+     * A snapshot of the engine's size, for monitoring.
+     */
+    struct Counts
+    {
+        size_t wallets;
+        size_t connections;
+        size_t threads;
+
+        /** Requests merged into one already in flight, as a fraction. */
+        double dedupeRatio;
+
+        /** The smoothed time from posting a command to running it. */
+        std::chrono::microseconds commandLatency;
+    };
+
+    ~NetworkEngine();
+    NetworkEngine(BlockCache &blocks, ServerCache &servers);
+
+    /**
+     * Starts syncing a wallet, connecting to servers if needed.
+     * The cache must stay alive until `disconnect` returns.
+     */
+    void
+    connect(const std::string &walletId, Cache &cache);
+
+    /**
+     * Opens the server connections before any wallet needs them,
+     * so the first wallet to connect finds the block height
+     * and fee estimates already loaded.
+     * Once warmed up, the connections stay open until shutdown.
+     */
+    void
+    warmup();
+
+    /**
+     * Stops syncing a wallet. Once the last wallet leaves,
+     * the server connections are closed, unless `warmup` was called.
+     * This waits for the network thread, so once it returns,
+     * nothing will touch the wallet's cache again.
+     */
+    void
+    disconnect(const std::string &walletId);
+
+    /**
+     * Broadcasts a transaction.
+     * All errors go to the `status` callback.
+     */
+    void
+    sendTx(StatusCallback status, DataSlice tx);
+
+    /**
+     * Starts recording the server traffic to a file,
+     * replacing any earlier recording.
+     * A blank path stops recording.
+     */
+    void
+    record(const std::string &path);
+
+    /**
+     * Asks the network thread to look for new work.
+     */
+    void
+    wakeup();
+
+    /**
+     * Tracks the per-wallet watcher threads,
+     * which deliver callbacks alongside the network thread.
+     */
+    void
+    watcherLoopStarted();
+    void
+    watcherLoopStopped();
+
+    Counts
+    counts() const;
+
+    NetworkEngine(const NetworkEngine &copy) = delete;
+    NetworkEngine &operator=(const NetworkEngine &copy) = delete;
+
+private:
+    struct Command
+    {
+        std::function<void ()> run;
+        std::chrono::steady_clock::time_point posted;
+    };
+
+    zmq::context_t ctx_;
+
+    // Talking to the thread. Posting a command takes no locks,
+    // except where it must not race with stopping the thread.
+    // The mutex only guards starting and stopping the thread:
+    MpscQueue<Command> commands_;
+    mutable std::mutex mutex_;
+    std::thread thread_;
+    std::atomic<bool> started_;
+    bool quit_;
+
+    // Wakes the thread. This is an eventfd where available,
+    // and a pipe elsewhere. Only the first post after the thread
+    // wakes up needs to touch it:
+    int wakeRead_;
+    int wakeWrite_;
+    std::atomic<bool> signalled_;
+
+    // Published by the thread for `counts`:
+    std::atomic<size_t> walletCount_;
+    std::atomic<size_t> connectionCount_;
+    std::atomic<size_t> watcherLoops_;
+    std::atomic<int64_t> commandLatency_; // Microseconds
+    InflightTable::Stats inflightStats_; // Guarded by the mutex
+
+    // Everything below this point is only touched by the thread:
+    std::set<std::string> connected_;
+    bool warm_;
+    Reactor reactor_;
+    TxUpdater txu_;
+
+    /**
+     * Runs a command on the network thread, starting it if needed.
+     */
+    void
+    post(std::function<void ()> command);
+
+    /**
+     * Runs the commands posted so far, timing how long they waited.
+     */
+    void
+    commandsRun();
+
+    void
+    loop();
+};
+
+} // namespace abcd
+
+#endif
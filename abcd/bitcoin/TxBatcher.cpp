@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "TxBatcher.hpp"
+
+namespace abcd {
+
+TxBatcher::TxBatcher(std::chrono::milliseconds window):
+    window_(window)
+{
+}
+
+std::chrono::milliseconds
+TxBatcher::window() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return window_;
+}
+
+void
+TxBatcher::windowSet(std::chrono::milliseconds window)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    window_ = window;
+}
+
+bool
+TxBatcher::insert(const std::string &txid, Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!seen_.insert(txid).second)
+        return false;
+
+    const bool opened = txids_.empty();
+    if (opened)
+        opened_ = now;
+    txids_.push_back(txid);
+    return opened;
+}
+
+bool
+TxBatcher::flush(TxidList &result, Clock::time_point now, bool force)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (txids_.empty())
+        return false;
+    if (!force && now < opened_ + window_)
+        return false;
+
+    result.clear();
+    result.swap(txids_);
+    seen_.clear();
+    return true;
+}
+
+std::chrono::milliseconds
+TxBatcher::nextWakeup(Clock::time_point now) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (txids_.empty())
+        return std::chrono::milliseconds(0);
+
+    const auto due = opened_ + window_;
+    if (due <= now)
+        return std::chrono::milliseconds(1); // Zero would mean "never"
+    return std::chrono::duration_cast<std::chrono::milliseconds>(due - now)
+           + std::chrono::milliseconds(1);
+}
+
+} // namespace abcd
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Coalesces per-transaction GUI notifications into batches.
+ */
+
+#ifndef ABCD_BITCOIN_TX_BATCHER_HPP
+#define ABCD_BITCOIN_TX_BATCHER_HPP
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * Collects transaction ids as the watcher discovers them,
+ * and releases them as a single batch once the coalescing window closes.
+ *
+ * The window opens when the first txid arrives,
+ * so a single payment is delayed by at most one window,
+ * while a catch-up sync with hundreds of transactions
+ * produces a handful of batches instead of hundreds of events.
+ */
+class TxBatcher
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::vector<std::string> TxidList;
+
+    /**
+     * @param window The coalescing window. Zero disables batching.
+     */
+    TxBatcher(std::chrono::milliseconds window=std::chrono::milliseconds(0));
+
+    /**
+     * Returns the coalescing window, or zero if batching is off.
+     */
+    std::chrono::milliseconds
+    window() const;
+
+    /**
+     * Changes the coalescing window. Zero disables batching.
+     */
+    void
+    windowSet(std::chrono::milliseconds window);
+
+    /**
+     * Adds a txid to the current batch, opening a new window if needed.
+     * Duplicate txids within the same batch are ignored.
+     * @return true if this txid opened a new window,
+     * so the caller should reschedule its wakeup.
+     */
+    bool
+    insert(const std::string &txid, Clock::time_point now=Clock::now());
+
+    /**
+     * Hands out the pending batch if its window has closed.
+     * @param force Release the batch even if the window is still open.
+     * @return false if there is nothing to deliver yet.
+     */
+    bool
+    flush(TxidList &result, Clock::time_point now=Clock::now(),
+          bool force=false);
+
+    /**
+     * Returns the time until the current batch is due,
+     * or zero if there is no pending batch.
+     */
+    std::chrono::milliseconds
+    nextWakeup(Clock::time_point now=Clock::now()) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::chrono::milliseconds window_;
+
+    // The batch in progress:
+    TxidList txids_;
+    std::set<std::string> seen_;
+    Clock::time_point opened_;
+};
+
+} // namespace abcd
+
+#endif
@@ -6,175 +6,103 @@
  */
 
 #include "Watcher.hpp"
+#include "NetworkEngine.hpp"
+#include "../Context.hpp"
 #include "../util/Debug.hpp"
-#include <bitcoin/bitcoin.hpp>
-#include <sstream>
 
 namespace abcd {
 
-using std::placeholders::_1;
-using std::placeholders::_2;
-
-static unsigned watcher_id = 0;
-
-enum
+Watcher::~Watcher()
 {
-    msg_quit,
-    msg_wakeup,
-    msg_disconnect,
-    msg_connect,
-    msg_send
-};
-
-Watcher::Watcher(Cache &cache):
-    socket_(ctx_, ZMQ_PAIR),
-    txu_(cache, ctx_)
+    // The context may already be gone during shutdown:
+    if (gContext)
+        gContext->network.disconnect(walletId_);
+}
+
+Watcher::Watcher(const std::string &walletId, Cache &cache):
+    walletId_(walletId),
+    cache_(cache),
+    stopped_(false),
+    awake_(false)
 {
-    std::stringstream name;
-    name << "inproc://watcher-" << watcher_id++;
-    socket_name_ = name.str();
-    socket_.bind(socket_name_.c_str());
-    int linger = 0;
-    socket_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
 }
 
 void
 Watcher::sendWakeup()
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        awake_ = true;
+    }
+    wakeup_.notify_all();
 
-    uint8_t req = msg_wakeup;
-    socket_.send(&req, 1);
+    // New addresses might need network work, too:
+    gContext->network.wakeup();
 }
 
 void Watcher::disconnect()
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-
-    uint8_t req = msg_disconnect;
-    socket_.send(&req, 1);
+    gContext->network.disconnect(walletId_);
 }
 
 void Watcher::connect()
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-
-    uint8_t req = msg_connect;
-    socket_.send(&req, 1);
+    gContext->network.connect(walletId_, cache_);
 }
 
 void
 Watcher::sendTx(StatusCallback status, DataSlice tx)
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-
-    auto statusCopy = new StatusCallback(std::move(status));
-    auto statusInt = reinterpret_cast<uintptr_t>(statusCopy);
-
-    auto data = buildData({bc::to_byte(msg_send),
-                           bc::to_little_endian(statusInt), tx
-                          });
-    socket_.send(data.data(), data.size());
+    gContext->network.sendTx(status, tx);
 }
 
 void Watcher::stop()
 {
-    std::lock_guard<std::mutex> lock(socket_mutex_);
-
-    uint8_t req = msg_quit;
-    socket_.send(&req, 1);
+    gContext->network.disconnect(walletId_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wakeup_.notify_all();
 
     // Log time to start logout
     ABC_DebugLog("Watcher::stop() %lu", this);
-
-}
-
-void throw_term()
-{
-    throw 1;
-}
-void throw_fault()
-{
-    throw 2;
-}
-void throw_intr()
-{
-    throw 3;
 }
 
 void Watcher::loop()
 {
-    zmq::socket_t socket(ctx_, ZMQ_PAIR);
-    socket.connect(socket_name_.c_str());
-    int linger = 0;
-    socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
-
-    bool done = false;
-    while (!done)
+    gContext->network.watcherLoopStarted();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_)
     {
-        auto nextWakeup = txu_.wakeup();
-        int delay = nextWakeup.count() ? nextWakeup.count() : -1;
-
-        std::vector<zmq_pollitem_t> items;
-        items.push_back(zmq_pollitem_t{ socket, 0, ZMQ_POLLIN, 0 });
-        auto txuItems = txu_.pollitems();
-        items.insert(items.end(), txuItems.begin(), txuItems.end());
-
-        if (zmq_poll(items.data(), items.size(), delay) < 0)
-            switch (errno)
-            {
-            case ETERM:
-                throw_term();
-                break;
-            case EFAULT:
-                throw_fault();
-                break;
-            case EINTR:
-                throw_intr();
-                break;
-            }
-
-        if (items[0].revents)
+        awake_ = false;
+        std::chrono::milliseconds nextWakeup(0);
+        if (wakeupCallback_)
         {
-            zmq::message_t msg;
-            socket.recv(&msg);
-            if (!command(static_cast<uint8_t *>(msg.data()), msg.size()))
-                done = true;
+            lock.unlock();
+            nextWakeup = wakeupCallback_();
+            lock.lock();
         }
-    }
-}
 
-bool Watcher::command(uint8_t *data, size_t size)
-{
-    auto serial = bc::make_deserializer(data, data + size);
-    switch (serial.read_byte())
-    {
-    default:
-    case msg_quit:
-        // Log time to finish watcher.
-        ABC_DebugLog("Watcher Successfully Quit %lu", this);
-        return false;
-
-    case msg_wakeup:
-        return true;
+        auto ready = [this]()
+        {
+            return stopped_ || awake_;
+        };
+        if (nextWakeup.count())
+            wakeup_.wait_for(lock, nextWakeup, ready);
+        else
+            wakeup_.wait(lock, ready);
+    }
 
-    case msg_disconnect:
-        txu_.disconnect();
-        return true;
+    gContext->network.watcherLoopStopped();
 
-    case msg_connect:
-        txu_.connect().log();
-        return true;
+    // Log time to finish watcher.
+    ABC_DebugLog("Watcher Successfully Quit %lu", this);
+}
 
-    case msg_send:
-    {
-        auto statusInt = serial.read_little_endian<uintptr_t>();
-        auto statusCopy = reinterpret_cast<StatusCallback *>(statusInt);
-        txu_.sendTx(*statusCopy, DataSlice(serial.iterator(), data + size));
-        delete statusCopy;
-    }
-    return true;
-    }
+void Watcher::wakeupCallbackSet(const WakeupCallback &callback)
+{
+    wakeupCallback_ = callback;
 }
 
 } // namespace abcd
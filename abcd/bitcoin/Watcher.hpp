@@ -8,19 +8,28 @@
 #ifndef ABCD_BITCOIN_WATCHER_HPP
 #define ABCD_BITCOIN_WATCHER_HPP
 
-#include "network/TxUpdater.hpp"
-#include <zmq.hpp>
+#include "Typedefs.hpp"
+#include "../util/Data.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
 
 namespace abcd {
 
+class Cache;
+
 /**
- * Provides threading support for the TxUpdater object.
+ * Connects one wallet to the shared network engine,
+ * and provides a per-wallet thread for running callbacks.
  */
 class Watcher
 {
 public:
-    Watcher(Cache &cache);
+    typedef std::function<std::chrono::milliseconds ()> WakeupCallback;
+
+    ~Watcher();
+    Watcher(const std::string &walletId, Cache &cache);
 
     // - Updater messages: -------------
     void sendWakeup();
@@ -32,33 +41,41 @@ public:
 
     /**
      * Tells the loop() method to return.
+     * Once this returns, the network engine has let go of the cache.
      */
     void stop();
 
     /**
      * Call this function from a separate thread. It will run for an
-     * unlimited amount of time as it works to keep the transactions
-     * in the watcher up-to-date with the network. The function will
-     * eventually return when the watcher object is destroyed.
+     * unlimited amount of time, delivering this wallet's callbacks
+     * while the shared network engine keeps its transactions up-to-date.
+     * The function will eventually return when the watcher is stopped.
      */
     void loop();
 
+    /**
+     * Provides a callback to run on the watcher thread
+     * each time the loop wakes up. The callback returns the time until
+     * it needs to run again, or zero if it has no pending work.
+     * Only call this while the loop is not running.
+     */
+    void wakeupCallbackSet(const WakeupCallback &callback);
+
     Watcher(const Watcher &copy) = delete;
     Watcher &operator=(const Watcher &copy) = delete;
 
 private:
-    zmq::context_t ctx_;
+    const std::string walletId_;
+    Cache &cache_;
 
-    // Socket for talking to the thread:
-    std::mutex socket_mutex_;
-    std::string socket_name_;
-    zmq::socket_t socket_;
+    // Signalling the thread:
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopped_;
+    bool awake_;
 
     // Everything below this point is only touched by the thread:
-    bool command(uint8_t *data, size_t size);
-
-    // This needs to be constructed last, since it uses everything else:
-    TxUpdater txu_;
+    WakeupCallback wakeupCallback_;
 };
 
 } // namespace abcd
@@ -6,6 +6,7 @@
  */
 
 #include "WatcherBridge.hpp"
+#include "TxBatcher.hpp"
 #include "Watcher.hpp"
 #include "cache/Cache.hpp"
 #include "../Context.hpp"
@@ -18,6 +19,8 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace abcd {
 
@@ -30,7 +33,7 @@ private:
 public:
     WatcherInfo(Wallet &wallet):
         parent_(wallet.shared_from_this()),
-        watcher(wallet.cache),
+        watcher(wallet.id(), wallet.cache),
         wallet(wallet)
     {
     }
@@ -38,11 +41,18 @@ public:
     Watcher watcher;
     Wallet &wallet;
     std::map<std::string, std::string> sweeping; // address to key
-
-    tABC_BitCoin_Event_Callback fCallback;
-    void *pData;
+    TxBatcher batcher;
+
+    // Events from the network thread, waiting for the watcher thread,
+    // so one slow wallet can't hold up the others:
+    std::mutex eventMutex;
+    std::list<std::string> newTxids;
+    std::list<std::string> completeAddresses;
+    TxidSet headerTxids;
+    bool heightChanged = false;
 };
 static std::map<std::string, std::unique_ptr<WatcherInfo>> watchers_;
+static std::mutex watchersMutex_;
 
 /**
  * Tells all running watchers that height has changed.
@@ -51,53 +61,69 @@ static std::map<std::string, std::unique_ptr<WatcherInfo>> watchers_;
 static void
 onHeight(size_t height)
 {
+    std::lock_guard<std::mutex> lock(watchersMutex_);
     for (auto &watcher: watchers_)
     {
-        if (watcher.second->fCallback)
         {
-            ABC_DebugLog("BlockHeightChange callback: wallet %s",
-                         watcher.second->wallet.id().c_str());
-            tABC_AsyncBitCoinInfo info;
-            info.pData = watcher.second->pData;
-            info.eventType = ABC_AsyncEventType_BlockHeightChange;
-            Status().toError(info.status, ABC_HERE());
-            info.szWalletUUID = watcher.second->wallet.id().c_str();
-            info.szTxID = nullptr;
-            info.sweepSatoshi = 0;
-            watcher.second->fCallback(&info);
+            std::lock_guard<std::mutex> lock(watcher.second->eventMutex);
+            watcher.second->heightChanged = true;
         }
+        watcher.second->watcher.sendWakeup();
     }
 }
 
 /**
- * Tells all running watchers that a new header was found.
- * This is a temporary hack until we gain support for app-wide callbacks.
+ * Tells a wallet's watcher that the headers for some of its
+ * transactions have arrived, so their timestamps are now known.
  */
 static void
-onHeader(void)
+onHeader(const std::string &walletId, const TxidSet &txids)
 {
-    for (auto &watcher: watchers_)
+    std::lock_guard<std::mutex> lock(watchersMutex_);
+    auto watcher = watchers_.find(walletId);
+    if (watchers_.end() == watcher)
+        return;
+
     {
-        if (watcher.second->fCallback)
-        {
-            ABC_DebugLog("BlockHeader callback: wallet %s",
-                         watcher.second->wallet.id().c_str());
-            tABC_AsyncBitCoinInfo info;
-            info.pData = watcher.second->pData;
-            info.eventType = ABC_AsyncEventType_TransactionUpdate;
-            Status().toError(info.status, ABC_HERE());
-            info.szWalletUUID = watcher.second->wallet.id().c_str();
-
-            // XXX Todo: Look up TxIDs that actually have a matching height and
-            // send a notification for each one OR send one notification with all
-            // affected TxIDs in a std::set.
-            info.szTxID = nullptr;
-            info.sweepSatoshi = 0;
-            watcher.second->fCallback(&info);
-
-            break;
-        }
+        std::lock_guard<std::mutex> lock(watcher->second->eventMutex);
+        watcher->second->headerTxids.insert(txids.begin(), txids.end());
     }
+    watcher->second->watcher.sendWakeup();
+}
+
+/**
+ * Updates the wallet for each transaction in a batch,
+ * and then tells the GUI about all of them with a single event.
+ */
+static void
+bridgeOnBatch(WatcherInfo *watcherInfo, const TxBatcher::TxidList &txids,
+              tABC_BitCoin_Event_Callback fCallback, void *pData)
+{
+    auto &wallet = watcherInfo->wallet;
+
+    std::vector<const char *> txidPointers;
+    for (const auto &txid: txids)
+    {
+        TxInfo info;
+        if (wallet.cache.txs.info(info, txid).log()
+                && onReceive(wallet, info, nullptr, nullptr).log())
+            txidPointers.push_back(txid.c_str());
+    }
+    if (txidPointers.empty())
+        return;
+
+    ABC_DebugLog("TransactionBatch callback: wallet %s, %d txids",
+                 wallet.id().c_str(), txidPointers.size());
+    tABC_AsyncBitCoinInfo info;
+    info.pData = pData;
+    info.eventType = ABC_AsyncEventType_TransactionBatch;
+    Status().toError(info.status, ABC_HERE());
+    info.szWalletUUID = wallet.id().c_str();
+    info.szTxID = nullptr;
+    info.aszTxIDs = txidPointers.data();
+    info.countTxIDs = txidPointers.size();
+    info.sweepSatoshi = 0;
+    fCallback(&info);
 }
 
 /**
@@ -133,6 +159,8 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
         Status().toError(info.status, ABC_HERE());
         info.szWalletUUID = wallet.id().c_str();
         info.szTxID = nullptr;
+        info.aszTxIDs = nullptr;
+        info.countTxIDs = 0;
         info.sweepSatoshi = 0;
         wallet.cache.addressCheckDoneSet();
         wallet.cache.save();
@@ -140,9 +168,80 @@ bridgeOnComplete(WatcherInfo *watcherInfo, const std::string &address,
     }
 }
 
+/**
+ * Delivers the events the network thread has posted for a wallet.
+ * This runs on the wallet's own watcher thread.
+ */
+static void
+bridgeOnEvents(WatcherInfo *watcherInfo,
+               tABC_BitCoin_Event_Callback fCallback, void *pData)
+{
+    auto &wallet = watcherInfo->wallet;
+
+    std::list<std::string> newTxids;
+    std::list<std::string> completeAddresses;
+    TxidSet headerTxids;
+    bool heightChanged;
+    {
+        std::lock_guard<std::mutex> lock(watcherInfo->eventMutex);
+        newTxids.swap(watcherInfo->newTxids);
+        completeAddresses.swap(watcherInfo->completeAddresses);
+        headerTxids.swap(watcherInfo->headerTxids);
+        heightChanged = watcherInfo->heightChanged;
+        watcherInfo->heightChanged = false;
+    }
+
+    for (const auto &txid: newTxids)
+    {
+        TxInfo info;
+        if (wallet.cache.txs.info(info, txid).log())
+            onReceive(wallet, info, fCallback, pData).log();
+    }
+
+    for (const auto &address: completeAddresses)
+        bridgeOnComplete(watcherInfo, address, fCallback, pData);
+
+    if (!headerTxids.empty())
+    {
+        std::vector<const char *> txidPointers;
+        for (const auto &txid: headerTxids)
+            txidPointers.push_back(txid.c_str());
+
+        ABC_DebugLog("BlockHeader callback: wallet %s, %d txids",
+                     wallet.id().c_str(), txidPointers.size());
+        tABC_AsyncBitCoinInfo info;
+        info.pData = pData;
+        info.eventType = ABC_AsyncEventType_TransactionUpdate;
+        Status().toError(info.status, ABC_HERE());
+        info.szWalletUUID = wallet.id().c_str();
+        info.szTxID = 1 == txidPointers.size() ? txidPointers[0] : nullptr;
+        info.aszTxIDs = txidPointers.data();
+        info.countTxIDs = txidPointers.size();
+        info.sweepSatoshi = 0;
+        fCallback(&info);
+    }
+
+    if (heightChanged)
+    {
+        ABC_DebugLog("BlockHeightChange callback: wallet %s",
+                     wallet.id().c_str());
+        tABC_AsyncBitCoinInfo info;
+        info.pData = pData;
+        info.eventType = ABC_AsyncEventType_BlockHeightChange;
+        Status().toError(info.status, ABC_HERE());
+        info.szWalletUUID = wallet.id().c_str();
+        info.szTxID = nullptr;
+        info.aszTxIDs = nullptr;
+        info.countTxIDs = 0;
+        info.sweepSatoshi = 0;
+        fCallback(&info);
+    }
+}
+
 static Status
 watcherFind(WatcherInfo *&result, const Wallet &self)
 {
+    std::lock_guard<std::mutex> lock(watchersMutex_);
     std::string id = self.id();
     auto row = watchers_.find(id);
     if (row == watchers_.end())
@@ -179,6 +278,7 @@ bridgeSweepKey(Wallet &self, const std::string &wif,
 Status
 bridgeWatcherStart(Wallet &self)
 {
+    std::lock_guard<std::mutex> lock(watchersMutex_);
     if (watchers_.end() != watchers_.find(self.id()))
         return ABC_ERROR(ABC_CC_Error,
                          "Watcher already exists for " + self.id());
@@ -197,8 +297,6 @@ bridgeWatcherLoop(Wallet &self,
     ABC_CHECK(watcherFind(watcherInfo, self));
 
     // Set up new-block callback:
-    watcherInfo->fCallback = fCallback;
-    watcherInfo->pData = pData;
     gContext->blockCache.onHeightSet(onHeight);
     gContext->blockCache.onHeaderSet(onHeader);
 
@@ -209,37 +307,68 @@ bridgeWatcherLoop(Wallet &self,
     };
     self.cache.addresses.wakeupCallbackSet(wakeupCallback);
 
-    // Set up the new-transaction callback:
-    auto onTx = [watcherInfo, fCallback, pData]
-                (const std::string &txid)
+    // Set up the new-transaction callback.
+    // This and the other network callbacks only post work
+    // for this wallet's own thread:
+    auto onTx = [watcherInfo](const std::string &txid)
     {
         ABC_DebugLog("**************************************************************");
         ABC_DebugLog("**** GUI Notified of NEW TRANSACTION txid %s", txid.c_str());
         ABC_DebugLog("**************************************************************\n");
 
-        TxInfo info;
-        if (watcherInfo->wallet.cache.txs.info(info, txid).log())
-            onReceive(watcherInfo->wallet, info, fCallback, pData).log();
+        // Hold the transaction for later if we are batching:
+        if (watcherInfo->batcher.window().count())
+        {
+            if (watcherInfo->batcher.insert(txid))
+                watcherInfo->watcher.sendWakeup();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(watcherInfo->eventMutex);
+            watcherInfo->newTxids.push_back(txid);
+        }
+        watcherInfo->watcher.sendWakeup();
     };
     self.cache.addresses.onTxSet(onTx);
 
     // Set up the address-completed callback:
-    auto onComplete = [watcherInfo, fCallback, pData]
-                      (const std::string &address)
+    auto onComplete = [watcherInfo](const std::string &address)
     {
-        bridgeOnComplete(watcherInfo, address, fCallback, pData);
+        {
+            std::lock_guard<std::mutex> lock(watcherInfo->eventMutex);
+            watcherInfo->completeAddresses.push_back(address);
+        }
+        watcherInfo->watcher.sendWakeup();
     };
     self.cache.addresses.onCompleteSet(onComplete);
 
+    // Set up the batch delivery timer:
+    auto onWakeup = [watcherInfo, fCallback, pData]()
+    {
+        bridgeOnEvents(watcherInfo, fCallback, pData);
+
+        TxBatcher::TxidList txids;
+        if (watcherInfo->batcher.flush(txids))
+            bridgeOnBatch(watcherInfo, txids, fCallback, pData);
+        return watcherInfo->batcher.nextWakeup();
+    };
+    watcherInfo->watcher.wakeupCallbackSet(onWakeup);
+
     // Do the loop:
     watcherInfo->watcher.loop();
 
+    // Deliver anything still waiting:
+    bridgeOnEvents(watcherInfo, fCallback, pData);
+    TxBatcher::TxidList txids;
+    if (watcherInfo->batcher.flush(txids, TxBatcher::Clock::now(), true))
+        bridgeOnBatch(watcherInfo, txids, fCallback, pData);
+
     // Cancel all callbacks:
+    watcherInfo->watcher.wakeupCallbackSet(nullptr);
     self.cache.addresses.wakeupCallbackSet(nullptr);
     self.cache.addresses.onTxSet(nullptr);
     self.cache.addresses.onCompleteSet(nullptr);
-    watcherInfo->fCallback = nullptr;
-    watcherInfo->pData = nullptr;
 
     return Status();
 }
@@ -255,6 +384,18 @@ bridgeWatcherConnect(Wallet &self)
     return Status();
 }
 
+Status
+bridgeWatcherBatch(Wallet &self, unsigned windowMs)
+{
+    WatcherInfo *watcherInfo = nullptr;
+    ABC_CHECK(watcherFind(watcherInfo, self));
+
+    watcherInfo->batcher.windowSet(std::chrono::milliseconds(windowMs));
+    watcherInfo->watcher.sendWakeup();
+
+    return Status();
+}
+
 Status
 watcherSend(Wallet &self, StatusCallback status, DataSlice tx)
 {
@@ -292,7 +433,18 @@ Status
 bridgeWatcherDelete(Wallet &self)
 {
     self.cache.save().log(); // Failure is fine
-    watchers_.erase(self.id());
+
+    // Destroy the watcher outside the lock, since that waits on the
+    // network thread, which might be waiting on the lock:
+    std::unique_ptr<WatcherInfo> watcherInfo;
+    {
+        std::lock_guard<std::mutex> lock(watchersMutex_);
+        auto i = watchers_.find(self.id());
+        if (watchers_.end() == i)
+            return Status();
+        watcherInfo = std::move(i->second);
+        watchers_.erase(i);
+    }
 
     return Status();
 }
@@ -39,6 +39,13 @@ bridgeWatcherLoop(Wallet &self,
 Status
 bridgeWatcherConnect(Wallet &self);
 
+/**
+ * Sets the window for coalescing transaction notifications.
+ * Zero turns batching off, so each transaction gets its own event.
+ */
+Status
+bridgeWatcherBatch(Wallet &self, unsigned windowMs);
+
 Status
 bridgeWatcherDisconnect(Wallet &self);
 
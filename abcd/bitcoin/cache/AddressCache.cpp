@@ -184,6 +184,16 @@ AddressCache::txids() const
     return knownTxids_;
 }
 
+bool
+AddressCache::hasTxid(const std::string &txid) const
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    for (const auto &row: rows_)
+        if (row.second.txids.count(txid))
+            return true;
+    return false;
+}
+
 void
 AddressCache::insert(const std::string &address, bool sweep)
 {
@@ -278,6 +288,21 @@ AddressCache::updateSpend(TxInfo &info)
     updateInternal();
 }
 
+void
+AddressCache::updatePushed(const std::string &address,
+                           const std::string &txid)
+{
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+    const auto i = rows_.find(address);
+    if (rows_.end() == i)
+        return;
+    i->second.insertTxid(txid);
+
+    // Fire callbacks:
+    updateInternal();
+}
+
 void
 AddressCache::updateSubscribe(const std::string &address)
 {
@@ -360,6 +385,7 @@ AddressCache::status(const std::string &address, const AddressRow &row,
     out.dirty = row.dirty;
     out.nextCheck = nextCheck(address, row);
     out.needsCheck = out.nextCheck <= now;
+    out.priority = !priorityAddress_.empty() && priorityAddress_ == address;
     out.count = row.txids.size();
 
     if (!row.complete)
@@ -34,6 +34,9 @@ struct AddressStatus
     /** True if this address hasn't been checked in a while. */
     bool needsCheck;
 
+    /** True if the user is waiting on this address. */
+    bool priority;
+
     /** The time of the next check. Used for sorting. */
     time_t nextCheck;
 
@@ -113,6 +116,13 @@ public:
     TxidSet
     txids() const;
 
+    /**
+     * True if the transaction appears in one of these addresses' histories,
+     * even if it or its inputs haven't arrived yet.
+     */
+    bool
+    hasTxid(const std::string &txid) const;
+
     // Updates -------------------------------------------------------------
 
     /**
@@ -146,6 +156,14 @@ public:
     void
     updateSpend(TxInfo &info);
 
+    /**
+     * Adds a transaction that the server pushed for an address.
+     * The push tells us everything a history fetch would,
+     * so the address does not become dirty.
+     */
+    void
+    updatePushed(const std::string &address, const std::string &txid);
+
     /**
      * Indicates that an address has been subscribed to,
      * so it's not really outdated.
@@ -6,6 +6,7 @@
  */
 
 #include "BlockCache.hpp"
+#include "TimestampCheckpoints.hpp"
 #include "../Utility.hpp"
 #include "../../crypto/Encoding.hpp"
 #include "../../json/JsonArray.hpp"
@@ -15,6 +16,7 @@
 namespace abcd {
 
 constexpr time_t onHeaderTimeout = 5;
+constexpr size_t timestampOffset = 68;
 
 struct BlockHeaderJson:
     public JsonObject
@@ -32,10 +34,12 @@ struct BlockCacheJson:
     ABC_JSON_VALUE(headers, "headers", JsonArray)
 };
 
-BlockCache::BlockCache(const std::string &path):
+BlockCache::BlockCache(const std::string &path,
+                       const std::string &headersPath):
     path_(path),
     dirty_(false),
-    height_(0)
+    height_(0),
+    headers_(headersPath)
 {
 }
 
@@ -44,20 +48,33 @@ BlockCache::clear()
 {
     std::lock_guard<std::mutex> lock(mutex_);
     height_ = 0;
-    headers_.clear();
+    headers_.clear().log();
     headersNeeded_.clear();
+    waiting_.clear();
+    arrived_.clear();
     dirty_ = true;
 }
 
+void
+BlockCache::checkpointsSet(const TimestampCheckpoints &checkpoints)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    checkpoints_ = &checkpoints;
+}
+
 Status
 BlockCache::load()
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
+    ABC_CHECK(headers_.open());
+
     BlockCacheJson json;
     ABC_CHECK(json.load(path_));
     height_ = json.height();
+    dirty_ = false;
 
+    // Move any headers from the old JSON format into the header store:
     auto headersJson = json.headers();
     size_t headersSize = headersJson.size();
     for (size_t i = 0; i < headersSize; i++)
@@ -70,11 +87,12 @@ BlockCache::load()
             bc::block_header_type header;
             ABC_CHECK(decodeHeader(header, rawHeader));
 
-            headers_[blockHeaderJson.height()] = std::move(header);
+            ABC_CHECK(headers_.insert(blockHeaderJson.height(), rawHeader));
         }
     }
+    if (headersSize)
+        dirty_ = true;
 
-    dirty_ = false;
     return Status();
 }
 
@@ -83,24 +101,11 @@ BlockCache::save()
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
+    // The header store writes itself, so we only save the height:
     if (dirty_)
     {
         BlockCacheJson json;
         ABC_CHECK(json.heightSet(height_));
-
-        JsonArray headersJson;
-        for (const auto &header: headers_)
-        {
-            bc::data_chunk rawHeader(satoshi_raw_size(header.second));
-            bc::satoshi_save(header.second, rawHeader.begin());
-
-            BlockHeaderJson blockHeaderJson;
-            ABC_CHECK(blockHeaderJson.heightSet(header.first));
-            ABC_CHECK(blockHeaderJson.headerSet(base64Encode(rawHeader)));
-            ABC_CHECK(headersJson.append(blockHeaderJson));
-        }
-        ABC_CHECK(json.headersSet(headersJson));
-
         ABC_CHECK(json.save(path_));
         dirty_ = false;
     }
@@ -142,31 +147,72 @@ BlockCache::headerTime(time_t &result, size_t height)
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto it = headers_.find(height);
-    if (it == headers_.end())
+    if (checkpoints().time(result, height))
+        return Status();
+
+    HeaderStore::Record rawHeader;
+    if (!headers_.get(rawHeader, height))
         return ABC_ERROR(ABC_CC_Synchronizing, "Header not available.");
 
-    result = it->second.timestamp;
+    result = bc::from_little_endian_unsafe<uint32_t>(
+                 rawHeader.begin() + timestampOffset);
     return Status();
 }
 
-bool
+Status
 BlockCache::headerInsert(size_t height, const bc::block_header_type &header)
 {
     std::unique_lock<std::mutex> lock(mutex_);
 
     // Do not stomp existing headers:
-    if (headers_.end() == headers_.find(height))
+    if (headers_.has(height))
+        return Status();
+
+    HeaderStore::Record rawHeader;
+    bc::satoshi_save(header, rawHeader.begin());
+    if (!checkpointMatch(height, rawHeader))
+        return ABC_ERROR(ABC_CC_ServerError,
+                         "Header does not match the checkpoints");
+    ABC_CHECK(headers_.insert(height, rawHeader));
+
+    ABC_DebugLog("Adding header %d", height);
+    headerArrived(height);
+
+    return Status();
+}
+
+Status
+BlockCache::headersInsert(size_t &count, size_t height, DataSlice rawHeaders)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    count = 0;
+
+    // Reject the whole run if any of it disagrees with the checkpoints:
+    const auto size = HeaderStore::recordSize;
+    for (size_t i = 0; (i + 1) * size <= rawHeaders.size(); ++i)
     {
-        ABC_DebugLog("Adding header %d", height);
-        headers_[height] = header;
-        dirty_ = true;
-        headersDirty_ = true;
+        const auto start = rawHeaders.data() + i * size;
+        if (!checkpointMatch(height + i, DataSlice(start, start + size)))
+            return ABC_ERROR(ABC_CC_ServerError,
+                             "Headers do not match the checkpoints");
+    }
 
-        return true;
+    for (size_t i = 0; (i + 1) * size <= rawHeaders.size(); ++i)
+    {
+        // Do not stomp existing headers:
+        if (headers_.has(height + i))
+            continue;
+
+        const auto start = rawHeaders.data() + i * size;
+        if (!headers_.insert(height + i, DataSlice(start, start + size)).log())
+            break;
+        headerArrived(height + i);
+        ++count;
     }
 
-    return false;
+    if (count)
+        ABC_DebugLog("Adding %d headers at %d", count, height);
+    return Status();
 }
 
 void
@@ -181,15 +227,22 @@ BlockCache::onHeaderInvoke(void)
 {
     std::unique_lock<std::mutex> lock(mutex_);
 
-    if (onHeader_ && headersDirty_)
+    if (onHeader_ && !arrived_.empty())
     {
         const auto now = time(nullptr);
         if (onHeaderTimeout <= now - onHeaderLastCall_)
         {
             ABC_DebugLog("onHeaderInvoke SENDING NOTIFICATION");
-            onHeader_();
             onHeaderLastCall_ = now;
-            headersDirty_ = false;
+
+            // The callback might need the cache, so release it first:
+            auto onHeader = onHeader_;
+            std::map<std::string, TxidSet> arrived;
+            arrived.swap(arrived_);
+            lock.unlock();
+
+            for (const auto &wallet: arrived)
+                onHeader(wallet.first, wallet.second);
         }
         else
         {
@@ -210,7 +263,7 @@ BlockCache::headerNeeded()
         headersNeeded_.erase(headersNeeded_.begin());
 
         // Only return the item if it is truly missing:
-        if (headers_.end() == headers_.find(out))
+        if (!headers_.has(out))
             return out;
     }
 
@@ -219,10 +272,86 @@ BlockCache::headerNeeded()
 }
 
 void
-BlockCache::headerNeededAdd(size_t height)
+BlockCache::headerNeededAdd(size_t height, const std::string &walletId,
+                            const std::string &txid)
 {
     std::unique_lock<std::mutex> lock(mutex_);
+
+    // Unconfirmed transactions have no header,
+    // and the checkpoints or the store might already have this one:
+    if (!height || checkpoints().has(height) || headers_.has(height))
+        return;
+
     headersNeeded_.insert(height);
+    if (!walletId.empty() && !txid.empty())
+        waiting_[height][walletId].insert(txid);
+}
+
+bool
+BlockCache::headerChunkNeeded(size_t &result, std::set<size_t> &heights,
+                              size_t chunkSize, size_t minimum)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // The set is sorted, so each chunk's heights are next to each other:
+    auto i = headersNeeded_.begin();
+    while (headersNeeded_.end() != i)
+    {
+        const auto chunk = *i / chunkSize;
+        const auto first = i;
+
+        size_t missing = 0;
+        for (; headersNeeded_.end() != i && *i / chunkSize == chunk; ++i)
+            if (!headers_.has(*i))
+                ++missing;
+
+        if (minimum <= missing)
+        {
+            heights = std::set<size_t>(first, i);
+            headersNeeded_.erase(first, i);
+            result = chunk;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const TimestampCheckpoints &
+BlockCache::checkpoints()
+{
+    if (!checkpoints_)
+        checkpoints_ = &TimestampCheckpoints::builtin();
+    return *checkpoints_;
+}
+
+bool
+BlockCache::checkpointMatch(size_t height, DataSlice rawHeader)
+{
+    time_t expected;
+    if (!checkpoints().time(expected, height))
+        return true;
+
+    const time_t timestamp = bc::from_little_endian_unsafe<uint32_t>(
+                                 rawHeader.begin() + timestampOffset);
+    if (expected == timestamp)
+        return true;
+
+    ABC_DebugLog("Header %d does not match the checkpoints", height);
+    return false;
+}
+
+void
+BlockCache::headerArrived(size_t height)
+{
+    auto i = waiting_.find(height);
+    if (waiting_.end() == i)
+        return;
+
+    for (const auto &wallet: i->second)
+        arrived_[wallet.first].insert(wallet.second.begin(),
+                                      wallet.second.end());
+    waiting_.erase(i);
 }
 
 } // namespace abcd
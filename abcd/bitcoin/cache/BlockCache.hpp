@@ -8,6 +8,8 @@
 #ifndef ABCD_BITCOIN_BLOCK_CACHE_HPP
 #define ABCD_BITCOIN_BLOCK_CACHE_HPP
 
+#include "HeaderStore.hpp"
+#include "../Typedefs.hpp"
 #include "../../util/Status.hpp"
 #include <bitcoin/bitcoin.hpp>
 #include <functional>
@@ -17,6 +19,8 @@
 
 namespace abcd {
 
+class TimestampCheckpoints;
+
 /**
  * A block-height cache.
  */
@@ -24,11 +28,17 @@ class BlockCache
 {
 public:
     typedef std::function<void (size_t height)> HeightCallback;
-    typedef std::function<void (void)> HeaderCallback;
+    typedef std::function<void (const std::string &walletId,
+                                const TxidSet &txids)> HeaderCallback;
 
     // Lifetime ------------------------------------------------------------
 
-    BlockCache(const std::string &path);
+    /**
+     * @param path The JSON file holding the chain height.
+     * @param headersPath The flat file holding the raw block headers.
+     * If this is empty, the headers are only kept in memory.
+     */
+    BlockCache(const std::string &path, const std::string &headersPath="");
 
     /**
      * Clears the cache in case something goes wrong.
@@ -38,6 +48,7 @@ public:
 
     /**
      * Reads the database contents from disk.
+     * Headers saved in the old JSON format are moved to the header store.
      */
     Status
     load();
@@ -48,6 +59,13 @@ public:
     Status
     save();
 
+    /**
+     * Replaces the built-in timestamp checkpoints.
+     * Heights covered by the checkpoints are never fetched from the network.
+     */
+    void
+    checkpointsSet(const TimestampCheckpoints &checkpoints);
+
     // Chain height --------------------------------------------------------
 
     /**
@@ -78,19 +96,31 @@ public:
 
     /**
      * Stores a block header in the cache.
+     * Fails if the header disagrees with the checkpoints.
      */
-    bool
+    Status
     headerInsert(size_t height, const libbitcoin::block_header_type &header);
 
     /**
-     * Provides a callback to be invoked when a new header is inserted.
+     * Stores a run of consecutive raw block headers in the cache,
+     * such as a chunk returned by a stratum server.
+     * Fails, storing nothing, if any header disagrees with the checkpoints.
+     * @param count Receives the number of headers that were new.
+     */
+    Status
+    headersInsert(size_t &count, size_t height, DataSlice rawHeaders);
+
+    /**
+     * Provides a callback to be invoked when new headers are inserted.
+     * The callback runs once for each wallet with transactions
+     * that were waiting on those headers, and lists just those transactions.
      */
     void
     onHeaderSet(const HeaderCallback &onHeader);
 
     /**
-     * Invokes the `onHeader` callback, but only if there are new headers,
-     * and enough time has elapsed.
+     * Invokes the `onHeader` callback, but only if there are transactions
+     * waiting to hear about new headers, and enough time has elapsed.
      */
     void
     onHeaderInvoke(void);
@@ -106,9 +136,23 @@ public:
 
     /**
      * Requests that a particular block header be added to the cache.
+     * @param walletId, txid The transaction waiting on this header,
+     * which will be named in the `onHeader` callback once it arrives.
      */
     void
-    headerNeededAdd(size_t height);
+    headerNeededAdd(size_t height, const std::string &walletId="",
+                    const std::string &txid="");
+
+    /**
+     * Finds a chunk of `chunkSize` headers containing at least `minimum`
+     * requested headers that are missing from the cache.
+     * The requested headers in that chunk are moved from the missing list
+     * into `heights`, so the caller can re-add them if the fetch fails.
+     * @return false if no chunk is worth fetching.
+     */
+    bool
+    headerChunkNeeded(size_t &result, std::set<size_t> &heights,
+                      size_t chunkSize, size_t minimum);
 
 private:
     mutable std::mutex mutex_;
@@ -120,13 +164,37 @@ private:
     HeightCallback onHeight_;
 
     // Chain headers:
-    std::map<size_t, libbitcoin::block_header_type> headers_;
-    bool headersDirty_ = false;
+    HeaderStore headers_;
     time_t onHeaderLastCall_ = 0;
     HeaderCallback onHeader_;
 
+    // Transactions waiting on headers, by height and then wallet:
+    std::map<size_t, std::map<std::string, TxidSet>> waiting_;
+    // Transactions whose headers have arrived, by wallet:
+    std::map<std::string, TxidSet> arrived_;
+
     // Missing headers:
     std::set<size_t> headersNeeded_;
+
+    // Built-in timestamps, loaded on first use:
+    const TimestampCheckpoints *checkpoints_ = nullptr;
+
+    const TimestampCheckpoints &
+    checkpoints();
+
+    /**
+     * Returns false if the raw header is covered by the checkpoints,
+     * but has the wrong timestamp.
+     */
+    bool
+    checkpointMatch(size_t height, DataSlice rawHeader);
+
+    /**
+     * Moves any transactions waiting on this height to the arrived list.
+     * Should be called with the mutex held.
+     */
+    void
+    headerArrived(size_t height);
 };
 
 } // namespace abcd
@@ -11,10 +11,12 @@
 
 namespace abcd {
 
-Cache::Cache(const std::string &path, BlockCache &blockCache):
-    txs(blockCache),
+Cache::Cache(const std::string &path, BlockCache &blockCache,
+             ServerCache &serverCache, const std::string &walletId):
+    txs(blockCache, walletId),
     blocks(blockCache),
     addresses(txs),
+    servers(serverCache),
     path_(path),
     addressCheckDone_(false)
 {
@@ -10,6 +10,7 @@
 
 #include "AddressCache.hpp"
 #include "BlockCache.hpp"
+#include "ServerCache.hpp"
 #include "TxCache.hpp"
 
 namespace abcd {
@@ -20,8 +21,10 @@ public:
     TxCache txs;
     BlockCache &blocks;
     AddressCache addresses;
+    ServerCache &servers;
 
-    Cache(const std::string &path, BlockCache &blockCache);
+    Cache(const std::string &path, BlockCache &blockCache,
+          ServerCache &serverCache, const std::string &walletId="");
 
     /**
      * Sets the address check done for this wallet meaning that
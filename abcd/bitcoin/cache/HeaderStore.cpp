@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "HeaderStore.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+namespace abcd {
+
+/**
+ * The file grows one difficulty period at a time,
+ * so we don't have to re-map it for every new header.
+ */
+constexpr size_t growRecords = 2016;
+
+static bool
+isEmpty(const uint8_t *record)
+{
+    return std::all_of(record, record + HeaderStore::recordSize,
+                       [](uint8_t byte) { return !byte; });
+}
+
+HeaderStore::~HeaderStore()
+{
+    unmap();
+    if (0 <= fd_)
+        close(fd_);
+}
+
+HeaderStore::HeaderStore(const std::string &path):
+    path_(path),
+    fd_(-1),
+    data_(nullptr),
+    size_(0)
+{
+}
+
+Status
+HeaderStore::open()
+{
+    if (path_.empty() || 0 <= fd_)
+        return Status();
+
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd_ < 0)
+        return ABC_ERROR(ABC_CC_FileOpenError, "Cannot open " + path_);
+
+    struct stat info;
+    if (fstat(fd_, &info) < 0)
+        return ABC_ERROR(ABC_CC_FileReadError, "Cannot stat " + path_);
+
+    // Ignore any partial record at the end of the file:
+    const size_t size = info.st_size - info.st_size % recordSize;
+    if (size)
+    {
+        void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd_, 0);
+        if (MAP_FAILED == data)
+            return ABC_ERROR(ABC_CC_FileReadError, "Cannot map " + path_);
+
+        data_ = static_cast<uint8_t *>(data);
+        size_ = size;
+    }
+
+    return Status();
+}
+
+Status
+HeaderStore::clear()
+{
+    unmap();
+    memory_.clear();
+
+    if (0 <= fd_ && ftruncate(fd_, 0) < 0)
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot truncate " + path_);
+
+    return Status();
+}
+
+bool
+HeaderStore::has(size_t height) const
+{
+    const size_t offset = height * recordSize;
+    if (size_ < offset + recordSize)
+        return false;
+
+    return !isEmpty(data_ + offset);
+}
+
+bool
+HeaderStore::get(Record &result, size_t height) const
+{
+    if (!has(height))
+        return false;
+
+    const auto *record = data_ + height * recordSize;
+    std::copy(record, record + recordSize, result.begin());
+    return true;
+}
+
+Status
+HeaderStore::insert(size_t height, DataSlice rawHeader)
+{
+    if (recordSize != rawHeader.size())
+        return ABC_ERROR(ABC_CC_ParseError, "Bad header size");
+
+    const size_t offset = height * recordSize;
+    ABC_CHECK(reserve(offset + recordSize));
+    memcpy(data_ + offset, rawHeader.data(), recordSize);
+
+    return Status();
+}
+
+Status
+HeaderStore::reserve(size_t size)
+{
+    if (size <= size_)
+        return Status();
+
+    // Round up to the next growth step:
+    const size_t step = growRecords * recordSize;
+    size = (size + step - 1) / step * step;
+
+    // Purely in-memory stores just resize their buffer:
+    if (fd_ < 0)
+    {
+        memory_.resize(size, 0);
+        data_ = memory_.data();
+        size_ = size;
+        return Status();
+    }
+
+    // The new space is a hole in the file, so it reads back as zeros:
+    if (ftruncate(fd_, size) < 0)
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot grow " + path_);
+
+    unmap();
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, 0);
+    if (MAP_FAILED == data)
+        return ABC_ERROR(ABC_CC_FileWriteError, "Cannot map " + path_);
+
+    data_ = static_cast<uint8_t *>(data);
+    size_ = size;
+    return Status();
+}
+
+void
+HeaderStore::unmap()
+{
+    if (0 <= fd_ && data_)
+        munmap(data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+} // namespace abcd
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Fixed-size on-disk storage for raw block headers.
+ */
+
+#ifndef ABCD_BITCOIN_CACHE_HEADER_STORE_HPP
+#define ABCD_BITCOIN_CACHE_HEADER_STORE_HPP
+
+#include "../../util/Data.hpp"
+#include "../../util/Status.hpp"
+#include <string>
+
+namespace abcd {
+
+/**
+ * A flat file of raw 80-byte block headers, indexed by height.
+ *
+ * The file is memory-mapped, so opening it costs nothing no matter
+ * how many headers it holds, and each new header is written in place
+ * at `height * recordSize`. Heights we have never fetched are holes
+ * in the file, which read back as all zeros.
+ *
+ * If the store has no path, it lives purely in memory.
+ */
+class HeaderStore
+{
+public:
+    static constexpr size_t recordSize = 80;
+    typedef DataArray<recordSize> Record;
+
+    ~HeaderStore();
+    HeaderStore(const std::string &path);
+
+    /**
+     * Maps the file into memory, creating it if it doesn't exist.
+     */
+    Status
+    open();
+
+    /**
+     * Erases all headers.
+     */
+    Status
+    clear();
+
+    /**
+     * Returns true if the store has a header at this height.
+     */
+    bool
+    has(size_t height) const;
+
+    /**
+     * Reads the raw header at this height.
+     * @return false if the header is missing.
+     */
+    bool
+    get(Record &result, size_t height) const;
+
+    /**
+     * Writes a raw header into the store at this height.
+     */
+    Status
+    insert(size_t height, DataSlice rawHeader);
+
+    HeaderStore(const HeaderStore &copy) = delete;
+    HeaderStore &operator=(const HeaderStore &copy) = delete;
+
+private:
+    const std::string path_;
+    int fd_;
+
+    // The mapped region (or the in-memory fallback):
+    uint8_t *data_;
+    size_t size_;
+    DataChunk memory_;
+
+    /**
+     * Grows the store so it has room for at least `size` bytes.
+     */
+    Status
+    reserve(size_t size);
+
+    /**
+     * Releases the current mapping, if any.
+     */
+    void
+    unmap();
+};
+
+} // namespace abcd
+
+#endif
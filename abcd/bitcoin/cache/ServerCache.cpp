@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "ServerCache.hpp"
+#include "../../json/JsonArray.hpp"
+#include "../../json/JsonObject.hpp"
+#include <stdlib.h>
+#include <algorithm>
+
+namespace abcd {
+
+// Latency samples kept per server:
+constexpr size_t maxLatencies = 32;
+
+// Once a server has this much history, old counts start to fade:
+constexpr double maxEvents = 200;
+
+// Scoring, in milliseconds:
+constexpr double unknownScore = 1000;
+constexpr double failurePenalty = 10000;
+constexpr double lagPenalty = 1000; // Per block behind
+constexpr double maxLag = 6; // Blocks, so a bad height can't bury a server
+
+// Chance of ignoring the scores and picking at random:
+constexpr int exploreOdds = 10; // One in ten
+
+struct ServerJson:
+    public JsonObject
+{
+    ABC_JSON_CONSTRUCTORS(ServerJson, JsonObject)
+
+    ABC_JSON_STRING(uri, "uri", nullptr)
+    ABC_JSON_NUMBER(connectTime, "connectTime", 0)
+    ABC_JSON_VALUE(latencies, "latencies", JsonArray)
+    ABC_JSON_NUMBER(replies, "replies", 0)
+    ABC_JSON_NUMBER(errors, "errors", 0)
+    ABC_JSON_NUMBER(timeouts, "timeouts", 0)
+    ABC_JSON_NUMBER(heightLag, "heightLag", 0)
+};
+
+struct ServerCacheJson:
+    public JsonObject
+{
+    ABC_JSON_VALUE(servers, "servers", JsonArray)
+};
+
+/**
+ * Returns the given percentile of some latency samples.
+ */
+static unsigned
+percentile(std::vector<unsigned> samples, double fraction)
+{
+    if (samples.empty())
+        return 0;
+
+    const auto n = std::min(samples.size() - 1,
+                            static_cast<size_t>(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return samples[n];
+}
+
+ServerCache::ServerCache(const std::string &path):
+    path_(path),
+    dirty_(false)
+{
+}
+
+Status
+ServerCache::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    ServerCacheJson json;
+    ABC_CHECK(json.load(path_));
+
+    auto serversJson = json.servers();
+    size_t size = serversJson.size();
+    for (size_t i = 0; i < size; i++)
+    {
+        ServerJson serverJson(serversJson[i]);
+        if (!serverJson.uriOk())
+            continue;
+
+        Server server;
+        server.connectTime = serverJson.connectTime();
+        server.replies = serverJson.replies();
+        server.errors = serverJson.errors();
+        server.timeouts = serverJson.timeouts();
+        server.heightLag = serverJson.heightLag();
+
+        auto latenciesJson = serverJson.latencies();
+        size_t latenciesSize = latenciesJson.size();
+        for (size_t j = 0; j < latenciesSize; j++)
+            server.latencies.push_back(
+                json_integer_value(latenciesJson[j].get()));
+
+        servers_[serverJson.uri()] = server;
+    }
+    dirty_ = false;
+
+    return Status();
+}
+
+Status
+ServerCache::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!dirty_ || path_.empty())
+        return Status();
+
+    JsonArray serversJson;
+    for (const auto &i: servers_)
+    {
+        JsonArray latenciesJson;
+        for (auto latency: i.second.latencies)
+            ABC_CHECK(latenciesJson.append(json_integer(latency)));
+
+        ServerJson serverJson;
+        ABC_CHECK(serverJson.uriSet(i.first));
+        ABC_CHECK(serverJson.connectTimeSet(i.second.connectTime));
+        ABC_CHECK(serverJson.latenciesSet(latenciesJson));
+        ABC_CHECK(serverJson.repliesSet(i.second.replies));
+        ABC_CHECK(serverJson.errorsSet(i.second.errors));
+        ABC_CHECK(serverJson.timeoutsSet(i.second.timeouts));
+        ABC_CHECK(serverJson.heightLagSet(i.second.heightLag));
+        ABC_CHECK(serversJson.append(serverJson));
+    }
+
+    ServerCacheJson json;
+    ABC_CHECK(json.serversSet(serversJson));
+    ABC_CHECK(json.save(path_));
+    dirty_ = false;
+
+    return Status();
+}
+
+void
+ServerCache::connected(const std::string &uri, Ms time)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto &server = servers_[uri];
+    server.connectTime = server.connectTime ?
+                         (3 * server.connectTime + time.count()) / 4 :
+                         time.count();
+    dirty_ = true;
+}
+
+void
+ServerCache::replied(const std::string &uri, Ms latency)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto &server = servers_[uri];
+    server.latencies.push_back(latency.count());
+    if (maxLatencies < server.latencies.size())
+        server.latencies.erase(server.latencies.begin());
+    server.replies += 1;
+    decay(server);
+    dirty_ = true;
+}
+
+void
+ServerCache::failed(const std::string &uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto &server = servers_[uri];
+    server.errors += 1;
+    decay(server);
+    dirty_ = true;
+}
+
+void
+ServerCache::timedOut(const std::string &uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto &server = servers_[uri];
+    server.timeouts += 1;
+    decay(server);
+    dirty_ = true;
+}
+
+void
+ServerCache::heightReported(const std::string &uri, size_t height)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    heights_[uri] = height;
+
+    // Measure against the median report, so one server claiming
+    // a huge height can't make all the honest ones look behind:
+    std::vector<size_t> heights;
+    for (const auto &i: heights_)
+        heights.push_back(i.second);
+    const auto n = (heights.size() - 1) / 2;
+    std::nth_element(heights.begin(), heights.begin() + n, heights.end());
+    const auto consensus = heights[n];
+    const double lag = height < consensus ? consensus - height : 0;
+
+    auto &server = servers_[uri];
+    server.heightLag = (3 * server.heightLag + lag) / 4;
+    dirty_ = true;
+}
+
+bool
+ServerCache::stats(Stats &result, const std::string &uri) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto i = servers_.find(uri);
+    if (servers_.end() == i)
+        return false;
+
+    const auto &server = i->second;
+    result.connectTime = Ms(static_cast<Ms::rep>(server.connectTime));
+    result.latency50 = Ms(percentile(server.latencies, 0.5));
+    result.latency90 = Ms(percentile(server.latencies, 0.9));
+    result.replies = server.replies;
+    result.errors = server.errors;
+    result.timeouts = server.timeouts;
+    result.heightLag = server.heightLag;
+    return true;
+}
+
+double
+ServerCache::score(const std::string &uri) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return scoreLocked(uri);
+}
+
+size_t
+ServerCache::pick(const std::vector<std::string> &candidates) const
+{
+    if (candidates.size() < 2)
+        return 0;
+
+    // Every so often, give an unlucky server another chance:
+    if (!(rand() % exploreOdds))
+        return rand() % candidates.size();
+
+    std::vector<double> weights;
+    double total = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto &uri: candidates)
+        {
+            // Squaring makes a server twice as fast four times as likely:
+            const auto score = std::max(1.0, scoreLocked(uri));
+            weights.push_back(1 / (score * score));
+            total += weights.back();
+        }
+    }
+
+    auto target = total * rand() / (RAND_MAX + 1.0);
+    for (size_t i = 0; i < weights.size(); ++i)
+    {
+        target -= weights[i];
+        if (target < 0)
+            return i;
+    }
+    return weights.size() - 1;
+}
+
+void
+ServerCache::decay(Server &server)
+{
+    if (server.replies + server.errors + server.timeouts < maxEvents)
+        return;
+
+    server.replies /= 2;
+    server.errors /= 2;
+    server.timeouts /= 2;
+}
+
+double
+ServerCache::scoreLocked(const std::string &uri) const
+{
+    auto measured = [](const Server &server) -> double
+    {
+        // Prefer real reply times, but connect times will do:
+        double latency;
+        if (!server.latencies.empty())
+            latency = percentile(server.latencies, 0.9);
+        else if (server.connectTime)
+            latency = 2 * server.connectTime;
+        else if (server.errors || server.timeouts)
+            latency = unknownScore;
+        else
+            return -1;
+
+        const auto events = server.replies + server.errors +
+                            2 * server.timeouts;
+        const auto failureRate = events ?
+                                 (server.errors + 2 * server.timeouts) / events :
+                                 0;
+        return latency + failurePenalty * failureRate +
+               lagPenalty * std::min(server.heightLag, maxLag);
+    };
+
+    auto i = servers_.find(uri);
+    if (servers_.end() != i)
+    {
+        const auto score = measured(i->second);
+        if (0 <= score)
+            return score;
+    }
+
+    // Unknown servers look as good as the median known server,
+    // so they get tried without displacing proven ones:
+    std::vector<double> scores;
+    for (const auto &server: servers_)
+    {
+        const auto score = measured(server.second);
+        if (0 <= score)
+            scores.push_back(score);
+    }
+    if (scores.empty())
+        return unknownScore;
+
+    std::nth_element(scores.begin(), scores.begin() + scores.size() / 2,
+                     scores.end());
+    return scores[scores.size() / 2];
+}
+
+} // namespace abcd
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Remembers how well each blockchain server has performed.
+ */
+
+#ifndef ABCD_BITCOIN_CACHE_SERVER_CACHE_HPP
+#define ABCD_BITCOIN_CACHE_SERVER_CACHE_HPP
+
+#include "../../util/Status.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * Per-server performance statistics, shared between wallets
+ * and persisted across sessions, so new sessions can start
+ * on the fastest healthy servers.
+ */
+class ServerCache
+{
+public:
+    typedef std::chrono::milliseconds Ms;
+
+    /**
+     * A summary of one server's history.
+     */
+    struct Stats
+    {
+        Ms connectTime;
+        Ms latency50;
+        Ms latency90;
+        double replies;
+        double errors;
+        double timeouts;
+        double heightLag;
+    };
+
+    /**
+     * @param path The JSON file to keep the statistics in.
+     * If this is empty, the statistics are only kept in memory.
+     */
+    ServerCache(const std::string &path);
+
+    /**
+     * Reads the statistics from disk.
+     */
+    Status
+    load();
+
+    /**
+     * Saves the statistics to disk, but only if there are changes.
+     */
+    Status
+    save();
+
+    // Measurements --------------------------------------------------------
+
+    void
+    connected(const std::string &uri, Ms time);
+
+    void
+    replied(const std::string &uri, Ms latency);
+
+    void
+    failed(const std::string &uri);
+
+    void
+    timedOut(const std::string &uri);
+
+    /**
+     * Records the chain height a server reports,
+     * so we can tell which servers are lagging behind the others.
+     */
+    void
+    heightReported(const std::string &uri, size_t height);
+
+    // Selection -----------------------------------------------------------
+
+    /**
+     * Summarizes a server's history.
+     * @return false if the server has never been measured.
+     */
+    bool
+    stats(Stats &result, const std::string &uri) const;
+
+    /**
+     * Returns the expected cost of using a server, in milliseconds.
+     * Lower is better. Unknown servers get an optimistic guess.
+     */
+    double
+    score(const std::string &uri) const;
+
+    /**
+     * Picks one of the candidates at random, strongly favoring
+     * the best scores, but occasionally exploring the others.
+     * @return An index into the candidate list.
+     */
+    size_t
+    pick(const std::vector<std::string> &candidates) const;
+
+private:
+    mutable std::mutex mutex_;
+    const std::string path_;
+    bool dirty_;
+
+    struct Server
+    {
+        double connectTime = 0; // Smoothed, zero if unknown
+        std::vector<unsigned> latencies; // Most recent last
+        double replies = 0;
+        double errors = 0;
+        double timeouts = 0;
+        double heightLag = 0; // Smoothed
+    };
+    std::map<std::string, Server> servers_;
+    std::map<std::string, size_t> heights_; // Latest reports, not saved
+
+    /**
+     * Ages out old counts so recent behavior dominates.
+     */
+    static void
+    decay(Server &server);
+
+    double
+    scoreLocked(const std::string &uri) const;
+};
+
+} // namespace abcd
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Generated by `abc-cli header-checkpoints`. Do not edit.
+ *
+ * This bundle is empty, so every header comes from the network,
+ * just as before. Fill it in with
+ * `make checkpoints CHECKPOINT_SERVER=<uri> CHECKPOINT_HEIGHT=<height>`,
+ * using a trusted stratum server.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace abcd {
+
+extern const size_t timestampBundleSize = 0;
+extern const uint8_t timestampBundle[] =
+{
+    0x00
+};
+
+} // namespace abcd
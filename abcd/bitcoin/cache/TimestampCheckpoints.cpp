@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "TimestampCheckpoints.hpp"
+#include "../Testnet.hpp"
+#include "../../util/Debug.hpp"
+#include <zlib.h>
+#include <mutex>
+
+namespace abcd {
+
+// Generated data, in TimestampBundle.cpp:
+extern const uint8_t timestampBundle[];
+extern const size_t timestampBundleSize;
+
+static void
+varintWrite(DataChunk &out, uint64_t value)
+{
+    while (0x80 <= value)
+    {
+        out.push_back(0x80 | (value & 0x7f));
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static bool
+varintRead(uint64_t &result, DataSlice &in)
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (in.empty())
+            return false;
+
+        const auto byte = in.data()[0];
+        in = DataSlice(in.data() + 1, in.end());
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            result = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+const TimestampCheckpoints &
+TimestampCheckpoints::builtin()
+{
+    static TimestampCheckpoints table;
+    static std::once_flag once;
+
+    std::call_once(once, []()
+    {
+        if (isTestnet())
+            return;
+        if (!timestampBundleSize)
+        {
+            ABC_DebugLog("No block timestamps are built in");
+            return;
+        }
+        table.decode(DataSlice(timestampBundle,
+                               timestampBundle + timestampBundleSize)).log();
+    });
+
+    return table;
+}
+
+Status
+TimestampCheckpoints::encode(DataChunk &result,
+                             const std::vector<uint32_t> &timestamps)
+{
+    DataChunk raw;
+    varintWrite(raw, timestamps.size());
+
+    int64_t last = 0;
+    for (auto timestamp: timestamps)
+    {
+        // Timestamps are not strictly increasing, so zigzag the deltas:
+        const int64_t delta = int64_t(timestamp) - last;
+        varintWrite(raw, (delta << 1) ^ (delta >> 63));
+        last = timestamp;
+    }
+
+    uLongf size = compressBound(raw.size());
+    DataChunk out(size);
+    if (Z_OK != compress2(out.data(), &size, raw.data(), raw.size(), 9))
+        return ABC_ERROR(ABC_CC_Error, "Cannot compress timestamps");
+    out.resize(size);
+
+    result = std::move(out);
+    return Status();
+}
+
+Status
+TimestampCheckpoints::decode(DataSlice bundle)
+{
+    timestamps_.clear();
+    if (bundle.empty())
+        return Status();
+
+    // Inflate the whole bundle:
+    z_stream stream {};
+    if (Z_OK != inflateInit(&stream))
+        return ABC_ERROR(ABC_CC_Error, "Cannot start decompression");
+    stream.next_in = const_cast<uint8_t *>(bundle.data());
+    stream.avail_in = bundle.size();
+
+    DataChunk raw;
+    int code = Z_OK;
+    while (Z_OK == code)
+    {
+        uint8_t buffer[16384];
+        stream.next_out = buffer;
+        stream.avail_out = sizeof(buffer);
+        code = inflate(&stream, Z_NO_FLUSH);
+        raw.insert(raw.end(), buffer, stream.next_out);
+    }
+    inflateEnd(&stream);
+    if (Z_STREAM_END != code)
+        return ABC_ERROR(ABC_CC_ParseError, "Bad timestamp bundle");
+
+    // Undo the delta encoding:
+    DataSlice in(raw);
+    uint64_t count;
+    if (!varintRead(count, in))
+        return ABC_ERROR(ABC_CC_ParseError, "Bad timestamp bundle");
+
+    std::vector<uint32_t> out;
+    out.reserve(count);
+    int64_t last = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t zigzag;
+        if (!varintRead(zigzag, in))
+            return ABC_ERROR(ABC_CC_ParseError, "Truncated timestamp bundle");
+
+        last += int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+        out.push_back(last);
+    }
+
+    timestamps_ = std::move(out);
+    return Status();
+}
+
+bool
+TimestampCheckpoints::time(time_t &result, size_t height) const
+{
+    if (!has(height))
+        return false;
+
+    result = timestamps_[height];
+    return true;
+}
+
+} // namespace abcd
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Historical block timestamps shipped with the library.
+ */
+
+#ifndef ABCD_BITCOIN_CACHE_TIMESTAMP_CHECKPOINTS_HPP
+#define ABCD_BITCOIN_CACHE_TIMESTAMP_CHECKPOINTS_HPP
+
+#include "../../util/Data.hpp"
+#include "../../util/Status.hpp"
+#include <time.h>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * A table of block timestamps, from the genesis block up to a checkpoint.
+ *
+ * The only thing the wallet needs from old block headers is their
+ * timestamp, so shipping these with the library means a fresh device
+ * only has to fetch headers for blocks after the checkpoint.
+ *
+ * The bundle format is a zlib-compressed stream of varints:
+ * the block count, followed by the zigzag-encoded difference
+ * between each block's timestamp and the one before it.
+ */
+class TimestampCheckpoints
+{
+public:
+    /**
+     * Returns the table compiled into the library,
+     * unpacking it the first time it is needed.
+     * The table is empty on testnet.
+     */
+    static const TimestampCheckpoints &
+    builtin();
+
+    /**
+     * Packs a list of timestamps, starting from the genesis block,
+     * into the compressed bundle format.
+     */
+    static Status
+    encode(DataChunk &result, const std::vector<uint32_t> &timestamps);
+
+    /**
+     * Unpacks a compressed bundle, replacing the table contents.
+     */
+    Status
+    decode(DataSlice bundle);
+
+    /**
+     * Returns the first height not covered by the table.
+     */
+    size_t
+    size() const { return timestamps_.size(); }
+
+    /**
+     * Returns true if the table covers this height.
+     */
+    bool
+    has(size_t height) const { return height < timestamps_.size(); }
+
+    /**
+     * Looks up the timestamp for a block.
+     * @return false if the table does not cover this height.
+     */
+    bool
+    time(time_t &result, size_t height) const;
+
+private:
+    std::vector<uint32_t> timestamps_;
+};
+
+} // namespace abcd
+
+#endif
@@ -163,8 +163,9 @@ struct HeightJson:
 };
 
 
-TxCache::TxCache(BlockCache &blockCache):
-    blocks_(blockCache)
+TxCache::TxCache(BlockCache &blockCache, const std::string &walletId):
+    blocks_(blockCache),
+    walletId_(walletId)
 {
 }
 
@@ -211,7 +212,8 @@ TxCache::load(JsonObject &json)
             info.height = heightJson.height();
             info.firstSeen = heightJson.firstSeen();
             heights_[heightJson.txid()] = info;
-            blocks_.headerNeededAdd(info.height);
+            blocks_.headerNeededAdd(info.height, walletId_,
+                                    heightJson.txid());
         }
     }
 
@@ -493,7 +495,7 @@ TxCache::confirmed(const std::string &txid, size_t height, time_t now)
 
     auto &info = heights_[txid];
     info.height = height;
-    blocks_.headerNeededAdd(height);
+    blocks_.headerNeededAdd(height, walletId_, txid);
     if (0 == info.firstSeen)
         info.firstSeen = now;
 }
@@ -84,7 +84,11 @@ class TxCache
 public:
     // Lifetime -----------------------------------------------------------
 
-    TxCache(BlockCache &blockCache);
+    /**
+     * @param walletId Identifies this wallet's transactions
+     * when it asks the block cache for headers.
+     */
+    TxCache(BlockCache &blockCache, const std::string &walletId="");
 
     /**
      * Clears the database for debugging purposes.
@@ -194,6 +198,7 @@ private:
     std::map<std::string, bc::transaction_type> txs_;
     std::map<std::string, HeightInfo> heights_;
     BlockCache &blocks_;
+    const std::string walletId_;
 
     /**
      * Same as `txInfo`, but should be called with the mutex held.
@@ -27,6 +27,18 @@ typedef std::function<void (const libbitcoin::transaction_type &tx)> TxCallback;
 typedef std::function<void (const libbitcoin::block_header_type &header)>
 HeaderCallback;
 
+/**
+ * Request classes. Interactive requests are the ones a user is waiting on,
+ * such as a prioritized address or a broadcast.
+ * Each connection reserves some room for these on top of its normal limits,
+ * so a big background sync can't hold them up.
+ */
+enum class Priority
+{
+    background,
+    interactive
+};
+
 /**
  * A connection to the Bitcoin network.
  * This combines the common features from both libbitcoin and Stratum.
@@ -44,9 +56,10 @@ public:
 
     /**
      * Returns true if the connection is saturated with outstanding requests.
+     * Interactive requests can also use the room reserved for them.
      */
     virtual bool
-    queueFull() = 0;
+    queueFull(Priority priority=Priority::background) = 0;
 
     /**
      * Begins watching for blockchain height changes.
@@ -62,7 +75,8 @@ public:
     virtual void
     addressSubscribe(const StatusCallback &onError,
                      const AddressUpdateCallback &onReply,
-                     const std::string &address) = 0;
+                     const std::string &address,
+                     Priority priority=Priority::background) = 0;
 
     /**
      * Returns true if the connection is subscribed to this address.
@@ -76,7 +90,8 @@ public:
     virtual void
     addressHistoryFetch(const StatusCallback &onError,
                         const AddressCallback &onReply,
-                        const std::string &address) = 0;
+                        const std::string &address,
+                        Priority priority=Priority::background) = 0;
 
     /**
      * Fetches the raw contents of a transaction.
@@ -84,7 +99,8 @@ public:
     virtual void
     txDataFetch(const StatusCallback &onError,
                 const TxCallback &onReply,
-                const std::string &txid) = 0;
+                const std::string &txid,
+                Priority priority=Priority::background) = 0;
 
     /**
      * Fetches the header for a block at a particular height.
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "InflightTable.hpp"
+
+namespace abcd {
+
+InflightTable::InflightTable():
+    stats_{0, 0}
+{
+}
+
+bool
+InflightTable::join(const std::string &key, const std::string &waiter)
+{
+    auto i = table_.find(key);
+    if (table_.end() == i)
+    {
+        table_[key].insert(waiter);
+        stats_.requests += 1;
+        stats_.sent += 1;
+        return true;
+    }
+
+    // Asking again for the same thing is not a new request:
+    if (i->second.insert(waiter).second)
+        stats_.requests += 1;
+    return false;
+}
+
+bool
+InflightTable::pending(const std::string &key) const
+{
+    return table_.count(key);
+}
+
+InflightTable::Waiters
+InflightTable::finish(const std::string &key)
+{
+    Waiters out;
+    auto i = table_.find(key);
+    if (table_.end() != i)
+    {
+        out.swap(i->second);
+        table_.erase(i);
+    }
+    return out;
+}
+
+void
+InflightTable::leave(const std::string &waiter)
+{
+    for (auto &i: table_)
+        i.second.erase(waiter);
+}
+
+} // namespace abcd
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Merges identical server requests while they are in flight.
+ */
+
+#ifndef ABCD_BITCOIN_NETWORK_INFLIGHT_TABLE_HPP
+#define ABCD_BITCOIN_NETWORK_INFLIGHT_TABLE_HPP
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace abcd {
+
+/**
+ * Tracks the requests currently on the wire, along with everyone
+ * waiting on each one, so a single reply can be fanned out
+ * to every wallet that asked.
+ * Requests are identified by a key such as "tx:<txid>".
+ */
+class InflightTable
+{
+public:
+    typedef std::set<std::string> Waiters;
+
+    struct Stats
+    {
+        /** Distinct waiters that asked for something. */
+        size_t requests;
+        /** Requests that actually went to a server. */
+        size_t sent;
+
+        /**
+         * The fraction of requests that were merged into another.
+         */
+        double
+        ratio() const
+        {
+            return requests ? 1 - static_cast<double>(sent) / requests : 0;
+        }
+    };
+
+    InflightTable();
+
+    /**
+     * Registers interest in a request.
+     * @return true if the request is new, so the caller should send it.
+     * Otherwise, the caller simply waits for the existing request.
+     */
+    bool
+    join(const std::string &key, const std::string &waiter="");
+
+    /**
+     * True if the request is on the wire.
+     */
+    bool
+    pending(const std::string &key) const;
+
+    /**
+     * Removes a request once it has succeeded or failed.
+     * @return Everyone who was waiting on it.
+     */
+    Waiters
+    finish(const std::string &key);
+
+    /**
+     * Drops a waiter from every request, such as when a wallet goes away.
+     * The requests themselves stay in flight.
+     */
+    void
+    leave(const std::string &waiter);
+
+    size_t size() const { return table_.size(); }
+    Stats stats() const { return stats_; }
+
+private:
+    std::map<std::string, Waiters> table_;
+    Stats stats_;
+};
+
+} // namespace abcd
+
+#endif
@@ -6,19 +6,37 @@
  */
 
 #include "LibbitcoinConnection.hpp"
+#include "../../crypto/Encoding.hpp"
 #include "../../util/Debug.hpp"
+#include <algorithm>
+#include <vector>
 
 namespace abcd {
 
 using namespace std::placeholders;
 
+// Every subscription gets renewed once per interval:
+constexpr auto renewInterval = std::chrono::minutes(8);
+
+// Renewals go out in batches, about this far apart:
+constexpr auto renewTick = std::chrono::seconds(10);
+constexpr size_t renewBatchMax = 10;
+
+// Queries allowed in flight, plus extra room for interactive ones:
+constexpr int maxQueries = 10;
+constexpr int interactiveQueries = 4;
+
 LibbitcoinConnection::LibbitcoinConnection(void *ctx):
     queuedQueries_(0),
+    renewCount_(0),
+    renewCountStart_(std::chrono::steady_clock::now()),
     socket_(std::make_shared<bc::client::zeromq_socket>(ctx)),
-    codec_(socket_,
+    out_(std::make_shared<Tap>(*this, TrafficRecorder::sent, *socket_)),
+    codec_(out_,
            std::bind(&LibbitcoinConnection::onUpdate, this, _1, _2, _3, _4),
            bc::client::obelisk_router::on_unknown_nop,
-           std::chrono::seconds(10), 0)
+           std::chrono::seconds(10), 0),
+    in_(*this, TrafficRecorder::received, codec_)
 {
 }
 
@@ -33,6 +51,63 @@ LibbitcoinConnection::connect(const std::string &uri, const std::string &key)
     return Status();
 }
 
+void
+LibbitcoinConnection::onTxPushSet(const TxPushCallback &callback)
+{
+    txPushCallback_ = callback;
+}
+
+void
+LibbitcoinConnection::recorderSet(std::shared_ptr<TrafficRecorder> recorder)
+{
+    recorder_ = recorder;
+    if (recorder_)
+        recorder_->record(TrafficRecorder::connected, uri_, DataSlice());
+}
+
+/**
+ * Formats a multi-part message as hex frames separated by colons.
+ */
+template <typename Stack>
+static std::string
+framesEncode(const Stack &frames)
+{
+    std::string out;
+    for (const auto &frame: frames)
+    {
+        if (!out.empty())
+            out += ':';
+        out += base16Encode(DataSlice(frame.data(),
+                                      frame.data() + frame.size()));
+    }
+    return out;
+}
+
+LibbitcoinConnection::Tap::Tap(LibbitcoinConnection &owner,
+                               TrafficRecorder::Type type,
+                               bc::client::message_stream &target):
+    owner_(owner),
+    type_(type),
+    target_(target)
+{
+}
+
+void
+LibbitcoinConnection::Tap::write(const bc::data_stack &data)
+{
+    if (owner_.recorder_)
+        owner_.recorder_->record(type_, owner_.uri_, framesEncode(data));
+    target_.write(data);
+}
+
+void
+LibbitcoinConnection::Tap::write_view(const bc::client::data_slice_stack &data)
+{
+    if (owner_.recorder_)
+        owner_.recorder_->record(type_, owner_.uri_, framesEncode(data));
+    target_.write_view(data);
+}
+
 std::chrono::milliseconds
 LibbitcoinConnection::wakeup()
 {
@@ -54,20 +129,32 @@ LibbitcoinConnection::wakeup()
         nextWakeup = period - elapsed;
     }
 
-    // Renew any outdated subscriptions:
-    for (auto &sub: addressSubscribes_)
+    // Renew subscriptions, spread evenly over the interval:
+    if (!addressSubscribes_.empty())
     {
-        if (sub.second.lastRefresh + std::chrono::minutes(8) < now)
+        if (nextRenew_ <= now)
         {
-            sub.second.lastRefresh = std::chrono::steady_clock::now();
-            renewAddress(sub.first);
+            renewBatch(now);
+            nextRenew_ = now + renewSpacing();
         }
-        // TODO: factor the time into nextWakeup. This isn't super-critical,
-        // since the height subscribes keep us awake.
+        const auto untilRenew = std::chrono::duration_cast<
+                                    std::chrono::milliseconds>(nextRenew_ - now);
+        nextWakeup = bc::client::min_sleep(nextWakeup, untilRenew +
+                                           std::chrono::milliseconds(1));
+    }
+
+    // Report the renewal rate once an hour:
+    if (renewCountStart_ + std::chrono::hours(1) <= now)
+    {
+        if (renewCount_)
+            ABC_DebugLog("%s: %d subscription renewals in the last hour",
+                         uri_.c_str(), renewCount_);
+        renewCount_ = 0;
+        renewCountStart_ = now;
     }
 
     // Handle the socket:
-    socket_->forward(codec_);
+    socket_->forward(in_);
     nextWakeup = bc::client::min_sleep(nextWakeup, codec_.wakeup());
 
     return nextWakeup;
@@ -79,6 +166,24 @@ LibbitcoinConnection::pollitem()
     return socket_->pollitem();
 }
 
+int
+LibbitcoinConnection::fd()
+{
+    int out = -1;
+    size_t size = sizeof(out);
+    zmq_getsockopt(pollitem().socket, ZMQ_FD, &out, &size);
+    return out;
+}
+
+bool
+LibbitcoinConnection::pending()
+{
+    int events = 0;
+    size_t size = sizeof(events);
+    zmq_getsockopt(pollitem().socket, ZMQ_EVENTS, &events, &size);
+    return events & ZMQ_POLLIN;
+}
+
 std::string
 LibbitcoinConnection::uri()
 {
@@ -86,9 +191,11 @@ LibbitcoinConnection::uri()
 }
 
 bool
-LibbitcoinConnection::queueFull()
+LibbitcoinConnection::queueFull(Priority priority)
 {
-    return 10 < queuedQueries_;
+    const auto limit = Priority::interactive == priority ?
+                       maxQueries + interactiveQueries : maxQueries;
+    return limit < queuedQueries_;
 }
 
 void
@@ -105,7 +212,8 @@ LibbitcoinConnection::heightSubscribe(const StatusCallback &onError,
 void
 LibbitcoinConnection::addressSubscribe(const StatusCallback &onError,
                                        const AddressUpdateCallback &onReply,
-                                       const std::string &address)
+                                       const std::string &address,
+                                       Priority priority)
 {
     bc::payment_address parsed;
     if (!parsed.set_encoded(address))
@@ -114,11 +222,18 @@ LibbitcoinConnection::addressSubscribe(const StatusCallback &onError,
     // Add the callback to our subscription list:
     if (addressSubscribes_.count(address))
         return;
+    const auto now = std::chrono::steady_clock::now();
     addressSubscribes_[address] = AddressSubscribe
     {
-        onReply, std::chrono::steady_clock::now()
+        onReply, now
     };
 
+    // More subscriptions means renewing more often:
+    if (1 == addressSubscribes_.size())
+        nextRenew_ = now + renewSpacing();
+    else
+        nextRenew_ = std::min(nextRenew_, now + renewSpacing());
+
     auto errorShim = [this, onError, address](const std::error_code &error)
     {
         --queuedQueries_;
@@ -145,7 +260,8 @@ LibbitcoinConnection::addressSubscribed(const std::string &address)
 void
 LibbitcoinConnection::addressHistoryFetch(const StatusCallback &onError,
         const AddressCallback &onReply,
-        const std::string &address)
+        const std::string &address,
+        Priority priority)
 {
     bc::payment_address parsed;
     if (!parsed.set_encoded(address))
@@ -178,7 +294,8 @@ LibbitcoinConnection::addressHistoryFetch(const StatusCallback &onError,
 void
 LibbitcoinConnection::txDataFetch(const StatusCallback &onError,
                                   const TxCallback &onReply,
-                                  const std::string &txid)
+                                  const std::string &txid,
+                                  Priority priority)
 {
     bc::hash_digest parsed;
     if (!bc::decode_hash(parsed, txid))
@@ -251,6 +368,53 @@ LibbitcoinConnection::fetchHeight()
     codec_.fetch_last_height(errorShim, replyShim);
 }
 
+std::chrono::steady_clock::duration
+LibbitcoinConnection::renewSpacing()
+{
+    if (addressSubscribes_.empty())
+        return renewInterval;
+    const std::chrono::steady_clock::duration interval = renewInterval;
+    return interval * renewBatchSize() / addressSubscribes_.size();
+}
+
+size_t
+LibbitcoinConnection::renewBatchSize()
+{
+    // Enough per tick to get through everything once per interval:
+    const size_t ticks = renewInterval / renewTick;
+    const size_t size = (addressSubscribes_.size() + ticks - 1) / ticks;
+    return std::max<size_t>(1, std::min(renewBatchMax, size));
+}
+
+void
+LibbitcoinConnection::renewBatch(std::chrono::steady_clock::time_point now)
+{
+    // Renew the subscriptions that have gone the longest:
+    typedef decltype(addressSubscribes_)::iterator Iterator;
+    std::vector<Iterator> oldest;
+    for (auto i = addressSubscribes_.begin(); i != addressSubscribes_.end();
+            ++i)
+        oldest.push_back(i);
+
+    const auto size = std::min(renewBatchSize(), oldest.size());
+    std::partial_sort(oldest.begin(), oldest.begin() + size, oldest.end(),
+                      [](Iterator a, Iterator b)
+    {
+        return a->second.lastRefresh < b->second.lastRefresh;
+    });
+    oldest.resize(size);
+
+    // Copy the addresses, since a failed renewal erases its entry:
+    std::vector<std::string> addresses;
+    for (auto i: oldest)
+    {
+        i->second.lastRefresh = now;
+        addresses.push_back(i->first);
+    }
+    for (const auto &address: addresses)
+        renewAddress(address);
+}
+
 void
 LibbitcoinConnection::renewAddress(const std::string &address)
 {
@@ -268,6 +432,7 @@ LibbitcoinConnection::renewAddress(const std::string &address)
     };
 
     ++queuedQueries_;
+    ++renewCount_;
     codec_.renew(errorShim, replyShim, bc::payment_address(address));
 }
 
@@ -277,7 +442,13 @@ LibbitcoinConnection::onUpdate(const bc::payment_address &address,
                                const bc::transaction_type &tx)
 {
     const auto i = addressSubscribes_.find(address.encoded());
-    if (addressSubscribes_.end() != i)
+    if (addressSubscribes_.end() == i)
+        return;
+
+    // The update carries the whole transaction, so use it if we can:
+    if (txPushCallback_)
+        txPushCallback_(i->first, height, tx);
+    else
         i->second.onReply("");
 }
 
@@ -9,6 +9,7 @@
 #define ABCD_BITCOIN_NETWORK_LIBBITCOIN_CONNECTION_HPP
 
 #include "IBitcoinConnection.hpp"
+#include "TrafficRecorder.hpp"
 #include "../../../minilibs/libbitcoin-client/client.hpp"
 
 namespace abcd {
@@ -21,11 +22,40 @@ class LibbitcoinConnection:
     public IBitcoinConnection
 {
 public:
+    typedef std::function<void (const std::string &address, size_t height,
+                                const bc::transaction_type &tx)>
+    TxPushCallback;
+
     LibbitcoinConnection(void *ctx);
 
+    /**
+     * Sets up a callback to receive the transactions
+     * that the server pushes along with subscription updates.
+     * Without this, an update only marks the address as changed.
+     */
+    void
+    onTxPushSet(const TxPushCallback &callback);
+
+    /**
+     * Copies every message to the recorder, or stops if it is null.
+     */
+    void
+    recorderSet(std::shared_ptr<TrafficRecorder> recorder);
+
     Status connect(const std::string &uri, const std::string &key);
     zmq_pollitem_t pollitem();
 
+    /**
+     * The file descriptor zeromq uses to signal socket activity.
+     * This only signals changes, so check `pending` after sending.
+     */
+    int fd();
+
+    /**
+     * True if replies are waiting to be read.
+     */
+    bool pending();
+
     // Sleeper interface:
     std::chrono::milliseconds wakeup() override;
 
@@ -34,7 +64,7 @@ public:
     uri() override;
 
     bool
-    queueFull() override;
+    queueFull(Priority priority=Priority::background) override;
 
     void
     heightSubscribe(const StatusCallback &onError,
@@ -43,7 +73,8 @@ public:
     void
     addressSubscribe(const StatusCallback &onError,
                      const AddressUpdateCallback &onReply,
-                     const std::string &address) override;
+                     const std::string &address,
+                     Priority priority=Priority::background) override;
 
     bool
     addressSubscribed(const std::string &address) override;
@@ -51,12 +82,14 @@ public:
     void
     addressHistoryFetch(const StatusCallback &onError,
                         const AddressCallback &onReply,
-                        const std::string &address) override;
+                        const std::string &address,
+                        Priority priority=Priority::background) override;
 
     void
     txDataFetch(const StatusCallback &onError,
                 const TxCallback &onReply,
-                const std::string &txid) override;
+                const std::string &txid,
+                Priority priority=Priority::background) override;
 
     void
     blockHeaderFetch(const StatusCallback &onError,
@@ -81,14 +114,61 @@ private:
         std::chrono::steady_clock::time_point lastRefresh;
     };
     std::map<std::string, AddressSubscribe> addressSubscribes_;
+    TxPushCallback txPushCallback_;
+
+    // Renewal schedule:
+    std::chrono::steady_clock::time_point nextRenew_;
+    size_t renewCount_;
+    std::chrono::steady_clock::time_point renewCountStart_;
+
+    /**
+     * Passes obelisk messages along, copying them to the recorder.
+     */
+    class Tap:
+        public bc::client::message_stream
+    {
+    public:
+        Tap(LibbitcoinConnection &owner, TrafficRecorder::Type type,
+            bc::client::message_stream &target);
+
+        void
+        write(const bc::data_stack &data) override;
+
+        void
+        write_view(const bc::client::data_slice_stack &data) override;
+
+    private:
+        LibbitcoinConnection &owner_;
+        TrafficRecorder::Type type_;
+        bc::client::message_stream &target_;
+    };
+    std::shared_ptr<TrafficRecorder> recorder_;
 
     // The actual obelisk connection (destructor called first):
     std::shared_ptr<bc::client::zeromq_socket> socket_;
+    std::shared_ptr<Tap> out_;
     bc::client::obelisk_codec codec_;
+    Tap in_;
 
     void
     fetchHeight();
 
+    /**
+     * The time between renewal batches,
+     * so every subscription gets renewed once per interval.
+     */
+    std::chrono::steady_clock::duration
+    renewSpacing();
+
+    size_t
+    renewBatchSize();
+
+    /**
+     * Renews the subscriptions that have gone the longest.
+     */
+    void
+    renewBatch(std::chrono::steady_clock::time_point now);
+
     void
     renewAddress(const std::string &address);
 
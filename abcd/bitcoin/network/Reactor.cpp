@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "Reactor.hpp"
+#include <errno.h>
+#include <unistd.h>
+#ifdef ABC_REACTOR_EPOLL
+#include <sys/epoll.h>
+#endif
+
+namespace abcd {
+
+// The most events handled per wait:
+constexpr int maxEvents = 64;
+
+#ifdef ABC_REACTOR_EPOLL
+static uint32_t
+epollEvents(short events)
+{
+    uint32_t out = 0;
+    if (events & POLLIN)
+        out |= EPOLLIN;
+    if (events & POLLOUT)
+        out |= EPOLLOUT;
+    return out;
+}
+
+static short
+pollEvents(uint32_t events)
+{
+    short out = 0;
+    if (events & EPOLLIN)
+        out |= POLLIN;
+    if (events & EPOLLOUT)
+        out |= POLLOUT;
+    if (events & EPOLLERR)
+        out |= POLLERR;
+    if (events & EPOLLHUP)
+        out |= POLLHUP;
+    return out;
+}
+#endif
+
+Reactor::~Reactor()
+{
+#ifdef ABC_REACTOR_EPOLL
+    if (0 <= epoll_)
+        close(epoll_);
+#endif
+}
+
+Reactor::Reactor():
+    lastTimer_(0)
+{
+#ifdef ABC_REACTOR_EPOLL
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+#endif
+}
+
+Status
+Reactor::watch(int fd, short events, const Handler &handler)
+{
+    auto i = watches_.find(fd);
+    const bool exists = watches_.end() != i;
+
+    // Only touch the kernel if the events have changed:
+    if (!exists || i->second.events != events)
+    {
+#ifdef ABC_REACTOR_EPOLL
+        if (epoll_ < 0)
+            return ABC_ERROR(ABC_CC_SysError, "Cannot create epoll instance");
+
+        struct epoll_event event {};
+        event.events = epollEvents(events);
+        event.data.fd = fd;
+
+        // The kernel forgets closed descriptors on its own,
+        // so our idea of what is registered might be out of date:
+        int s = epoll_ctl(epoll_, exists ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                          fd, &event);
+        if (s < 0 && ENOENT == errno)
+            s = epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+        if (s < 0 && EEXIST == errno)
+            s = epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event);
+        if (s < 0)
+            return ABC_ERROR(ABC_CC_SysError, "Cannot watch socket");
+#else
+        if (exists)
+        {
+            pollfds_[pollIndex_[fd]].events = events;
+        }
+        else
+        {
+            pollIndex_[fd] = pollfds_.size();
+            pollfds_.push_back(pollfd{ fd, events, 0 });
+        }
+#endif
+    }
+
+    watches_[fd] = Watch{ events, handler };
+    return Status();
+}
+
+void
+Reactor::unwatch(int fd)
+{
+    if (!watches_.erase(fd))
+        return;
+
+#ifdef ABC_REACTOR_EPOLL
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+#else
+    // Swap the last entry into the hole:
+    auto index = pollIndex_[fd];
+    pollfds_[index] = pollfds_.back();
+    pollIndex_[pollfds_[index].fd] = index;
+    pollfds_.pop_back();
+    pollIndex_.erase(fd);
+#endif
+}
+
+Reactor::TimerId
+Reactor::timerAdd(Clock::time_point when, const TimerCallback &callback)
+{
+    const auto id = ++lastTimer_;
+    timers_[id] = callback;
+    timerHeap_.push(TimerEntry(when, id));
+    return id;
+}
+
+void
+Reactor::timerCancel(TimerId id)
+{
+    timers_.erase(id);
+}
+
+Status
+Reactor::run(std::chrono::milliseconds timeout)
+{
+    // Timers that are already due don't need to wait:
+    bool fired;
+    auto nextTimer = timersRun(fired);
+    if (nextTimer.count() && (!timeout.count() || nextTimer < timeout))
+        timeout = nextTimer;
+    int delay = timeout.count() ? timeout.count() : -1;
+
+    // Those timers may have queued work, so let the caller see it
+    // right away, rather than after the next event:
+    if (fired)
+        delay = 0;
+
+#ifdef ABC_REACTOR_EPOLL
+    struct epoll_event events[maxEvents];
+    const int count = epoll_wait(epoll_, events, maxEvents, delay);
+    if (count < 0 && EINTR != errno)
+        return ABC_ERROR(ABC_CC_SysError, "epoll_wait failed");
+
+    for (int i = 0; i < count; ++i)
+        dispatch(events[i].data.fd, pollEvents(events[i].events));
+#else
+    const int count = poll(pollfds_.data(), pollfds_.size(), delay);
+    if (count < 0 && EINTR != errno)
+        return ABC_ERROR(ABC_CC_SysError, "poll failed");
+
+    // Handlers can change the list, so gather the ready ones first:
+    std::vector<struct pollfd> ready;
+    for (const auto &item: pollfds_)
+        if (item.revents)
+            ready.push_back(item);
+    for (const auto &item: ready)
+        dispatch(item.fd, item.revents);
+#endif
+
+    timersRun(fired);
+    return Status();
+}
+
+void
+Reactor::dispatch(int fd, short revents)
+{
+    // An earlier handler might have removed this one:
+    auto i = watches_.find(fd);
+    if (watches_.end() == i)
+        return;
+
+    // Copy the handler, since it may unwatch itself:
+    const auto handler = i->second.handler;
+    handler(revents);
+}
+
+std::chrono::milliseconds
+Reactor::timersRun(bool &fired)
+{
+    fired = false;
+    while (!timerHeap_.empty())
+    {
+        const auto top = timerHeap_.top();
+        auto i = timers_.find(top.second);
+        if (timers_.end() == i)
+        {
+            // Cancelled:
+            timerHeap_.pop();
+            continue;
+        }
+
+        const auto now = Clock::now();
+        if (now < top.first)
+        {
+            // Round up, so we never wake a hair too early:
+            auto sleep = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             top.first - now);
+            return sleep + std::chrono::milliseconds(1);
+        }
+
+        const auto callback = i->second;
+        timers_.erase(i);
+        timerHeap_.pop();
+        fired = true;
+        callback();
+    }
+
+    return std::chrono::milliseconds(0);
+}
+
+} // namespace abcd
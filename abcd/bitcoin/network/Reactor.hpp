@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A persistent socket and timer event loop.
+ */
+
+#ifndef ABCD_BITCOIN_NETWORK_REACTOR_HPP
+#define ABCD_BITCOIN_NETWORK_REACTOR_HPP
+
+#include "../../util/Status.hpp"
+#include <poll.h>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Linux gets epoll, everything else falls back on poll:
+#if defined(__linux__) && !defined(ABC_REACTOR_POLL)
+#define ABC_REACTOR_EPOLL 1
+#endif
+
+namespace abcd {
+
+/**
+ * Waits on a set of file descriptors and timers, calling a handler
+ * for each one that becomes ready.
+ * Registrations persist between waits, so the cost of each wakeup
+ * is proportional to the number of ready events,
+ * not the number of sockets being watched.
+ * This is not thread-safe; one thread should own the reactor.
+ */
+class Reactor
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void (short revents)> Handler;
+    typedef std::function<void ()> TimerCallback;
+    typedef uint64_t TimerId;
+
+    ~Reactor();
+    Reactor();
+
+    /**
+     * Starts watching a file descriptor, or changes an existing watch.
+     * @param events A mask of `POLLIN` and `POLLOUT`.
+     * @param handler Receives the ready events, in `poll` terms.
+     * Errors and hang-ups are reported as `POLLERR` and `POLLHUP`.
+     */
+    Status
+    watch(int fd, short events, const Handler &handler);
+
+    /**
+     * Stops watching a file descriptor.
+     * Call this before closing the descriptor.
+     */
+    void
+    unwatch(int fd);
+
+    /**
+     * Schedules a callback to run once at the given time.
+     */
+    TimerId
+    timerAdd(Clock::time_point when, const TimerCallback &callback);
+
+    /**
+     * Cancels a timer. Cancelling a timer that has already fired is fine.
+     */
+    void
+    timerCancel(TimerId id);
+
+    /**
+     * Waits until something is ready, and then runs the handlers.
+     * Returns without waiting if a due timer ran first,
+     * so the caller can act on whatever the timer did.
+     * @param timeout The longest to wait, or zero to wait until
+     * the next timer or event, however long that takes.
+     */
+    Status
+    run(std::chrono::milliseconds timeout);
+
+    size_t watchCount() const { return watches_.size(); }
+    size_t timerCount() const { return timers_.size(); }
+
+    Reactor(const Reactor &copy) = delete;
+    Reactor &operator=(const Reactor &copy) = delete;
+
+private:
+    struct Watch
+    {
+        short events;
+        Handler handler;
+    };
+    std::unordered_map<int, Watch> watches_;
+
+#ifdef ABC_REACTOR_EPOLL
+    int epoll_;
+#else
+    std::vector<struct pollfd> pollfds_;
+    std::unordered_map<int, size_t> pollIndex_;
+#endif
+
+    // Timers, soonest first. Cancelled timers stay in the heap
+    // until they reach the top, but leave the callback map right away:
+    typedef std::pair<Clock::time_point, TimerId> TimerEntry;
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>,
+        std::greater<TimerEntry>> timerHeap_;
+    std::unordered_map<TimerId, TimerCallback> timers_;
+    TimerId lastTimer_;
+
+    /**
+     * Runs the handler for a ready file descriptor, if still watched.
+     */
+    void
+    dispatch(int fd, short revents);
+
+    /**
+     * Runs the timers that are due.
+     * @param fired Set to true if any timer ran.
+     * @return The time until the next timer, or zero if there are none.
+     */
+    std::chrono::milliseconds
+    timersRun(bool &fired);
+};
+
+} // namespace abcd
+
+#endif
@@ -12,12 +12,49 @@
 #include "../../json/JsonArray.hpp"
 #include "../../json/JsonObject.hpp"
 #include "../../util/Debug.hpp"
+#include <string.h>
 #include <algorithm>
 
 namespace abcd {
 
 constexpr std::chrono::seconds keepaliveTime(60);
 constexpr std::chrono::seconds timeout(10);
+constexpr size_t maxBatchSize = 50;
+
+// Congestion window, in round trips:
+constexpr double startWindow = 10;
+constexpr double minWindow = 2;
+constexpr double maxWindow = 64;
+
+// Extra round trips held back for interactive requests:
+constexpr double interactiveWindow = 4;
+
+// Timeouts in a row before we give up on the socket:
+constexpr unsigned maxTimeouts = 3;
+
+/**
+ * True for the requests that public servers rate-limit.
+ */
+static bool
+pacedMethod(const std::string &method)
+{
+    return "blockchain.address.subscribe" == method ||
+           "blockchain.address.get_history" == method;
+}
+
+/**
+ * Picks a reply deadline based on how much work the server has to do.
+ */
+static SleepTime
+defaultTimeout(const std::string &method)
+{
+    if ("blockchain.address.get_history" == method ||
+            "blockchain.block.get_chunk" == method)
+        return std::chrono::seconds(30);
+    if ("blockchain.transaction.broadcast" == method)
+        return std::chrono::seconds(20);
+    return timeout;
+}
 
 struct RequestJson:
     public JsonObject
@@ -44,8 +81,11 @@ struct HeaderJson:
 struct ReplyJson:
     public JsonObject
 {
+    ABC_JSON_CONSTRUCTORS(ReplyJson, JsonObject)
+
     ABC_JSON_INTEGER(id, "id", 0)
     ABC_JSON_VALUE(result, "result", JsonPtr);
+    ABC_JSON_VALUE(error, "error", JsonPtr);
 
     // Only used on subscription updates:
     ABC_JSON_STRING(method, "method", "");
@@ -55,7 +95,49 @@ struct ReplyJson:
 StratumConnection::~StratumConnection()
 {
     for (auto &i: pending_)
-        i.second.onError(ABC_ERROR(ABC_CC_Error, "Connection closed"));
+        i.second.onError(ABC_ERROR(ABC_CC_Cancelled, "Connection closed"));
+}
+
+StratumConnection::StratumConnection():
+    window_(startWindow)
+{
+}
+
+void
+StratumConnection::timeoutSet(const std::string &method, SleepTime timeout)
+{
+    methodTimeouts_[method] = timeout;
+}
+
+SleepTime
+StratumConnection::latency() const
+{
+    return SleepTime(static_cast<SleepTime::rep>(rtt_));
+}
+
+void
+StratumConnection::onLatencySet(const LatencyCallback &callback)
+{
+    latencyCallback_ = callback;
+}
+
+void
+StratumConnection::paceSet(double rate, double burst)
+{
+    pace_.rateSet(rate, burst);
+
+    // Anything held back can go out now:
+    if (pace_.unlimited())
+    {
+        queued_.insert(queued_.end(), paced_.begin(), paced_.end());
+        paced_.clear();
+    }
+}
+
+SleepTime
+StratumConnection::paceWait()
+{
+    return pace_.wait(paced_.size() + 1);
 }
 
 void
@@ -98,6 +180,32 @@ StratumConnection::feeEstimateFetch(const StatusCallback &onError,
     sendMessage("blockchain.estimatefee", params, onError, decoder);
 }
 
+void
+StratumConnection::blockHeaderChunkFetch(const StatusCallback &onError,
+                                         const HeaderChunkCallback &onReply,
+                                         size_t chunk)
+{
+    JsonArray params;
+    params.append(json_integer(chunk));
+
+    auto decoder = [onReply](JsonPtr payload) -> Status
+    {
+        if (!json_is_string(payload.get()))
+            return ABC_ERROR(ABC_CC_JSONError, "Bad reply format");
+
+        DataChunk rawHeaders;
+        if (!base16Decode(rawHeaders, json_string_value(payload.get())))
+            return ABC_ERROR(ABC_CC_ParseError, "Bad header chunk format");
+        if (rawHeaders.size() % 80)
+            return ABC_ERROR(ABC_CC_ParseError, "Bad header chunk size");
+
+        onReply(rawHeaders);
+        return Status();
+    };
+
+    sendMessage("blockchain.block.get_chunk", params, onError, decoder);
+}
+
 void
 StratumConnection::sendTx(const StatusCallback &onDone, DataSlice tx)
 {
@@ -118,7 +226,8 @@ StratumConnection::sendTx(const StatusCallback &onDone, DataSlice tx)
         return Status();
     };
 
-    sendMessage("blockchain.transaction.broadcast", params, onDone, decoder);
+    sendMessage("blockchain.transaction.broadcast", params, onDone, decoder,
+                Priority::interactive);
 }
 
 Status
@@ -140,32 +249,91 @@ StratumConnection::connect(const std::string &rawUri)
     auto serverName = server.substr(0, last);
     auto serverPort = server.substr(last + 1, std::string::npos);
 
-    // Connect to the server:
+    // Start connecting to the server.
+    // Requests wait in the queue until this finishes:
     ABC_CHECK(connection_.connect(serverName, atoi(serverPort.c_str())));
     lastKeepalive_ = std::chrono::steady_clock::now();
 
     return Status();
 }
 
+Status
+StratumConnection::probe()
+{
+    // Probe for batch support with a harmless one-item batch.
+    // Other requests go out one by one until we know the answer:
+    probeId_ = lastId++;
+    RequestJson request;
+    request.idSet(probeId_);
+    request.methodSet("server.version");
+    request.paramsSet(JsonArray());
+    ABC_CHECK(send("[" + request.encode(true) + "]\n"));
+
+    auto onError = [this](Status s)
+    {
+        if (Batching::unknown == batching_)
+            batching_ = Batching::no;
+    };
+    auto decoder = [](JsonPtr payload) -> Status
+    {
+        return Status();
+    };
+    const auto trip = ++lastTrip_;
+    trips_[trip] = 1;
+    pending_[probeId_] = Pending
+    {
+        onError, decoder, methodTimeout("server.version"), trip,
+        std::chrono::steady_clock::now()
+    };
+
+    return Status();
+}
+
 Status
 StratumConnection::wakeup(SleepTime &sleep)
 {
+    // Finish connecting before anything else:
+    if (!connection_.connected())
+    {
+        ABC_CHECK(connection_.wakeup(sleep));
+        if (!connection_.connected())
+            return Status();
+
+        ABC_DebugLog("Stratum connection to %s established", uri_.c_str());
+        lastKeepalive_ = std::chrono::steady_clock::now();
+        ABC_CHECK(probe());
+
+        // Send whatever piled up while we were connecting:
+        ABC_CHECK(flush());
+    }
+    else
+    {
+        // Finish any sends the socket couldn't take earlier:
+        ABC_CHECK(connection_.wakeup(sleep));
+    }
+
     // Read any data available on the socket:
-    DataChunk buffer;
-    ABC_CHECK(connection_.read(buffer));
-    incoming_ += std::string(buffer.begin(), buffer.end());
+    ABC_CHECK(connection_.read(incoming_));
 
     // Extract any incoming messages:
     while (true)
     {
-        // Find the newline:
-        auto where = std::find(incoming_.begin(), incoming_.end(), '\n');
-        if (incoming_.end() == where)
+        // Find the newline, skipping what we have already searched:
+        const auto data = incoming_.data();
+        const auto where = static_cast<const uint8_t *>(
+                               memchr(data.data() + scanned_, '\n',
+                                      data.size() - scanned_));
+        if (!where)
+        {
+            scanned_ = data.size();
             break;
+        }
 
-        // Extract and process the message:
-        ABC_CHECK(handleMessage(std::string(incoming_.begin(), where + 1)));
-        incoming_.erase(incoming_.begin(), where + 1);
+        // Process the message in place:
+        const auto end = where + 1;
+        ABC_CHECK(handleMessage(DataSlice(data.data(), end)));
+        incoming_.consume(end - data.data());
+        scanned_ = 0;
     }
 
     // We need to wake up every minute:
@@ -181,21 +349,121 @@ StratumConnection::wakeup(SleepTime &sleep)
 
         lastKeepalive_ = now;
     }
+    ABC_CHECK(flush());
     sleep = std::chrono::duration_cast<SleepTime>(
                 lastKeepalive_ + keepaliveTime - now);
 
-    // Check the timeout:
-    if (pending_.size())
+    // Come back when the next paced request can go out:
+    const auto paceSleep = pace_.wait();
+    if (!paced_.empty() && paceSleep.count())
+        sleep = std::min(sleep, paceSleep + SleepTime(1));
+
+    // Fail any requests that have missed their deadlines.
+    // A server that ignores the batch probe isn't slow, just old:
+    std::vector<unsigned> expired;
+    bool slow = false;
+    for (const auto &i: pending_)
     {
-        if (lastProgress_ + timeout < now)
+        if (!i.second.trip)
+            continue;
+
+        const auto deadline = i.second.sent + i.second.timeout;
+        if (deadline < now)
+        {
+            expired.push_back(i.first);
+            slow = slow || probeId_ != i.first;
+        }
+        else
+        {
+            sleep = std::min(sleep, std::chrono::duration_cast<SleepTime>(
+                                 deadline - now) + SleepTime(1));
+        }
+    }
+    if (slow)
+    {
+        window_ = std::max(minWindow, window_ / 2);
+        if (maxTimeouts <= ++timeouts_)
             return ABC_ERROR(ABC_CC_ServerError, "Connection timed out");
-        sleep = std::min(sleep, std::chrono::duration_cast<SleepTime>(
-                             lastProgress_ + timeout - now));
+    }
+    for (auto id: expired)
+    {
+        // The callbacks might have already removed this one:
+        auto i = pending_.find(id);
+        if (pending_.end() == i)
+            continue;
+
+        auto onError = i->second.onError;
+        finish(i);
+        onError(ABC_ERROR(ABC_CC_ServerTimeout, "Request timed out"));
     }
 
     return Status();
 }
 
+Status
+StratumConnection::flush()
+{
+    // Requests wait in the queue until the socket is up:
+    if (!connection_.connected())
+        return Status();
+
+    // Release as many paced requests as the server will take:
+    while (!paced_.empty() && pace_.take())
+    {
+        queued_.push_back(std::move(paced_.front()));
+        paced_.pop_front();
+    }
+
+    if (queued_.empty())
+        return Status();
+
+    const auto now = std::chrono::steady_clock::now();
+    for (const auto &request: queued_)
+        pending_[request.first].sent = now;
+
+    std::string out;
+    if (Batching::yes == batching_)
+    {
+        for (size_t i = 0; i < queued_.size(); i += maxBatchSize)
+        {
+            const auto trip = ++lastTrip_;
+            const auto end = std::min(queued_.size(), i + maxBatchSize);
+
+            out += '[';
+            for (size_t j = i; j < end; ++j)
+            {
+                out += (j != i ? "," : "") + queued_[j].second;
+                pending_[queued_[j].first].trip = trip;
+            }
+            out += "]\n";
+            trips_[trip] = end - i;
+        }
+    }
+    else
+    {
+        // Until the probe says otherwise, send requests one by one.
+        // Even without batches, one write is better than many:
+        for (const auto &request: queued_)
+        {
+            const auto trip = ++lastTrip_;
+            out += request.second + '\n';
+            pending_[request.first].trip = trip;
+            trips_[trip] = 1;
+        }
+    }
+    queued_.clear();
+
+    return send(out);
+}
+
+void
+StratumConnection::recorderSet(std::shared_ptr<TrafficRecorder> recorder)
+{
+    recorder_ = recorder;
+    if (recorder_)
+        recorder_->record(TrafficRecorder::connected, uri_, DataSlice());
+}
+
 std::string
 StratumConnection::uri()
 {
@@ -203,9 +471,19 @@ StratumConnection::uri()
 }
 
 bool
-StratumConnection::queueFull()
+StratumConnection::queueFull(Priority priority)
 {
-    return 10 < pending_.size();
+    // Don't park work on a server that might never answer:
+    if (!connection_.connected())
+        return true;
+
+    // Queued requests will go out together if the server allows it:
+    const auto queued = Batching::yes == batching_ ?
+                        (queued_.size() + maxBatchSize - 1) / maxBatchSize :
+                        queued_.size();
+    const auto window = Priority::interactive == priority ?
+                        window_ + interactiveWindow : window_;
+    return window < trips_.size() + queued;
 }
 
 void
@@ -230,7 +508,8 @@ StratumConnection::heightSubscribe(const StatusCallback &onError,
 void
 StratumConnection::addressSubscribe(const StatusCallback &onError,
                                     const AddressUpdateCallback &onReply,
-                                    const std::string &address)
+                                    const std::string &address,
+                                    Priority priority)
 {
     // Add the callback to our subscription list:
     if (addressCallbacks_.count(address))
@@ -256,7 +535,8 @@ StratumConnection::addressSubscribe(const StatusCallback &onError,
         return Status();
     };
 
-    sendMessage("blockchain.address.subscribe", params, errorShim, decoder);
+    sendMessage("blockchain.address.subscribe", params, errorShim, decoder,
+                priority);
 }
 
 bool
@@ -268,7 +548,8 @@ StratumConnection::addressSubscribed(const std::string &address)
 void
 StratumConnection::addressHistoryFetch(const StatusCallback &onError,
                                        const AddressCallback &onReply,
-                                       const std::string &address)
+                                       const std::string &address,
+                                       Priority priority)
 {
     JsonArray params;
     params.append(json_string(address.c_str()));
@@ -307,13 +588,15 @@ StratumConnection::addressHistoryFetch(const StatusCallback &onError,
         return Status();
     };
 
-    sendMessage("blockchain.address.get_history", params, onError, decoder);
+    sendMessage("blockchain.address.get_history", params, onError, decoder,
+                priority);
 }
 
 void
 StratumConnection::txDataFetch(const StatusCallback &onError,
                                const TxCallback &onReply,
-                               const std::string &txid)
+                               const std::string &txid,
+                               Priority priority)
 {
     JsonArray params;
     params.append(json_string(txid.c_str()));
@@ -333,7 +616,8 @@ StratumConnection::txDataFetch(const StatusCallback &onError,
         return Status();
     };
 
-    sendMessage("blockchain.transaction.get", params, onError, decoder);
+    sendMessage("blockchain.transaction.get", params, onError, decoder,
+                priority);
 }
 
 void
@@ -370,10 +654,17 @@ StratumConnection::blockHeaderFetch(const StatusCallback &onError,
     sendMessage("blockchain.block.get_header", params, onError, decoder);
 }
 
+SleepTime
+StratumConnection::methodTimeout(const std::string &method) const
+{
+    auto i = methodTimeouts_.find(method);
+    return methodTimeouts_.end() != i ? i->second : defaultTimeout(method);
+}
+
 void
 StratumConnection::sendMessage(const std::string &method, JsonPtr params,
                                const StatusCallback &onError,
-                               const Decoder &decoder)
+                               const Decoder &decoder, Priority priority)
 {
     const auto id = lastId++;
 
@@ -382,32 +673,92 @@ StratumConnection::sendMessage(const std::string &method, JsonPtr params,
     query.methodSet(method);
     query.paramsSet(params);
 
-    auto s = connection_.send(query.encode(true) + '\n');
-    if (!s)
-        return onError(s);
+    const auto timeout = methodTimeout(method);
 
-    // Start the timeout if this is the first message in the queue:
-    if (pending_.empty())
-        lastProgress_ = std::chrono::steady_clock::now();
+    // Interactive requests skip the pacing queue,
+    // leaving a debt for the background ones to pay off:
+    const bool paced = !pace_.unlimited() && pacedMethod(method);
+    if (paced && Priority::interactive == priority)
+        pace_.borrow();
 
-    // The message has been sent, so save the decoder:
-    pending_[id] = Pending{ onError, decoder };
+    // The message goes out on the next flush, so save the decoder:
+    if (paced && Priority::background == priority)
+        paced_.emplace_back(id, query.encode(true));
+    else
+        queued_.emplace_back(id, query.encode(true));
+    pending_[id] = Pending
+    {
+        onError, decoder, timeout, 0, std::chrono::steady_clock::time_point()
+    };
+}
+
+Status
+StratumConnection::send(const std::string &data)
+{
+    // One event per message:
+    const auto *p = reinterpret_cast<const uint8_t *>(data.data());
+    for (size_t start = 0; recorder_ && start < data.size(); )
+    {
+        auto end = data.find('\n', start);
+        if (std::string::npos == end)
+            end = data.size();
+        recorder_->record(TrafficRecorder::sent, uri_,
+                          DataSlice(p + start, p + end));
+        start = end + 1;
+    }
+
+    return connection_.send(data);
 }
 
 Status
-StratumConnection::handleMessage(const std::string &message)
+StratumConnection::handleMessage(DataSlice message)
 {
-    ReplyJson json;
-    ABC_CHECK(json.decode(message));
+    if (recorder_)
+        recorder_->record(TrafficRecorder::received, uri_,
+                          DataSlice(message.data(), message.end() - 1));
+
+    JsonPtr json;
+    ABC_CHECK(json.decode(reinterpret_cast<const char *>(message.data()),
+                          message.size()));
+
+    if (json_is_array(json.get()))
+    {
+        // Only servers that understand batches send these:
+        batching_ = Batching::yes;
+
+        JsonArray array(json);
+        size_t size = array.size();
+        for (size_t i = 0; i < size; ++i)
+            ABC_CHECK(handleReply(array[i]));
+        return Status();
+    }
+
+    return handleReply(json);
+}
+
+Status
+StratumConnection::handleReply(JsonPtr message)
+{
+    ReplyJson json(message);
     if (json.idOk())
     {
         auto i = pending_.find(json.id());
         if (pending_.end() != i)
         {
-            auto s = i->second.decoder(json.result());
+            // A plain reply to the probe means the server unwrapped it:
+            if (probeId_ == i->first && Batching::unknown == batching_)
+                batching_ = Batching::no;
+
+            // Servers report unknown methods and other failures this way:
+            auto error = json.error();
+            auto s = error && !json_is_null(error.get()) ?
+                     ABC_ERROR(ABC_CC_ServerError, "Server error " +
+                               error.encode(true)) :
+                     i->second.decoder(json.result());
             if (!s)
                 i->second.onError(s);
-            pending_.erase(i);
+            replied(i->second.sent);
+            finish(i);
             return Status();
         }
         else
@@ -415,6 +766,20 @@ StratumConnection::handleMessage(const std::string &message)
             ; // TODO: Handle mis-matched replies
         }
     }
+    else if (Batching::unknown == batching_ && json.error()
+             && !json_is_null(json.error().get()))
+    {
+        // Servers without batch support reject the probe without an id:
+        auto i = pending_.find(probeId_);
+        if (pending_.end() != i)
+        {
+            i->second.onError(ABC_ERROR(ABC_CC_ServerError,
+                                        "Batches not supported"));
+            finish(i);
+        }
+        batching_ = Batching::no;
+        timeouts_ = 0;
+    }
     else
     {
         // Handle subscription updates:
@@ -465,8 +830,37 @@ StratumConnection::handleMessage(const std::string &message)
         }
     }
 
-    lastProgress_ = std::chrono::steady_clock::now();
     return Status();
 }
 
+void
+StratumConnection::finish(std::map<unsigned, Pending>::iterator i)
+{
+    auto trip = trips_.find(i->second.trip);
+    if (trips_.end() != trip && !--trip->second)
+        trips_.erase(trip);
+    pending_.erase(i);
+}
+
+void
+StratumConnection::replied(std::chrono::steady_clock::time_point sent)
+{
+    timeouts_ = 0;
+
+    const double rtt = std::chrono::duration_cast<SleepTime>(
+                           std::chrono::steady_clock::now() - sent).count();
+
+    // Open the window while replies come back promptly,
+    // and back off when they start to lag:
+    if (rtt <= 2 * rtt_ || !rtt_)
+        window_ = std::min(maxWindow, window_ + 1 / window_);
+    else
+        window_ = std::max(minWindow, window_ * 7 / 8);
+
+    rtt_ = rtt_ ? (7 * rtt_ + rtt) / 8 : rtt;
+
+    if (latencyCallback_)
+        latencyCallback_(SleepTime(static_cast<SleepTime::rep>(rtt)));
+}
+
 }
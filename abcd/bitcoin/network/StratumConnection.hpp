@@ -10,8 +10,12 @@
 
 #include "IBitcoinConnection.hpp"
 #include "TcpConnection.hpp"
+#include "TrafficRecorder.hpp"
+#include "../../util/TokenBucket.hpp"
 #include <chrono>
+#include <deque>
 #include <map>
+#include <vector>
 
 namespace abcd {
 
@@ -21,14 +25,20 @@ typedef std::chrono::milliseconds SleepTime;
 // Scheme used for stratum URI's:
 constexpr auto stratumScheme = "stratum";
 
+// Number of headers in a `blockchain.block.get_chunk` reply:
+constexpr size_t stratumChunkSize = 2016;
+
 class StratumConnection:
     public IBitcoinConnection
 {
 public:
     typedef std::function<void (const std::string &version)> VersionHandler;
     typedef std::function<void (double fee)> FeeCallback;
+    typedef std::function<void (DataSlice rawHeaders)> HeaderChunkCallback;
+    typedef std::function<void (SleepTime latency)> LatencyCallback;
 
     ~StratumConnection();
+    StratumConnection();
 
     /**
      * Requests the server version.
@@ -45,6 +55,17 @@ public:
                      const FeeCallback &onReply,
                      size_t blocks);
 
+    /**
+     * Fetches a chunk of `stratumChunkSize` consecutive raw block headers,
+     * starting at height `chunk * stratumChunkSize`.
+     * The final chunk in the chain may be shorter.
+     * Servers that don't support chunks will return an error.
+     */
+    void
+    blockHeaderChunkFetch(const StatusCallback &onError,
+                          const HeaderChunkCallback &onReply,
+                          size_t chunk);
+
     /**
      * Broadcasts a transaction over the Bitcoin network.
      * @param onDone called when the broadcast is done,
@@ -54,7 +75,9 @@ public:
     sendTx(const StatusCallback &onDone, DataSlice tx);
 
     /**
-     * Connects to the specified stratum server.
+     * Begins connecting to the specified stratum server.
+     * The connection completes in the background during calls to `wakeup`,
+     * which then asks whether the server accepts batched requests.
      */
     Status
     connect(const std::string &uri);
@@ -67,16 +90,88 @@ public:
     wakeup(SleepTime &sleep);
 
     /**
-     * Obtains the socket that the main loop should sleep on.
+     * Overrides the reply deadline for a particular method.
+     * Requests that miss their deadline fail with `ABC_CC_ServerTimeout`,
+     * but the connection stays up.
+     */
+    void
+    timeoutSet(const std::string &method, SleepTime timeout);
+
+    /**
+     * Returns the number of round trips we are willing to have in flight.
+     * This grows while the server answers promptly,
+     * and shrinks when replies slow down or time out.
+     */
+    double
+    window() const { return window_; }
+
+    /**
+     * Returns the smoothed round-trip time, or zero before the first reply.
+     */
+    SleepTime
+    latency() const;
+
+    /**
+     * Sets up a callback to receive the round-trip time of every reply.
+     */
+    void
+    onLatencySet(const LatencyCallback &callback);
+
+    /**
+     * Limits how fast address subscriptions and history polls go out,
+     * since public servers disconnect clients that send too many.
+     * Requests over the limit wait here until the bucket refills.
+     * @param rate Requests per second, or zero for no limit.
+     * @param burst The most requests that can go out at once.
+     */
+    void
+    paceSet(double rate, double burst);
+
+    /**
+     * Returns how long a new paced request would have to wait,
+     * counting the ones already held back, or zero if it could go now.
+     */
+    SleepTime
+    paceWait();
+
+    /**
+     * Copies every message to the recorder, or stops if it is null.
+     */
+    void
+    recorderSet(std::shared_ptr<TrafficRecorder> recorder);
+
+    /**
+     * True once the socket has finished connecting.
+     */
+    bool connected() const { return connection_.connected(); }
+
+    /**
+     * Sends all the requests queued up since the last flush.
+     * If the server accepts JSON-RPC batches,
+     * these go out together and share a single round trip.
+     * While the connection is still being set up, the requests
+     * stay queued, and go out as soon as it finishes.
+     */
+    Status
+    flush();
+
+    /**
+     * True if there are requests waiting for the next `flush`.
      */
-    int pollfd() const { return connection_.pollfd(); }
+    bool flushNeeded() const { return !queued_.empty(); }
+
+    /**
+     * Obtains the sockets that the main loop should sleep on.
+     */
+    std::vector<struct pollfd>
+    pollfds() const { return connection_.pollfds(); }
 
     // IBitcoinConnection interface:
     std::string
     uri() override;
 
     bool
-    queueFull() override;
+    queueFull(Priority priority=Priority::background) override;
 
     void
     heightSubscribe(const StatusCallback &onError,
@@ -85,7 +180,8 @@ public:
     void
     addressSubscribe(const StatusCallback &onError,
                      const AddressUpdateCallback &onReply,
-                     const std::string &address) override;
+                     const std::string &address,
+                     Priority priority=Priority::background) override;
 
     bool
     addressSubscribed(const std::string &address) override;
@@ -93,12 +189,14 @@ public:
     void
     addressHistoryFetch(const StatusCallback &onError,
                         const AddressCallback &onReply,
-                        const std::string &address) override;
+                        const std::string &address,
+                        Priority priority=Priority::background) override;
 
     void
     txDataFetch(const StatusCallback &onError,
                 const TxCallback &onReply,
-                const std::string &txid) override;
+                const std::string &txid,
+                Priority priority=Priority::background) override;
 
     void
     blockHeaderFetch(const StatusCallback &onError,
@@ -111,7 +209,8 @@ private:
     // Socket:
     std::string uri_;
     TcpConnection connection_;
-    std::string incoming_;
+    ReceiveBuffer incoming_;
+    size_t scanned_ = 0; // Bytes known not to contain a newline
 
     // Sending:
     unsigned lastId = 0;
@@ -119,12 +218,34 @@ private:
     {
         StatusCallback onError;
         Decoder decoder;
-        // TODO: Add timeout logic
+        SleepTime timeout;
+        unsigned trip; // Zero until sent
+        std::chrono::steady_clock::time_point sent;
     };
     std::map<unsigned, Pending> pending_;
 
-    // Timeout:
-    std::chrono::steady_clock::time_point lastProgress_;
+    // Encoded requests waiting for the next flush:
+    std::vector<std::pair<unsigned, std::string>> queued_;
+
+    // Rate-limited requests waiting for tokens:
+    TokenBucket pace_;
+    std::deque<std::pair<unsigned, std::string>> paced_;
+
+    // Replies outstanding for each round trip:
+    unsigned lastTrip_ = 0;
+    std::map<unsigned, size_t> trips_;
+
+    // Batch support, which we find out by sending a probe on connect:
+    enum class Batching { unknown, yes, no };
+    Batching batching_ = Batching::unknown;
+    unsigned probeId_ = 0;
+
+    // Congestion control:
+    double window_;
+    double rtt_ = 0; // Smoothed, in milliseconds
+    unsigned timeouts_ = 0; // In a row
+    std::map<std::string, SleepTime> methodTimeouts_;
+    LatencyCallback latencyCallback_;
 
     // Server heartbeat:
     std::chrono::steady_clock::time_point lastKeepalive_;
@@ -133,20 +254,60 @@ private:
     HeightCallback heightCallback_;
     std::map<std::string, AddressUpdateCallback> addressCallbacks_;
 
+    std::shared_ptr<TrafficRecorder> recorder_;
+
+    /**
+     * Writes some newline-terminated messages to the socket.
+     */
+    Status
+    send(const std::string &data);
+
+    /**
+     * Returns the reply deadline for a method.
+     */
+    SleepTime
+    methodTimeout(const std::string &method) const;
+
     /**
-     * Sends a message and sets up the reply decoder.
+     * Queues a message and sets up the reply decoder.
      * If anything goes wrong (including errors returned by the decoder),
      * the error callback will be called.
      */
     void
     sendMessage(const std::string &method, JsonPtr params,
-                const StatusCallback &onError, const Decoder &decoder);
+                const StatusCallback &onError, const Decoder &decoder,
+                Priority priority=Priority::background);
+
+    /**
+     * Decodes and handles a complete message from the server,
+     * which might be a batch of replies.
+     */
+    Status
+    handleMessage(DataSlice message);
+
+    /**
+     * Handles a single reply or subscription update.
+     */
+    Status
+    handleReply(JsonPtr message);
 
     /**
-     * Decodes and handles a complete message from the server.
+     * Sends the batch-support probe once the socket connects.
      */
     Status
-    handleMessage(const std::string &message);
+    probe();
+
+    /**
+     * Updates the latency estimate and congestion window for a reply.
+     */
+    void
+    replied(std::chrono::steady_clock::time_point sent);
+
+    /**
+     * Marks a request as answered, freeing up its slot.
+     */
+    void
+    finish(std::map<unsigned, Pending>::iterator i);
 };
 
 } // namespace abcd
@@ -6,95 +6,159 @@
  */
 
 #include "TcpConnection.hpp"
+#include "../../util/Debug.hpp"
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
 namespace abcd {
 
-static int
-timeoutConnect(int sock, struct sockaddr *addr,
-               socklen_t addr_len, struct timeval *tv)
-{
-    fd_set fdset;
-    int flags = 0;
-    int so_error;
-    socklen_t len = sizeof(so_error);
-
-    if ((flags = fcntl(sock, F_GETFL, 0)) < 0)
-        return -1;
-
-    if (fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
-        return -1;
+// Socket reads:
+constexpr size_t readSize = 65536;
+constexpr size_t maxReadTotal = 4 * 1024 * 1024;
 
-    if (connect(sock, addr, addr_len) == 0)
-        goto exit;
+// Connection setup:
+constexpr std::chrono::milliseconds attemptDelay(250);
 
-    FD_ZERO(&fdset);
-    FD_SET(sock, &fdset);
+/**
+ * Results from a background DNS lookup.
+ * The lookup thread keeps this alive even if the connection goes away.
+ */
+struct TcpResolver
+{
+    std::mutex mutex;
+    bool done = false;
+    int error = 0;
+    struct addrinfo *list = nullptr;
+    int pipe[2] = { -1, -1 }; // Becomes readable when done
 
-    if (select(sock + 1, NULL, &fdset, NULL, tv) > 0)
+    ~TcpResolver()
     {
-        getsockopt(sock, SOL_SOCKET, SO_ERROR, &so_error, &len);
-        if (so_error == 0)
-            goto exit;
+        if (list)
+            freeaddrinfo(list);
+        if (0 <= pipe[0])
+            close(pipe[0]);
+        if (0 <= pipe[1])
+            close(pipe[1]);
     }
-    return -1;
+};
+
+static void
+resolveTask(std::shared_ptr<TcpResolver> resolver,
+            std::string hostname, std::string port)
+{
+    struct addrinfo hints {};
+    struct addrinfo *list = nullptr;
+    hints.ai_family = AF_UNSPEC; // Allow IPv6 or IPv4
+    hints.ai_socktype = SOCK_STREAM; // TCP only
+    const auto error = getaddrinfo(hostname.c_str(), port.c_str(),
+                                   &hints, &list);
+
+    std::lock_guard<std::mutex> lock(resolver->mutex);
+    resolver->error = error;
+    resolver->list = list;
+    resolver->done = true;
 
-exit:
-    if (fcntl(sock, F_SETFL, flags) < 0)
-        return -1;
-    return 0;
+    // Wake up the poll loop:
+    if (::write(resolver->pipe[1], "", 1) < 0)
+        ABC_DebugLog("Cannot signal DNS results for %s", hostname.c_str());
 }
 
 TcpConnection::~TcpConnection()
 {
-    if (0 < fd_)
+    attemptsClose();
+    if (0 <= fd_)
         close(fd_);
 }
 
 TcpConnection::TcpConnection():
-    fd_(0)
+    fd_(-1),
+    nextAddress_(0)
 {
 }
 
 Status
-TcpConnection::connect(const std::string &hostname, unsigned port)
+TcpConnection::connect(const std::string &hostname, unsigned port,
+                       std::chrono::milliseconds timeout)
 {
-    // Do the DNS lookup:
-    struct addrinfo hints {};
-    struct addrinfo *list = nullptr;
-    hints.ai_family = AF_UNSPEC; // Allow IPv6 or IPv4
-    hints.ai_socktype = SOCK_STREAM; // TCP only
-    if (getaddrinfo(hostname.c_str(), std::to_string(port).c_str(), &hints, &list))
-        return ABC_ERROR(ABC_CC_ServerError, "Cannot look up " + hostname);
+    hostname_ = hostname;
+    deadline_ = std::chrono::steady_clock::now() + timeout;
+
+    // Do the DNS lookup in the background:
+    std::shared_ptr<TcpResolver> resolver(new TcpResolver());
+    if (pipe(resolver->pipe))
+        return ABC_ERROR(ABC_CC_SysError, "Cannot create pipe");
+    std::thread(resolveTask, resolver, hostname,
+                std::to_string(port)).detach();
+    resolver_ = resolver;
+
+    return Status();
+}
 
-    // Try the returned DNS entries until one connects:
-    for (struct addrinfo *p = list; p; ++p)
+Status
+TcpConnection::wakeup(std::chrono::milliseconds &sleep)
+{
+    if (connected())
+        return sendPending();
+
+    const auto now = std::chrono::steady_clock::now();
+    if (deadline_ < now)
+        return ABC_ERROR(ABC_CC_ServerError, "Timed out connecting to " +
+                         hostname_);
+
+    // Collect the DNS results:
+    if (resolver_)
     {
-        fd_ = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (fd_ < 0)
+        std::lock_guard<std::mutex> lock(resolver_->mutex);
+        if (!resolver_->done)
         {
-            freeaddrinfo(list);
-            return ABC_ERROR(ABC_CC_ServerError, "Cannot create socket to " + hostname);
+            sleep = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline_ - now) + std::chrono::milliseconds(1);
+            return Status();
         }
+        if (resolver_->error)
+            return ABC_ERROR(ABC_CC_ServerError, "Cannot look up " +
+                             hostname_);
 
-        struct timeval sto;
-        sto.tv_sec = 10;
-        sto.tv_usec = 0;
-        if (0 == timeoutConnect(fd_, p->ai_addr, p->ai_addrlen, &sto))
-            break;
+        addressesLoad(resolver_->list);
+        nextAttempt_ = now;
+    }
+    resolver_.reset();
 
-        close(fd_);
-        fd_ = 0;
+    // See if any attempts have finished:
+    attemptsCheck();
+    if (connected())
+        return Status();
+
+    // Start a new attempt if the others are slow or have all failed:
+    if (attempts_.empty())
+        nextAttempt_ = now;
+    while (nextAttempt_ <= now && nextAddress_ < addresses_.size())
+    {
+        if (!attemptStart())
+            continue;
+        if (connected())
+            return Status();
+        nextAttempt_ = now + attemptDelay;
     }
-    freeaddrinfo(list);
 
-    if (fd_ < 0)
-        return ABC_ERROR(ABC_CC_ServerError, "Cannot connect to " + hostname);
+    if (attempts_.empty())
+        return ABC_ERROR(ABC_CC_ServerError, "Cannot connect to " +
+                         hostname_);
+
+    // Come back when it is time for the next attempt, if not sooner:
+    auto next = deadline_;
+    if (nextAddress_ < addresses_.size())
+        next = std::min(next, nextAttempt_);
+    sleep = std::chrono::duration_cast<std::chrono::milliseconds>(
+                next - now) + std::chrono::milliseconds(1);
 
     return Status();
 }
@@ -102,34 +166,197 @@ TcpConnection::connect(const std::string &hostname, unsigned port)
 Status
 TcpConnection::send(DataSlice data)
 {
-    while (data.size())
+    // Keep the data in order behind anything still waiting:
+    outgoing_.insert(outgoing_.end(), data.begin(), data.end());
+    return sendPending();
+}
+
+Status
+TcpConnection::sendPending()
+{
+    size_t sent = 0;
+    while (sent < outgoing_.size())
     {
-        auto bytes = ::send(fd_, data.data(), data.size(), 0);
+        auto bytes = ::send(fd_, outgoing_.data() + sent,
+                            outgoing_.size() - sent, 0);
         if (bytes < 0)
-            return ABC_ERROR(ABC_CC_ServerError, "Failed to send");
+        {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+                return ABC_ERROR(ABC_CC_ServerError, "Failed to send");
 
-        data = DataSlice(data.data() + bytes, data.end());
+            // The socket is full, so wait for it to drain:
+            break;
+        }
+
+        sent += bytes;
     }
+    outgoing_.erase(outgoing_.begin(), outgoing_.begin() + sent);
 
     return Status();
 }
 
 Status
-TcpConnection::read(DataChunk &result)
+TcpConnection::read(ReceiveBuffer &buffer)
 {
-    unsigned char data[1024];
-    auto bytes = recv(fd_, data, sizeof(data), MSG_DONTWAIT);
-    if (bytes < 0)
+    // Drain the socket, but leave something for the next wakeup
+    // if the server is sending faster than we can keep up:
+    size_t total = 0;
+    while (total < maxReadTotal)
     {
-        if (EAGAIN != errno && EWOULDBLOCK != errno)
-            return ABC_ERROR(ABC_CC_ServerError, "Cannot read from socket");
+        auto data = buffer.prepare(readSize);
+        auto bytes = recv(fd_, data, buffer.space(), MSG_DONTWAIT);
+        if (bytes < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+                return ABC_ERROR(ABC_CC_ServerError, "Cannot read from socket");
+
+            // No more data, but that's fine:
+            break;
+        }
+        if (!bytes)
+            return ABC_ERROR(ABC_CC_ServerError, "Connection closed");
 
-        // No data, but that's fine:
-        bytes = 0;
+        buffer.commit(bytes);
+        total += bytes;
     }
 
-    result = DataChunk(data, data + bytes);
     return Status();
 }
 
+std::vector<struct pollfd>
+TcpConnection::pollfds() const
+{
+    std::vector<struct pollfd> out;
+    if (connected())
+        out.push_back(pollfd{ fd_, static_cast<short>(
+                                  outgoing_.empty() ? POLLIN :
+                                  POLLIN | POLLOUT), 0 });
+    else if (resolver_)
+        out.push_back(pollfd{ resolver_->pipe[0], POLLIN, 0 });
+    else
+        for (auto fd: attempts_)
+            out.push_back(pollfd{ fd, POLLOUT, 0 });
+    return out;
+}
+
+void
+TcpConnection::addressesLoad(const struct addrinfo *list)
+{
+    // Split the results by family, keeping the resolver's order:
+    std::vector<Address> primary;
+    std::vector<Address> secondary;
+    for (auto p = list; p; p = p->ai_next)
+    {
+        Address address {};
+        memcpy(&address.addr, p->ai_addr,
+               std::min<size_t>(p->ai_addrlen, sizeof(address.addr)));
+        address.size = p->ai_addrlen;
+        address.family = p->ai_family;
+        address.socktype = p->ai_socktype;
+        address.protocol = p->ai_protocol;
+
+        if (list->ai_family == p->ai_family)
+            primary.push_back(address);
+        else
+            secondary.push_back(address);
+    }
+
+    // Alternate between the families:
+    addresses_.clear();
+    nextAddress_ = 0;
+    for (size_t i = 0; i < std::max(primary.size(), secondary.size()); ++i)
+    {
+        if (i < primary.size())
+            addresses_.push_back(primary[i]);
+        if (i < secondary.size())
+            addresses_.push_back(secondary[i]);
+    }
+}
+
+bool
+TcpConnection::attemptStart()
+{
+    const auto &address = addresses_[nextAddress_++];
+
+    const int fd = socket(address.family, address.socktype, address.protocol);
+    if (fd < 0)
+        return false;
+
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (0 == ::connect(fd, reinterpret_cast<const struct sockaddr *>(
+                           &address.addr), address.size))
+    {
+        // Loopback connections can finish right away:
+        attempts_.push_back(fd);
+        attemptsCheck();
+        return true;
+    }
+    if (EINPROGRESS != errno)
+    {
+        close(fd);
+        return false;
+    }
+
+    attempts_.push_back(fd);
+    return true;
+}
+
+void
+TcpConnection::attemptsCheck()
+{
+    if (attempts_.empty())
+        return;
+
+    std::vector<struct pollfd> items;
+    for (auto fd: attempts_)
+        items.push_back(pollfd{ fd, POLLOUT, 0 });
+    if (poll(items.data(), items.size(), 0) <= 0)
+        return;
+
+    std::vector<int> pending;
+    for (const auto &item: items)
+    {
+        if (!item.revents || connected())
+        {
+            pending.push_back(item.fd);
+            continue;
+        }
+
+        int error = 0;
+        socklen_t size = sizeof(error);
+        if (getsockopt(item.fd, SOL_SOCKET, SO_ERROR, &error, &size) ||
+                error)
+        {
+            close(item.fd);
+            continue;
+        }
+
+        // We have a winner. It stays non-blocking,
+        // since one full socket must not stall the network thread:
+        fd_ = item.fd;
+    }
+    attempts_ = pending;
+
+    if (connected())
+        attemptsClose();
+}
+
+void
+TcpConnection::attemptsClose()
+{
+    for (auto fd: attempts_)
+        close(fd);
+    attempts_.clear();
+}
+
 } // namespace abcd
@@ -10,9 +10,18 @@
 
 #include "../../util/Status.hpp"
 #include "../../util/Data.hpp"
+#include "../../util/ReceiveBuffer.hpp"
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <memory>
+#include <vector>
 
 namespace abcd {
 
+struct TcpResolver;
+
 class TcpConnection
 {
 public:
@@ -20,30 +29,104 @@ public:
     TcpConnection();
 
     /**
-     * Connect to the specified server.
+     * Begins connecting to the specified server.
+     * This returns right away. The DNS lookup happens in the background,
+     * and then connection attempts race across the returned addresses,
+     * alternating between IPv6 and IPv4.
+     * Call `wakeup` when the `pollfds` are ready to make progress.
+     * @param timeout The time allowed for the whole process.
+     */
+    Status
+    connect(const std::string &hostname, unsigned port,
+            std::chrono::milliseconds timeout=std::chrono::seconds(10));
+
+    /**
+     * Advances a connection that is still being set up,
+     * or sends whatever data the socket couldn't take earlier.
+     * @param sleep Set to the longest the caller should wait
+     * before calling again, if the connection is still in progress.
+     * @return An error if every address has failed or time has run out.
      */
     Status
-    connect(const std::string &hostname, unsigned port);
+    wakeup(std::chrono::milliseconds &sleep);
+
+    /**
+     * True once the connection is ready to send and receive data.
+     */
+    bool connected() const { return 0 <= fd_; }
 
     /**
      * Send some data over the socket.
+     * This never blocks. Whatever the socket can't take right away
+     * waits in a buffer, and goes out as `wakeup` is called.
      */
     Status
     send(DataSlice data);
 
     /**
-     * Read all pending data from the socket (might not produce anything).
+     * Read all pending data from the socket (might not produce anything),
+     * appending it to the buffer.
+     * Fails if the server has closed the connection.
      */
     Status
-    read(DataChunk &result);
+    read(ReceiveBuffer &buffer);
 
     /**
      * Obtains a list of sockets that the main loop should sleep on.
+     * While connecting, or while data is waiting to go out,
+     * these wait to become writable.
      */
-    int pollfd() const { return fd_; }
+    std::vector<struct pollfd>
+    pollfds() const;
 
 private:
     int fd_;
+    DataChunk outgoing_;
+
+    // Connection setup:
+    struct Address
+    {
+        struct sockaddr_storage addr;
+        socklen_t size;
+        int family;
+        int socktype;
+        int protocol;
+    };
+    std::string hostname_;
+    std::shared_ptr<TcpResolver> resolver_;
+    std::vector<Address> addresses_;
+    size_t nextAddress_;
+    std::vector<int> attempts_;
+    std::chrono::steady_clock::time_point nextAttempt_;
+    std::chrono::steady_clock::time_point deadline_;
+
+    /**
+     * Copies the DNS results into `addresses_`, interleaving families.
+     */
+    void
+    addressesLoad(const struct addrinfo *list);
+
+    /**
+     * Starts a non-blocking connection to the next address.
+     * @return false if the attempt failed right away.
+     */
+    bool
+    attemptStart();
+
+    /**
+     * Checks the attempts in flight, adopting the first one to succeed.
+     */
+    void
+    attemptsCheck();
+
+    void
+    attemptsClose();
+
+    /**
+     * Writes as much of `outgoing_` as the socket will take.
+     */
+    Status
+    sendPending();
 };
 
 } // namespace abcd
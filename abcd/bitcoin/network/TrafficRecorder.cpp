@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "TrafficRecorder.hpp"
+#include "../../util/Debug.hpp"
+#include "../../util/FileIO.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+namespace abcd {
+
+TrafficRecorder::~TrafficRecorder()
+{
+    if (file_)
+        fclose(file_);
+}
+
+TrafficRecorder::TrafficRecorder():
+    file_(nullptr)
+{
+}
+
+Status
+TrafficRecorder::open(const std::string &path)
+{
+    if (file_)
+        fclose(file_);
+
+    file_ = fopen(path.c_str(), "w");
+    if (!file_)
+        return ABC_ERROR(ABC_CC_SysError, "Cannot open " + path);
+
+    start_ = std::chrono::steady_clock::now();
+    ABC_DebugLog("Recording network traffic to %s", path.c_str());
+    return Status();
+}
+
+void
+TrafficRecorder::record(Type type, const std::string &uri, DataSlice message)
+{
+    if (!file_)
+        return;
+
+    const auto elapsed = std::chrono::duration_cast<
+                         std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start_);
+
+    // The stdio buffer batches these up, so this is cheap:
+    fprintf(file_, "%lld %c %s ",
+            static_cast<long long>(elapsed.count()), type, uri.c_str());
+    fwrite(message.data(), 1, message.size(), file_);
+    fputc('\n', file_);
+}
+
+Status
+TrafficRecorder::load(std::vector<Event> &result, const std::string &path)
+{
+    DataChunk data;
+    ABC_CHECK(fileLoad(data, path));
+
+    std::vector<Event> out;
+    const auto *p = reinterpret_cast<const char *>(data.data());
+    const auto *end = p + data.size();
+    while (p < end)
+    {
+        const auto *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+        const std::string line(p, eol);
+        p = eol + 1;
+        if (line.empty())
+            continue;
+
+        // Split off the three leading fields:
+        const auto typeStart = line.find(' ');
+        const auto uriStart = line.find(' ', typeStart + 1);
+        const auto messageStart = line.find(' ', uriStart + 1);
+        if (std::string::npos == messageStart ||
+                uriStart != typeStart + 2)
+            return ABC_ERROR(ABC_CC_ParseError, "Bad traffic recording");
+
+        Event event;
+        event.elapsed = std::chrono::microseconds(
+                            strtoll(line.c_str(), nullptr, 10));
+        event.type = static_cast<Type>(line[typeStart + 1]);
+        event.uri = line.substr(uriStart + 1, messageStart - uriStart - 1);
+        event.message = line.substr(messageStart + 1);
+        out.push_back(std::move(event));
+    }
+
+    result = std::move(out);
+    return Status();
+}
+
+} // namespace abcd
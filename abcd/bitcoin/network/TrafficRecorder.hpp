@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Captures the traffic between the wallet and the bitcoin servers.
+ */
+
+#ifndef ABCD_BITCOIN_NETWORK_TRAFFIC_RECORDER_HPP
+#define ABCD_BITCOIN_NETWORK_TRAFFIC_RECORDER_HPP
+
+#include "../../util/Data.hpp"
+#include "../../util/Status.hpp"
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace abcd {
+
+/**
+ * Writes every message the server connections send and receive
+ * to a file, along with when it happened, so a sync session
+ * can be studied or replayed later.
+ *
+ * The file holds one event per line:
+ * the microseconds since recording began, the event type,
+ * the server URI, and the message. Stratum messages appear as-is,
+ * while libbitcoin messages appear as hex frames separated by colons.
+ */
+class TrafficRecorder
+{
+public:
+    enum Type: char
+    {
+        connected = '+',
+        sent = '>',
+        received = '<'
+    };
+
+    struct Event
+    {
+        std::chrono::microseconds elapsed;
+        Type type;
+        std::string uri;
+        std::string message;
+    };
+
+    ~TrafficRecorder();
+    TrafficRecorder();
+
+    /**
+     * Starts a new recording, replacing whatever is at the path.
+     */
+    Status
+    open(const std::string &path);
+
+    /**
+     * Adds an event to the recording.
+     * Messages must not contain newlines.
+     */
+    void
+    record(Type type, const std::string &uri, DataSlice message);
+
+    /**
+     * Reads a recording back in.
+     */
+    static Status
+    load(std::vector<Event> &result, const std::string &path);
+
+    TrafficRecorder(const TrafficRecorder &copy) = delete;
+    TrafficRecorder &operator=(const TrafficRecorder &copy) = delete;
+
+private:
+    FILE *file_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace abcd
+
+#endif
@@ -8,9 +8,13 @@
 #include "TxUpdater.hpp"
 #include "LibbitcoinConnection.hpp"
 #include "StratumConnection.hpp"
+#include "../cache/BlockCache.hpp"
 #include "../cache/Cache.hpp"
+#include "../cache/ServerCache.hpp"
 #include "../../General.hpp"
 #include "../../util/Debug.hpp"
+#include <algorithm>
+#include <deque>
 
 namespace abcd {
 
@@ -23,15 +27,122 @@ constexpr auto NUM_CONNECT_SERVERS = 5;
 constexpr auto MINIMUM_LIBBITCOIN_SERVERS = 1;
 constexpr auto MINIMUM_STRATUM_SERVERS = 4;
 
+// A chunk costs about as much as 20 single-header replies:
+constexpr size_t HEADER_CHUNK_MINIMUM = 20;
+
+// Hedging, for requests the user is waiting on:
+constexpr auto HEDGE_DEFAULT_DELAY = std::chrono::milliseconds(1000);
+constexpr auto HEDGE_MINIMUM_DELAY = std::chrono::milliseconds(200);
+constexpr double HEDGE_DEFAULT_BUDGET = 0.05; // Extra load, at most
+constexpr double HEDGE_BURST = 2; // Hedges allowed before the budget builds
+constexpr double HEDGE_HISTORY = 1000; // Requests the budget remembers
+
+// Address subscriptions and history polls per second, for each server:
+constexpr double PACE_DEFAULT_RATE = 20;
+constexpr double PACE_DEFAULT_BURST = 100;
+
 TxUpdater::~TxUpdater()
 {
     disconnect();
 }
 
-TxUpdater::TxUpdater(Cache &cache, void *ctx):
-    cache_(cache),
-    ctx_(ctx)
+TxUpdater::TxUpdater(BlockCache &blocks, ServerCache &servers, void *ctx,
+                     Reactor &reactor):
+    blocks_(blocks),
+    servers_(servers),
+    ctx_(ctx),
+    reactor_(reactor),
+    pace_{PACE_DEFAULT_RATE, PACE_DEFAULT_BURST},
+    walletTurn_(0),
+    hedgeBudget_(HEDGE_DEFAULT_BUDGET),
+    raceCount_(0),
+    hedgeCount_(0)
+{
+}
+
+void
+TxUpdater::hedgeBudgetSet(double fraction)
+{
+    hedgeBudget_ = fraction;
+}
+
+void
+TxUpdater::paceSet(double rate, double burst, const std::string &uri)
+{
+    if (uri.empty())
+        pace_ = Pace{rate, burst};
+    else
+        serverPaces_[uri] = Pace{rate, burst};
+
+    // Update the servers we are already talking to:
+    for (auto &i: watches_)
+    {
+        auto *sc = i.second.sc;
+        if (sc && (uri.empty() || uri == sc->uri()))
+        {
+            const auto pace = paceFor(sc->uri());
+            sc->paceSet(pace.rate, pace.burst);
+        }
+    }
+}
+
+void
+TxUpdater::serverListSet(const std::vector<std::string> &servers)
+{
+    serverList_ = servers;
+    untriedLibbitcoin_.clear();
+    untriedStratum_.clear();
+    generalInfo_ = false;
+}
+
+void
+TxUpdater::recorderSet(std::shared_ptr<TrafficRecorder> recorder)
+{
+    recorder_ = recorder;
+    for (auto &i: watches_)
+    {
+        if (i.second.sc)
+            i.second.sc->recorderSet(recorder);
+        if (i.second.lc)
+            i.second.lc->recorderSet(recorder);
+    }
+}
+
+void
+TxUpdater::walletAdd(const std::string &id, Cache &cache)
+{
+    wallets_[id] = WalletState{&cache, false, time(nullptr)};
+}
+
+void
+TxUpdater::walletRemove(const std::string &id)
+{
+    auto i = wallets_.find(id);
+    if (wallets_.end() == i)
+        return;
+
+    if (i->second.dirty)
+        i->second.cache->save().log(); // Failure is fine
+    wallets_.erase(i);
+
+    for (auto &address: addressWallets_)
+        address.second.erase(id);
+    inflight_.leave(id);
+}
+
+Cache *
+TxUpdater::walletCache(const std::string &id)
+{
+    auto i = wallets_.find(id);
+    return wallets_.end() == i ? nullptr : i->second.cache;
+}
+
+void
+TxUpdater::walletDirty(const std::string &id)
 {
+    auto i = wallets_.find(id);
+    if (wallets_.end() != i)
+        i->second.dirty = true;
 }
 
 void
@@ -42,11 +153,19 @@ TxUpdater::disconnect()
     auto i = connections_.begin();
     while (i != connections_.end())
     {
+        watchRemove(*i);
         delete *i;
         i = connections_.erase(i);
     }
 
-    ABC_DebugLog("Disconnected from all servers.");
+    connecting_.clear();
+    servers_.save().log(); // Failure is fine
+
+    const auto stats = inflight_.stats();
+    ABC_DebugLog("Disconnected from all servers. "
+                 "%d of %d requests were merged (%.0f%%).",
+                 stats.requests - stats.sent, stats.requests,
+                 100 * stats.ratio());
 }
 
 Status
@@ -63,13 +182,23 @@ TxUpdater::connect()
         ABC_DebugLevel(1, "serverList_[%d]=%s", i, serverList_[i].c_str());
     }
 
+    // Servers we are already talking to don't need a second connection:
+    std::set<std::string> connected;
+    for (auto *bc: connections_)
+        connected.insert(bc->uri());
+    auto isConnected = [&connected](const std::string &server)
+    {
+        return connected.count(server.substr(0, server.find(' ')));
+    };
+
     // If we are out of fresh libbitcoin servers, reload the list:
     if (untriedLibbitcoin_.empty())
     {
         for (size_t i = 0; i < serverList_.size(); ++i)
         {
             const auto &server = serverList_[i];
-            if (0 == server.compare(0, LIBBITCOIN_PREFIX_LENGTH, LIBBITCOIN_PREFIX))
+            if (0 == server.compare(0, LIBBITCOIN_PREFIX_LENGTH, LIBBITCOIN_PREFIX)
+                    && !isConnected(server))
                 untriedLibbitcoin_.insert(i);
         }
     }
@@ -80,7 +209,8 @@ TxUpdater::connect()
         for (size_t i = 0; i < serverList_.size(); ++i)
         {
             const auto &server = serverList_[i];
-            if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX))
+            if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX)
+                    && !isConnected(server))
                 untriedStratum_.insert(i);
         }
     }
@@ -126,9 +256,7 @@ TxUpdater::connect()
                 ((minSecondary - *secondaryCount < NUM_CONNECT_SERVERS - connections_.size()) ||
                  (rand() & 8)))
         {
-            auto i = untriedPrimary->begin();
-            std::advance(i, rand() % untriedPrimary->size());
-            if (connectTo(*i).log())
+            if (connectTo(pickUntried(*untriedPrimary)).log())
             {
                 (*primaryCount)++;
                 ++numConnections;
@@ -138,9 +266,7 @@ TxUpdater::connect()
                  ((minPrimary - *primaryCount < NUM_CONNECT_SERVERS - connections_.size()) ||
                   (rand() & 8)))
         {
-            auto i = untriedSecondary->begin();
-            std::advance(i, rand() % untriedSecondary->size());
-            if (connectTo(*i).log())
+            if (connectTo(pickUntried(*untriedSecondary)).log())
             {
                 (*secondaryCount)++;
                 ++numConnections;
@@ -156,92 +282,230 @@ TxUpdater::wakeup()
 {
     // Handle any old work that has finished:
     std::chrono::milliseconds nextWakeup(0);
-    for (auto *bc: connections_)
+    for (auto &i: watches_)
     {
-        auto *sc = dynamic_cast<StratumConnection *>(bc);
+        auto *bc = i.first;
+        auto &watch = i.second;
+        if (!watch.ready)
+            continue;
+        watch.ready = false;
+
+        SleepTime sleep(0);
+        auto *sc = watch.sc;
         if (sc)
         {
-            SleepTime sleep;
             if (!sc->wakeup(sleep).log())
+            {
+                servers_.failed(bc->uri());
                 failedServers_.insert(bc->uri());
-            else
-                nextWakeup = bc::client::min_sleep(nextWakeup, sleep);
+                continue;
+            }
+
+            // Time the connection setup:
+            auto i = connecting_.find(bc->uri());
+            if (connecting_.end() != i && sc->connected())
+            {
+                servers_.connected(bc->uri(),
+                                   std::chrono::duration_cast<SleepTime>(
+                                       std::chrono::steady_clock::now() -
+                                       i->second));
+                connecting_.erase(i);
+            }
         }
 
-        auto *lc = dynamic_cast<LibbitcoinConnection *>(bc);
-        if (lc)
-            nextWakeup = bc::client::min_sleep(nextWakeup, lc->wakeup());
+        if (watch.lc)
+            sleep = watch.lc->wakeup();
+
+        watchUpdate(bc, watch, sleep);
     }
 
-    // Fetch missing transactions:
-    time_t sleep;
-    const auto statuses = cache_.addresses.statuses(sleep);
-    nextWakeup = bc::client::min_sleep(nextWakeup, std::chrono::seconds(sleep));
-    for (const auto &status: statuses)
+    // Address work, by class, with a queue for each wallet:
+    enum { workPriority, workDirty, workCheck, workClasses };
+    typedef std::deque<AddressStatus> WorkQueue;
+    std::vector<std::map<std::string, WorkQueue>> work(workClasses);
+
+    for (const auto &wallet: wallets_)
     {
-        for (const auto &txid: status.missingTxids)
+        const auto &walletId = wallet.first;
+        auto &cache = *wallet.second.cache;
+
+        // Fetch missing transactions:
+        time_t sleep;
+        const auto statuses = cache.addresses.statuses(sleep);
+        nextWakeup = bc::client::min_sleep(nextWakeup,
+                                           std::chrono::seconds(sleep));
+        for (const auto &status: statuses)
         {
-            // Try to use the same server:
-            auto *bc = pickServer(addressServers_[status.address]);
-            if (!bc)
-                break;
+            const auto priority = status.priority ? Priority::interactive :
+                                  Priority::background;
+            for (const auto &txid: status.missingTxids)
+            {
+                // Try to use the same server:
+                auto *bc = pickServer(addressServers_[status.address], false,
+                                      priority);
+                if (!bc)
+                    break;
 
-            fetchTx(txid, bc);
+                fetchTx(txid, walletId, bc, priority);
+            }
         }
-    }
 
-    // Schedule new address work:
-    for (const auto &status: statuses)
-    {
-        if (status.dirty)
+        for (const auto &status: statuses)
         {
-            // Try to use the same server that made us dirty:
-            auto *bc = pickServer(addressServers_[status.address]);
-            if (!bc)
-                break;
+            if (!status.dirty && !status.needsCheck)
+                continue;
 
-            if (bc->addressSubscribed(status.address))
-                fetchAddress(status.address, bc);
-            else
-                subscribeAddress(status.address, bc);
+            const auto type = status.priority ? workPriority :
+                              status.dirty ? workDirty : workCheck;
+            work[type][walletId].push_back(status);
         }
-        else if (status.needsCheck)
+    }
+
+    // Schedule new address work, taking turns between wallets
+    // so one big wallet can't use up every server's pace:
+    const auto turn = walletTurn_++;
+    bool paceLimited = false;
+    for (auto &queues: work)
+    {
+        std::vector<std::pair<std::string, WorkQueue *>> order;
+        for (auto &i: queues)
+            order.emplace_back(i.first, &i.second);
+        if (order.empty())
+            continue;
+        std::rotate(order.begin(), order.begin() + turn % order.size(),
+                    order.end());
+
+        bool more = true;
+        while (more)
         {
-            // Try to use a different server than last time:
-            auto *bc = pickOtherServer(addressServers_[status.address]);
-            if (!bc)
-                break;
+            more = false;
+            for (auto &i: order)
+            {
+                const auto &walletId = i.first;
+                auto *queue = i.second;
+                if (queue->empty())
+                    continue;
+                const auto status = queue->front();
+                queue->pop_front();
+                more = more || !queue->empty();
+                const auto priority = status.priority ? Priority::interactive :
+                                      Priority::background;
+
+                IBitcoinConnection *bc;
+                if (status.dirty)
+                {
+                    // Try to use the same server that made us dirty:
+                    bc = pickServer(addressServers_[status.address], true,
+                                    priority);
+                    if (!bc)
+                    {
+                        paceLimited = true;
+                        continue;
+                    }
+
+                    if (bc->addressSubscribed(status.address))
+                        fetchAddress(status.address, walletId, bc, priority);
+                    else
+                        subscribeAddress(status.address, walletId, bc,
+                                         priority);
+                }
+                else
+                {
+                    // Try to use a different server than last time:
+                    bc = pickOtherServer(addressServers_[status.address],
+                                         true, priority);
+                    if (!bc)
+                    {
+                        paceLimited = true;
+                        continue;
+                    }
+
+                    subscribeAddress(status.address, walletId, bc, priority);
+                }
+            }
+        }
+    }
 
-            subscribeAddress(status.address, bc);
+    // Come back once the servers have tokens again:
+    if (paceLimited)
+    {
+        for (const auto &i: watches_)
+        {
+            if (!i.second.sc)
+                continue;
+            const auto wait = i.second.sc->paceWait();
+            if (wait.count())
+                nextWakeup = bc::client::min_sleep(nextWakeup,
+                                                   wait + SleepTime(1));
         }
     }
 
-    // Grab block headers that we don't have:
+    // Grab whole chunks of block headers where we are missing many:
     while (true)
     {
-        size_t headerNeeded = cache_.blocks.headerNeeded();
-        if (!headerNeeded)
+        auto *sc = pickChunkServer();
+        if (!sc)
             break;
 
+        size_t chunk;
+        std::set<size_t> heights;
+        if (!blocks_.headerChunkNeeded(chunk, heights, stratumChunkSize,
+                                             HEADER_CHUNK_MINIMUM))
+            break;
+
+        blockHeaderChunkFetch(chunk, heights, sc);
+    }
+
+    // Pipeline the remaining block headers one by one.
+    // Pick the server first, since taking a height removes it from the list:
+    while (true)
+    {
         auto *bc = pickOtherServer();
         if (!bc)
             break;
 
+        size_t headerNeeded = blocks_.headerNeeded();
+        if (!headerNeeded)
+            break;
+
         blockHeaderFetch(headerNeeded, bc);
     }
-    cache_.blocks.save();
-    cache_.blocks.onHeaderInvoke();
+    blocks_.save();
+    blocks_.onHeaderInvoke();
 
-    // Save the cache if it is dirty and enough time has elapsed:
-    if (cacheDirty)
+    // Send everything we just asked for:
+    for (auto &i: watches_)
     {
-        time_t now = time(nullptr);
+        auto &watch = i.second;
+        bool sent = false;
+        if (watch.sc)
+        {
+            sent = watch.sc->flushNeeded();
+            if (!watch.sc->flush().log())
+                failedServers_.insert(i.first->uri());
+            sent = sent && !watch.sc->flushNeeded();
+        }
+
+        // Zeromq can swallow its own signal while sending:
+        if (watch.lc)
+            sent = watch.lc->pending();
+
+        // Give the connection a turn to arm its request timeouts:
+        if (sent)
+            watch.ready = true;
+    }
 
-        if (10 <= now - cacheLastSave)
+    // Save the caches that are dirty once enough time has elapsed:
+    time_t now = time(nullptr);
+    for (auto &wallet: wallets_)
+    {
+        auto &state = wallet.second;
+        if (state.dirty && 10 <= now - state.lastSave)
         {
-            cache_.save().log(); // Failure is fine
-            cacheLastSave = now;
-            cacheDirty = false;
+            state.cache->save().log(); // Failure is fine
+            servers_.save().log(); // Failure is fine
+            state.lastSave = now;
+            state.dirty = false;
         }
     }
 
@@ -255,6 +519,8 @@ TxUpdater::wakeup()
             if (uri == bc->uri())
             {
                 ABC_DebugLog("Disconnecting from %s", bc->uri().c_str());
+                connecting_.erase(uri);
+                watchRemove(bc);
                 delete bc;
                 i = connections_.erase(i);
             }
@@ -270,45 +536,92 @@ TxUpdater::wakeup()
     if (wantConnection && connections_.size() < NUM_CONNECT_SERVERS)
         connect().log();
 
+    // Connections that are new or just sent requests need a turn soon:
+    for (const auto &i: watches_)
+        if (i.second.ready)
+            nextWakeup = bc::client::min_sleep(nextWakeup, SleepTime(1));
+
     return nextWakeup;
 }
 
-std::list<zmq_pollitem_t>
-TxUpdater::pollitems()
+void
+TxUpdater::watchUpdate(IBitcoinConnection *bc, Watch &watch, SleepTime sleep)
 {
-    std::list<zmq_pollitem_t> out;
-    for (auto *bc: connections_)
+    auto onReady = [this, bc](short revents)
     {
-        auto *sc = dynamic_cast<StratumConnection *>(bc);
-        if (sc)
-        {
-            zmq_pollitem_t pollitem =
-            {
-                nullptr, sc->pollfd(), ZMQ_POLLIN, ZMQ_POLLOUT
-            };
-            out.push_back(pollitem);
-        }
+        auto i = watches_.find(bc);
+        if (watches_.end() != i)
+            i->second.ready = true;
+    };
+
+    // Sockets come and go while connecting, and a closed descriptor
+    // can come back with the same number, so re-register those each time:
+    std::vector<struct pollfd> fds;
+    if (watch.sc)
+        fds = watch.sc->pollfds();
+    if (watch.lc)
+        fds.push_back(pollfd{ watch.lc->fd(), POLLIN, 0 });
+    const bool settled = !watch.sc || watch.sc->connected();
 
-        auto *lc = dynamic_cast<LibbitcoinConnection *>(bc);
-        if (lc)
-            out.push_back(lc->pollitem());
+    for (const auto &fd: watch.fds)
+    {
+        bool keep = false;
+        for (const auto &item: fds)
+            keep = keep || (settled && item.fd == fd.fd);
+        if (!keep)
+            reactor_.unwatch(fd.fd);
     }
-    return out;
+    for (const auto &fd: fds)
+        reactor_.watch(fd.fd, fd.events, onReady).log();
+    watch.fds = fds;
+
+    // Wake up again when the connection asked to:
+    if (watch.timer)
+        reactor_.timerCancel(watch.timer);
+    watch.timer = 0;
+    if (sleep.count())
+        watch.timer = reactor_.timerAdd(Reactor::Clock::now() + sleep,
+                                        [onReady]() { onReady(0); });
+}
+
+void
+TxUpdater::watchRemove(IBitcoinConnection *bc)
+{
+    auto i = watches_.find(bc);
+    if (watches_.end() == i)
+        return;
+
+    for (const auto &fd: i->second.fds)
+        reactor_.unwatch(fd.fd);
+    if (i->second.timer)
+        reactor_.timerCancel(i->second.timer);
+    watches_.erase(i);
 }
 
 void
 TxUpdater::sendTx(StatusCallback status, DataSlice tx)
 {
+    // Pick one (and only one) stratum server for the broadcast,
+    // preferring one that can send it right away:
+    StratumConnection *pick = nullptr;
     for (auto *bc: connections_)
     {
-        // Pick one (and only one) stratum server for the broadcast:
         auto *sc = dynamic_cast<StratumConnection *>(bc);
-        if (sc)
+        if (!sc)
+            continue;
+        if (!pick)
+            pick = sc;
+        if (!sc->queueFull(Priority::interactive))
         {
-            sc->sendTx(status, tx);
-            return;
+            pick = sc;
+            break;
         }
     }
+    if (pick)
+    {
+        pick->sendTx(status, tx);
+        return;
+    }
 
     // If we get here, there are no stratum connections:
     status(ABC_ERROR(ABC_CC_Error, "No stratum connections"));
@@ -335,7 +648,15 @@ TxUpdater::connectTo(long index)
         // Libbitcoin server:
         untriedLibbitcoin_.erase(index);
         std::unique_ptr<LibbitcoinConnection> lc(new LibbitcoinConnection(ctx_));
+        auto onTxPush = [this, server](const std::string &address,
+                                       size_t height,
+                                       const bc::transaction_type &tx)
+        {
+            txPushed(server, address, height, tx);
+        };
+        lc->onTxPushSet(onTxPush);
         ABC_CHECK(lc->connect(server, key));
+        lc->recorderSet(recorder_);
         bc.reset(lc.release());
     }
     else if (0 == server.compare(0, STRATUM_PREFIX_LENGTH, STRATUM_PREFIX))
@@ -343,7 +664,21 @@ TxUpdater::connectTo(long index)
         // Stratum server:
         untriedStratum_.erase(index);
         std::unique_ptr<StratumConnection> sc(new StratumConnection());
-        ABC_CHECK(sc->connect(server));
+        auto onLatency = [this, server](SleepTime latency)
+        {
+            servers_.replied(server, latency);
+        };
+        sc->onLatencySet(onLatency);
+        const auto pace = paceFor(server);
+        sc->paceSet(pace.rate, pace.burst);
+        auto s = sc->connect(server);
+        if (!s)
+        {
+            servers_.failed(server);
+            return s;
+        }
+        sc->recorderSet(recorder_);
+        connecting_[server] = std::chrono::steady_clock::now();
         bc.reset(sc.release());
     }
     else
@@ -356,7 +691,7 @@ TxUpdater::connectTo(long index)
 
     // Check for mining fees:
     auto sc = dynamic_cast<StratumConnection *>(bc.get());
-    if (generalEstimateFeesNeedUpdate() && sc)
+    if (generalInfo_ && sc && generalEstimateFeesNeedUpdate())
     {
         fetchFeeEstimate(1, sc);
         fetchFeeEstimate(2, sc);
@@ -365,41 +700,130 @@ TxUpdater::connectTo(long index)
         fetchFeeEstimate(5, sc);
     }
 
+    // Give the new connection its first turn right away:
+    watches_[bc.get()] = Watch
+    {
+        sc, dynamic_cast<LibbitcoinConnection *>(bc.get()), {}, 0, true
+    };
+
     connections_.push_back(bc.release());
-    ABC_DebugLog("Connected to %s as %d", server.c_str(), index);
+    ABC_DebugLog("Connecting to %s as %d", server.c_str(), index);
 
     return Status();
 }
 
 IBitcoinConnection *
-TxUpdater::pickServer(const std::string &name)
+TxUpdater::pickServer(const std::string &name, bool paced, Priority priority)
 {
+    // Interactive requests borrow their tokens:
+    paced = paced && Priority::background == priority;
+
     // If the requested server is connected, only consider that:
     for (auto *bc: connections_)
         if (name == bc->uri() && !failedServers_.count(bc->uri()))
-            return bc->queueFull() ? nullptr : bc;
+            return bc->queueFull(priority) || !paceReady(bc, paced) ?
+                   nullptr : bc;
 
     // Otherwise, use any server:
-    return pickOtherServer();
+    return pickOtherServer("", paced, priority);
+}
+
+StratumConnection *
+TxUpdater::pickChunkServer()
+{
+    for (auto *bc: connections_)
+    {
+        auto *sc = dynamic_cast<StratumConnection *>(bc);
+        if (sc && !sc->queueFull() && !failedServers_.count(sc->uri())
+                && !noChunkServers_.count(sc->uri()))
+            return sc;
+    }
+
+    return nullptr;
 }
 
 IBitcoinConnection *
-TxUpdater::pickOtherServer(const std::string &name)
+TxUpdater::pickOtherServer(const std::string &name, bool paced,
+                           Priority priority)
 {
+    IBitcoinConnection *best = nullptr;
     IBitcoinConnection *fallback = nullptr;
+    double bestScore = 0;
+    paced = paced && Priority::background == priority;
 
     for (auto *bc: connections_)
     {
-        if (!bc->queueFull() && !failedServers_.count(bc->uri()))
+        if (!bc->queueFull(priority) && !failedServers_.count(bc->uri()) &&
+                paceReady(bc, paced))
         {
-            if (name != bc->uri())
-                return bc; // Just what we want!
-            else
+            if (name == bc->uri())
+            {
                 fallback = bc; // Not our first choice, but tolerable.
+                continue;
+            }
+
+            const auto score = servers_.score(bc->uri());
+            if (!best || score < bestScore)
+            {
+                best = bc;
+                bestScore = score;
+            }
         }
     }
 
-    return fallback;
+    return best ? best : fallback;
+}
+
+bool
+TxUpdater::paceReady(IBitcoinConnection *bc, bool paced)
+{
+    if (!paced)
+        return true;
+
+    auto i = watches_.find(bc);
+    if (watches_.end() == i || !i->second.sc)
+        return true;
+    return !i->second.sc->paceWait().count();
+}
+
+TxUpdater::Pace
+TxUpdater::paceFor(const std::string &uri) const
+{
+    auto i = serverPaces_.find(uri);
+    return serverPaces_.end() != i ? i->second : pace_;
+}
+
+int
+TxUpdater::pickUntried(const std::set<int> &untried)
+{
+    std::vector<int> indices(untried.begin(), untried.end());
+    std::vector<std::string> uris;
+    for (auto index: indices)
+    {
+        const auto &server = serverList_[index];
+        uris.push_back(server.substr(0, server.find(' ')));
+    }
+
+    return indices[servers_.pick(uris)];
+}
+
+bool
+TxUpdater::serverFailed(const std::string &uri, Status status)
+{
+    // We closed the connection ourselves, so the server did nothing wrong:
+    if (ABC_CC_Cancelled == status.value())
+        return false;
+
+    // The connection stays up, so other requests can still use it:
+    if (ABC_CC_ServerTimeout == status.value())
+    {
+        servers_.timedOut(uri);
+        return true;
+    }
+
+    servers_.failed(uri);
+    failedServers_.insert(uri);
+    return false;
 }
 
 void
@@ -410,25 +834,30 @@ TxUpdater::subscribeHeight(IBitcoinConnection *bc)
     {
         ABC_DebugLog("%s: height subscribe failed (%s)",
                      uri.c_str(), s.message().c_str());
-        failedServers_.insert(uri);
+        serverFailed(uri, s);
     };
 
     auto onReply = [this, uri](size_t height)
     {
         ABC_DebugLog("%s: height %d returned", uri.c_str(), height);
-        cache_.blocks.heightSet(height);
+        blocks_.heightSet(height);
+        servers_.heightReported(uri, height);
 
         // Update addresses with unconfirmed txs:
-        const auto statuses = cache_.txs.statuses(cache_.addresses.txids());
-        for (const auto status: statuses)
+        for (const auto &wallet: wallets_)
         {
-            if (!status.second.height)
+            auto &cache = *wallet.second.cache;
+            const auto statuses = cache.txs.statuses(cache.addresses.txids());
+            for (const auto status: statuses)
             {
-                for (const auto &io: status.first.ios)
+                if (!status.second.height)
                 {
-                    ABC_DebugLog("Marking %s dirty (tx height check)",
-                                 io.address.c_str());
-                    cache_.addresses.updateStratumHash(io.address);
+                    for (const auto &io: status.first.ios)
+                    {
+                        ABC_DebugLog("Marking %s dirty (tx height check)",
+                                     io.address.c_str());
+                        cache.addresses.updateStratumHash(io.address);
+                    }
                 }
             }
         }
@@ -438,12 +867,18 @@ TxUpdater::subscribeHeight(IBitcoinConnection *bc)
 }
 
 void
-TxUpdater::subscribeAddress(const std::string &address, IBitcoinConnection *bc)
+TxUpdater::subscribeAddress(const std::string &address,
+                            const std::string &walletId,
+                            IBitcoinConnection *bc, Priority priority)
 {
+    addressWallets_[address].insert(walletId);
+
     // If we are already subscribed, mark the address as up-to-date:
     if (bc->addressSubscribed(address))
     {
-        cache_.addresses.updateSubscribe(address);
+        auto *cache = walletCache(walletId);
+        if (cache)
+            cache->addresses.updateSubscribe(address);
         return;
     }
 
@@ -452,125 +887,360 @@ TxUpdater::subscribeAddress(const std::string &address, IBitcoinConnection *bc)
     {
         ABC_DebugLog("%s: %s subscribe failed (%s)",
                      uri.c_str(), address.c_str(), s.message().c_str());
-        failedServers_.insert(uri);
+        serverFailed(uri, s);
     };
 
     auto onReply = [this, address, uri](const std::string &stateHash)
     {
-        if (cache_.addresses.updateStratumHash(address, stateHash))
-        {
-            addressServers_[address] = uri;
-            ABC_DebugLog("%s: %s subscribe reply (dirty) %s",
-                         uri.c_str(), address.c_str(), stateHash.c_str());
-        }
-        else
+        // Every wallet watching this address shares the subscription:
+        for (const auto &walletId: addressWallets_[address])
         {
-            ABC_DebugLog("%s: %s subscribe reply (clean) %s",
-                         uri.c_str(), address.c_str(), stateHash.c_str());
+            auto *cache = walletCache(walletId);
+            if (!cache)
+                continue;
+
+            if (cache->addresses.updateStratumHash(address, stateHash))
+            {
+                addressServers_[address] = uri;
+                ABC_DebugLog("%s: %s subscribe reply (dirty) %s",
+                             uri.c_str(), address.c_str(), stateHash.c_str());
+            }
+            else
+            {
+                ABC_DebugLog("%s: %s subscribe reply (clean) %s",
+                             uri.c_str(), address.c_str(), stateHash.c_str());
+            }
         }
     };
 
-    bc->addressSubscribe(onError, onReply, address);
+    bc->addressSubscribe(onError, onReply, address, priority);
+}
+
+void
+TxUpdater::txPushed(const std::string &uri, const std::string &address,
+                    size_t height, const bc::transaction_type &tx)
+{
+    const auto txid = bc::encode_hash(bc::hash_transaction(tx));
+    ABC_DebugLog("%s: %s pushed tx %s", uri.c_str(), address.c_str(),
+                 txid.c_str());
+    addressServers_[address] = uri;
+
+    // No need to fetch the history or the transaction:
+    for (const auto &walletId: addressWallets_[address])
+    {
+        auto *cache = walletCache(walletId);
+        if (!cache)
+            continue;
+
+        cache->txs.insert(tx);
+        cache->txs.confirmed(txid, height);
+        cache->addresses.updatePushed(address, txid);
+        walletDirty(walletId);
+        prefetch(TxidSet{txid}, walletId, uri, Priority::background);
+    }
 }
 
 void
-TxUpdater::fetchAddress(const std::string &address, IBitcoinConnection *bc)
+TxUpdater::fetchAddress(const std::string &address,
+                        const std::string &walletId,
+                        IBitcoinConnection *bc, Priority priority)
 {
-    if (wipAddresses_.count(address))
+    if (!inflight_.join("address:" + address, walletId))
         return;
-    wipAddresses_.insert(address);
+
+    auto race = raceStart();
+    fetchAddressSend(address, bc, race, priority);
+    if (Priority::interactive == priority)
+    {
+        hedgeArm(race, bc->uri(), [this, address, race](IBitcoinConnection *bc)
+        {
+            fetchAddressSend(address, bc, race, Priority::interactive);
+        });
+    }
+}
+
+void
+TxUpdater::fetchAddressSend(const std::string &address,
+                            IBitcoinConnection *bc, RacePtr race,
+                            Priority priority)
+{
+    ++race->outstanding;
 
     const auto uri = bc->uri();
-    auto onError = [this, address, uri](Status s)
+    auto onError = [this, address, uri, race, priority](Status s)
     {
         ABC_DebugLog("%s: %s fetch failed (%s)",
                      uri.c_str(), address.c_str(), s.message().c_str());
-        failedServers_.insert(uri);
-        wipAddresses_.erase(address);
+        --race->outstanding;
+
+        // Score the server even if another copy already won the race:
+        const bool retry = serverFailed(uri, s);
+        if (race->done)
+            return;
+
+        // A hedged copy might still come through:
+        if (race->outstanding)
+            return;
+        raceFinish(race);
+
+        const auto waiting = inflight_.finish("address:" + address);
+        if (retry)
+        {
+            auto *bc = pickOtherServer(uri, false, priority);
+            if (bc)
+                for (const auto &walletId: waiting)
+                    fetchAddress(address, walletId, bc, priority);
+        }
     };
 
-    auto onReply = [this, address, uri](const AddressHistory &history)
+    auto onReply = [this, address, uri, race, priority](
+                       const AddressHistory &history)
     {
+        --race->outstanding;
+        if (!raceFinish(race))
+        {
+            ABC_DebugLog("%s: %s fetch lost the race", uri.c_str(),
+                         address.c_str());
+            return;
+        }
+
         ABC_DebugLog("%s: %s fetched %d TXIDs", uri.c_str(), address.c_str(),
                      history.size());
-        wipAddresses_.erase(address);
+        const auto waiting = inflight_.finish("address:" + address);
         addressServers_[address] = uri;
 
-        TxidSet txids;
-        for (auto &row: history)
+        for (const auto &walletId: waiting)
         {
-            cache_.txs.confirmed(row.first, row.second);
-            txids.insert(row.first);
-        }
+            auto *cache = walletCache(walletId);
+            if (!cache)
+                continue;
 
-        if (!history.empty())
-        {
-            cache_.addresses.update(address, txids);
-        }
-        else
-        {
-            std::string hash = cache_.addresses.getStratumHash(address);
-            if (hash.empty())
+            TxidSet txids;
+            for (auto &row: history)
+            {
+                cache->txs.confirmed(row.first, row.second);
+                txids.insert(row.first);
+            }
+
+            if (!history.empty())
             {
-                cache_.addresses.update(address, txids);
+                cache->addresses.update(address, txids);
             }
             else
             {
-                ABC_DebugLog("%s: %s SERVER ERROR EMPTY TXIDs with hash %s", uri.c_str(),
-                             address.c_str(), hash.c_str());
-                // Do not trust current server. Force a new server.
-                addressServers_[address] = "";
+                std::string hash = cache->addresses.getStratumHash(address);
+                if (hash.empty())
+                {
+                    cache->addresses.update(address, txids);
+                }
+                else
+                {
+                    ABC_DebugLog("%s: %s SERVER ERROR EMPTY TXIDs with hash %s",
+                                 uri.c_str(), address.c_str(), hash.c_str());
+                    // Do not trust current server. Force a new server.
+                    addressServers_[address] = "";
+                }
             }
+
+            // Start on the new transactions right away:
+            prefetch(txids, walletId, uri, priority);
         }
     };
 
-    bc->addressHistoryFetch(onError, onReply, address);
+    bc->addressHistoryFetch(onError, onReply, address, priority);
 }
 
 void
-TxUpdater::fetchTx(const std::string &txid, IBitcoinConnection *bc)
+TxUpdater::fetchTx(const std::string &txid, const std::string &walletId,
+                   IBitcoinConnection *bc, Priority priority)
 {
-    if (wipTxids_.count(txid))
+    if (!inflight_.join("tx:" + txid, walletId))
         return;
-    wipTxids_.insert(txid);
+
+    auto race = raceStart();
+    fetchTxSend(txid, bc, race, priority);
+    if (Priority::interactive == priority)
+    {
+        hedgeArm(race, bc->uri(), [this, txid, race](IBitcoinConnection *bc)
+        {
+            fetchTxSend(txid, bc, race, Priority::interactive);
+        });
+    }
+}
+
+void
+TxUpdater::fetchTxSend(const std::string &txid, IBitcoinConnection *bc,
+                       RacePtr race, Priority priority)
+{
+    ++race->outstanding;
 
     const auto uri = bc->uri();
-    auto onError = [this, txid, uri](Status s)
+    auto onError = [this, txid, uri, race, priority](Status s)
     {
         ABC_DebugLog("%s: tx %s fetch failed (%s)",
                      uri.c_str(), txid.c_str(), s.message().c_str());
-        failedServers_.insert(uri);
-        wipTxids_.erase(txid);
+        --race->outstanding;
+
+        // Score the server even if another copy already won the race:
+        const bool retry = serverFailed(uri, s);
+        if (race->done)
+            return;
+
+        // A hedged copy might still come through:
+        if (race->outstanding)
+            return;
+        raceFinish(race);
+
+        const auto waiting = inflight_.finish("tx:" + txid);
+        if (retry)
+        {
+            auto *bc = pickOtherServer(uri, false, priority);
+            if (bc)
+                for (const auto &walletId: waiting)
+                    fetchTx(txid, walletId, bc, priority);
+        }
     };
 
-    auto onReply = [this, txid, uri](const bc::transaction_type &tx)
+    auto onReply = [this, txid, uri, race, priority](
+                       const bc::transaction_type &tx)
     {
+        --race->outstanding;
+        if (!raceFinish(race))
+        {
+            ABC_DebugLog("%s: tx %s fetch lost the race",
+                         uri.c_str(), txid.c_str());
+            return;
+        }
+
         ABC_DebugLog("%s: tx %s fetched", uri.c_str(), txid.c_str());
-        wipTxids_.erase(txid);
+        const auto waiting = inflight_.finish("tx:" + txid);
+
+        for (const auto &walletId: waiting)
+        {
+            auto *cache = walletCache(walletId);
+            if (!cache)
+                continue;
 
-        cache_.txs.insert(tx);
-        cache_.addresses.update();
-        cacheDirty = true;
+            cache->txs.insert(tx);
+            cache->addresses.update();
+            walletDirty(walletId);
+
+            // Go straight for the inputs, but not their inputs in turn:
+            if (cache->addresses.hasTxid(txid))
+                prefetch(TxidSet{txid}, walletId, uri, priority);
+        }
     };
 
     ABC_DebugLog("%s: tx %s requested", uri.c_str(), txid.c_str());
-    bc->txDataFetch(onError, onReply, txid);
+    bc->txDataFetch(onError, onReply, txid, priority);
+}
+
+void
+TxUpdater::prefetch(const TxidSet &txids, const std::string &walletId,
+                    const std::string &uri, Priority priority)
+{
+    auto *cache = walletCache(walletId);
+    if (!cache)
+        return;
+
+    // Anything that doesn't fit now goes out on a later wakeup.
+    // The address-status pass already leans on the server that just
+    // answered, so start somewhere else:
+    std::string last = uri;
+    for (const auto &txid: cache->txs.missingTxids(txids))
+    {
+        auto *bc = pickOtherServer(last, false, priority);
+        if (!bc)
+            break;
+
+        fetchTx(txid, walletId, bc, priority);
+        last = bc->uri();
+    }
+}
+
+TxUpdater::RacePtr
+TxUpdater::raceStart()
+{
+    // Let old history fade, so the budget tracks recent traffic:
+    raceCount_ += 1;
+    if (HEDGE_HISTORY < raceCount_)
+    {
+        raceCount_ /= 2;
+        hedgeCount_ /= 2;
+    }
+
+    return std::make_shared<Race>();
+}
+
+bool
+TxUpdater::raceFinish(RacePtr race)
+{
+    if (race->done)
+        return false;
+
+    race->done = true;
+    if (race->timer)
+        reactor_.timerCancel(race->timer);
+    race->timer = 0;
+    return true;
+}
+
+void
+TxUpdater::hedgeArm(RacePtr race, const std::string &uri,
+                    const std::function<void (IBitcoinConnection *)> &resend)
+{
+    if (hedgeBudget_ <= 0)
+        return;
+
+    // Give the server as long as it usually takes, but no longer:
+    SleepTime delay = HEDGE_DEFAULT_DELAY;
+    ServerCache::Stats stats;
+    if (servers_.stats(stats, uri) && stats.latency90.count())
+        delay = std::max(HEDGE_MINIMUM_DELAY, stats.latency90);
+
+    auto onTimer = [this, race, uri, resend]()
+    {
+        race->timer = 0;
+        if (race->done)
+            return;
+
+        // Stay within the budget:
+        if (hedgeBudget_ * raceCount_ + HEDGE_BURST < hedgeCount_ + 1)
+            return;
+
+        auto *bc = pickOtherServer(uri, false, Priority::interactive);
+        if (!bc || uri == bc->uri())
+            return;
+
+        ABC_DebugLog("%s: hedging slow request on %s",
+                     uri.c_str(), bc->uri().c_str());
+        hedgeCount_ += 1;
+        resend(bc); // The next wakeup flushes this
+    };
+    race->timer = reactor_.timerAdd(Reactor::Clock::now() + delay, onTimer);
 }
 
 void
 TxUpdater::fetchFeeEstimate(size_t blocks, StratumConnection *sc)
 {
+    // One estimate at a time is plenty, whichever server gives it:
+    const auto key = "fee:" + std::to_string(blocks);
+    if (!inflight_.join(key))
+        return;
+
     const auto uri = sc->uri();
-    auto onError = [this, blocks, uri](Status s)
+    auto onError = [this, blocks, key, uri](Status s)
     {
         ABC_DebugLog("%s: get fees for %d blocks failed (%s)",
                      uri.c_str(), blocks, s.message().c_str());
+        inflight_.finish(key);
     };
 
-    auto onReply = [this, blocks, uri](double fee)
+    auto onReply = [this, blocks, key, uri](double fee)
     {
         ABC_DebugLog("%s: returned fee %lf for %d blocks",
                      uri.c_str(), fee, blocks);
+        inflight_.finish(key);
 
         if (fee > 0)
         {
@@ -584,23 +1254,91 @@ TxUpdater::fetchFeeEstimate(size_t blocks, StratumConnection *sc)
 void
 TxUpdater::blockHeaderFetch(size_t height, IBitcoinConnection *bc)
 {
+    // Several wallets can ask for the same header:
+    const auto key = "header:" + std::to_string(height);
+    if (!inflight_.join(key))
+        return;
+
     const auto uri = bc->uri();
-    auto onError = [this, height, uri](Status s)
+    auto onError = [this, height, key, uri](Status s)
     {
         ABC_DebugLog("%s: header %d fetch failed (%s)",
                      uri.c_str(), height, s.message().c_str());
-        failedServers_.insert(uri);
+        inflight_.finish(key);
+        serverFailed(uri, s);
+
+        // Whatever went wrong, the wallets still need this header:
+        blocks_.headerNeededAdd(height);
     };
 
-    auto onReply = [this, height, uri](const bc::block_header_type &header)
+    auto onReply = [this, height, key, uri](const bc::block_header_type &header)
     {
-        ABC_DebugLog("%s: header %d fetched",
-                     uri.c_str(), height);
+        inflight_.finish(key);
 
-        cache_.blocks.headerInsert(height, header);
+        const auto s = blocks_.headerInsert(height, header);
+        if (s)
+        {
+            ABC_DebugLog("%s: header %d fetched",
+                         uri.c_str(), height);
+        }
+        else
+        {
+            ABC_DebugLog("%s: header %d rejected (%s)",
+                         uri.c_str(), height, s.message().c_str());
+            serverFailed(uri, s);
+            blocks_.headerNeededAdd(height);
+        }
     };
 
     bc->blockHeaderFetch(onError, onReply, height);
 }
 
+void
+TxUpdater::blockHeaderChunkFetch(size_t chunk,
+                                 const std::set<size_t> &heights,
+                                 StratumConnection *sc)
+{
+    const auto uri = sc->uri();
+    auto onError = [this, chunk, heights, uri](Status s)
+    {
+        ABC_DebugLog("%s: header chunk %d fetch failed (%s)",
+                     uri.c_str(), chunk, s.message().c_str());
+
+        // The server might just not support chunks,
+        // so fall back on fetching the headers one by one:
+        if (ABC_CC_ServerError == s.value())
+            noChunkServers_.insert(uri);
+        else
+            serverFailed(uri, s);
+        for (auto height: heights)
+            blocks_.headerNeededAdd(height);
+    };
+
+    auto onReply = [this, chunk, heights, uri](DataSlice rawHeaders)
+    {
+        size_t count;
+        const auto s = blocks_.headersInsert(count, chunk * stratumChunkSize,
+                                             rawHeaders);
+        if (s)
+        {
+            ABC_DebugLog("%s: header chunk %d fetched (%d new)",
+                         uri.c_str(), chunk, count);
+        }
+        else
+        {
+            ABC_DebugLog("%s: header chunk %d rejected (%s)",
+                         uri.c_str(), chunk, s.message().c_str());
+            serverFailed(uri, s);
+        }
+
+        // A short or rejected chunk leaves some heights to fetch again:
+        for (auto height: heights)
+            blocks_.headerNeededAdd(height);
+    };
+
+    ABC_DebugLog("%s: header chunk %d requested for %d headers",
+                 uri.c_str(), chunk, heights.size());
+    sc->blockHeaderChunkFetch(onError, onReply, chunk);
+}
+
 } // namespace abcd
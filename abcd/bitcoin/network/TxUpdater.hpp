@@ -8,43 +8,97 @@
 #ifndef ABCD_BITCOIN_NETWORK_TX_UPDATER_HPP
 #define ABCD_BITCOIN_NETWORK_TX_UPDATER_HPP
 
+#include "IBitcoinConnection.hpp"
+#include "InflightTable.hpp"
+#include "Reactor.hpp"
 #include "../Typedefs.hpp"
 #include "../../util/Data.hpp"
-#include <zmq.h>
 #include <chrono>
 #include <map>
+#include <memory>
 
 namespace abcd {
 
+class BlockCache;
 class Cache;
-class IBitcoinConnection;
+class LibbitcoinConnection;
+class ServerCache;
 class StratumConnection;
+class TrafficRecorder;
 
 /**
- * Syncs a set of transactions with the bitcoin server.
+ * Syncs the transactions of any number of wallets with the bitcoin servers,
+ * sharing one set of connections between them.
  */
 class TxUpdater
 {
 public:
     ~TxUpdater();
-    TxUpdater(Cache &cache, void *ctx);
+    TxUpdater(BlockCache &blocks, ServerCache &servers, void *ctx,
+              Reactor &reactor);
 
     void disconnect();
     Status connect();
 
+    /**
+     * Starts syncing a wallet's cache.
+     * The cache must stay alive until the wallet is removed.
+     */
+    void
+    walletAdd(const std::string &id, Cache &cache);
+
+    /**
+     * Stops syncing a wallet, saving its cache.
+     * Replies still in flight for this wallet are dropped.
+     */
+    void
+    walletRemove(const std::string &id);
+
+    /**
+     * Limits the extra load that hedged requests may add,
+     * as a fraction of all requests. Zero turns hedging off.
+     */
+    void
+    hedgeBudgetSet(double fraction);
+
+    /**
+     * Limits how fast address subscriptions and history polls
+     * go out to the stratum servers.
+     * @param rate Requests per second, or zero for no limit.
+     * @param burst The most requests that can go out at once.
+     * @param uri The server to limit, or blank to change the default.
+     */
+    void
+    paceSet(double rate, double burst, const std::string &uri="");
+
+    /**
+     * Uses a fixed list of servers, rather than the general info.
+     * Since the fee estimates also belong to the general info,
+     * this stops the updater from fetching them.
+     */
+    void
+    serverListSet(const std::vector<std::string> &servers);
+
+    /**
+     * Records the traffic on every server connection,
+     * or stops recording if the recorder is null.
+     */
+    void
+    recorderSet(std::shared_ptr<TrafficRecorder> recorder);
+
+    size_t walletCount() const { return wallets_.size(); }
+    InflightTable::Stats inflightStats() const { return inflight_.stats(); }
+    size_t connectionCount() const { return connections_.size(); }
+
     /**
      * Performs any pending work.
+     * Connections only run when the reactor has seen activity
+     * on their sockets or their timers have expired.
      * Returns the number of milliseconds until the next work will be ready.
      */
     std::chrono::milliseconds
     wakeup();
 
-    /**
-     * Obtains a list of sockets that the main loop should sleep on.
-     */
-    std::list<zmq_pollitem_t>
-    pollitems();
-
     /**
      * Broadcasts a transaction.
      * All errors go to the `status` callback.
@@ -55,21 +109,84 @@ public:
 private:
     Status connectTo(long index);
 
-    Cache &cache_;
+    /**
+     * Chooses one of the untried servers, favoring the ones
+     * that have performed well in the past.
+     */
+    int
+    pickUntried(const std::set<int> &untried);
+
+    BlockCache &blocks_;
+    ServerCache &servers_;
     void *ctx_;
+    Reactor &reactor_;
 
     bool wantConnection = false;
-    bool cacheDirty = false;
-    time_t cacheLastSave = 0;
+
+    // The wallets being synced:
+    struct WalletState
+    {
+        Cache *cache;
+        bool dirty;
+        time_t lastSave;
+    };
+    std::map<std::string, WalletState> wallets_;
+
+    /**
+     * Looks up a wallet's cache.
+     * @return A null pointer if the wallet has gone away.
+     */
+    Cache *
+    walletCache(const std::string &id);
+
+    /**
+     * Marks a wallet's cache as needing to be saved.
+     */
+    void
+    walletDirty(const std::string &id);
 
     std::vector<IBitcoinConnection *> connections_;
+
+    // Reactor registrations for each connection:
+    struct Watch
+    {
+        StratumConnection *sc;
+        LibbitcoinConnection *lc;
+        std::vector<struct pollfd> fds;
+        Reactor::TimerId timer;
+        bool ready;
+    };
+    std::map<IBitcoinConnection *, Watch> watches_;
+
+    /**
+     * Brings a connection's reactor registrations up to date
+     * after it has run.
+     * @param sleep The time until the connection wants to run again.
+     */
+    void
+    watchUpdate(IBitcoinConnection *bc, Watch &watch,
+                std::chrono::milliseconds sleep);
+
+    void
+    watchRemove(IBitcoinConnection *bc);
     std::vector<std::string> serverList_;
+    bool generalInfo_ = true;
+    std::shared_ptr<TrafficRecorder> recorder_;
     std::set<int> untriedLibbitcoin_;
     std::set<int> untriedStratum_;
 
-    // Fetches currently in progress:
-    AddressSet wipAddresses_;
-    TxidSet wipTxids_;
+    // Connections that are still being set up, for timing:
+    std::map<std::string, std::chrono::steady_clock::time_point> connecting_;
+
+    // Fetches currently in progress, along with the waiting wallets.
+    // Wallets that need the same thing share a single fetch:
+    InflightTable inflight_;
+
+    /**
+     * The wallets watching each address, so subscription updates
+     * reach every wallet that shares the address.
+     */
+    std::map<std::string, std::set<std::string>> addressWallets_;
 
     /**
      * The last server used to query the address.
@@ -83,39 +200,166 @@ private:
      */
     std::set<std::string> failedServers_;
 
+    /**
+     * Stratum servers that have rejected `blockchain.block.get_chunk`.
+     */
+    std::set<std::string> noChunkServers_;
+
+    // Address request pacing, by default and for specific servers:
+    struct Pace
+    {
+        double rate;
+        double burst;
+    };
+    Pace pace_;
+    std::map<std::string, Pace> serverPaces_;
+
+    // The wallet whose address work goes first, round-robin:
+    size_t walletTurn_;
+
+    Pace
+    paceFor(const std::string &uri) const;
+
+    /**
+     * True if the server can take a paced request without holding it back.
+     * @param paced False for requests that are not paced at all.
+     */
+    bool
+    paceReady(IBitcoinConnection *bc, bool paced);
+
     /**
      * Finds the requested server, assuming it is even connected and ready.
+     * @param paced True for address requests, which need a free token.
+     * @param priority Interactive requests can use the reserved room,
+     * and don't wait for tokens.
      * @return The best available server,
      * or a null pointer if the server is busy.
      */
     IBitcoinConnection *
-    pickServer(const std::string &name);
+    pickServer(const std::string &name, bool paced=false,
+               Priority priority=Priority::background);
 
     /**
-     * Tries to pick a different server than the one provided.
+     * Finds a stratum server that can fetch block header chunks.
+     * @return The server, or a null pointer if there are none free.
+     */
+    StratumConnection *
+    pickChunkServer();
+
+    /**
+     * Tries to pick a different server than the one provided,
+     * favoring the best-scoring ones.
      * @return The best available server,
      * or a null pointer if there are no free servers.
      */
     IBitcoinConnection *
-    pickOtherServer(const std::string &name="");
+    pickOtherServer(const std::string &name="", bool paced=false,
+                    Priority priority=Priority::background);
+
+    /**
+     * Marks a server as failed, unless the request merely timed out.
+     * Either way, the failure counts against the server's score,
+     * unless we cancelled the request by closing the connection.
+     * @return true if the request should be retried somewhere else.
+     */
+    bool
+    serverFailed(const std::string &uri, Status status);
 
     void
     subscribeHeight(IBitcoinConnection *bc);
 
     void
-    subscribeAddress(const std::string &address, IBitcoinConnection *bc);
+    subscribeAddress(const std::string &address, const std::string &walletId,
+                     IBitcoinConnection *bc,
+                     Priority priority=Priority::background);
+
+    /**
+     * Stores a transaction that came with a subscription update,
+     * saving the history and transaction fetches.
+     */
+    void
+    txPushed(const std::string &uri, const std::string &address,
+             size_t height, const libbitcoin::transaction_type &tx);
+
+    /**
+     * One logical request, possibly sent to two servers at once.
+     * The first reply wins, and the other reply is ignored.
+     */
+    struct Race
+    {
+        bool done = false;
+        unsigned outstanding = 0;
+        Reactor::TimerId timer = 0;
+    };
+    typedef std::shared_ptr<Race> RacePtr;
+
+    // Hedging budget:
+    double hedgeBudget_;
+    double raceCount_;
+    double hedgeCount_;
+
+    RacePtr
+    raceStart();
+
+    /**
+     * Marks a race as decided.
+     * @return false if some other reply already won.
+     */
+    bool
+    raceFinish(RacePtr race);
+
+    /**
+     * If the first server is slower than it usually is,
+     * sends a copy of the request to a second server,
+     * as long as the hedging budget allows.
+     * Only interactive requests get hedged.
+     */
+    void
+    hedgeArm(RacePtr race, const std::string &uri,
+             const std::function<void (IBitcoinConnection *)> &resend);
+
+    /**
+     * @param priority Interactive if the user is waiting on the answer,
+     * which also makes the request eligible for hedging.
+     */
+    void
+    fetchAddress(const std::string &address, const std::string &walletId,
+                 IBitcoinConnection *bc,
+                 Priority priority=Priority::background);
 
     void
-    fetchAddress(const std::string &address, IBitcoinConnection *bc);
+    fetchAddressSend(const std::string &address, IBitcoinConnection *bc,
+                     RacePtr race, Priority priority);
 
     void
-    fetchTx(const std::string &txid, IBitcoinConnection *bc);
+    fetchTx(const std::string &txid, const std::string &walletId,
+            IBitcoinConnection *bc, Priority priority=Priority::background);
+
+    void
+    fetchTxSend(const std::string &txid, IBitcoinConnection *bc,
+                RacePtr race, Priority priority);
+
+    /**
+     * Fetches whatever these wallet transactions are still missing,
+     * either the transactions themselves or their inputs,
+     * without waiting for the address statuses to notice.
+     * The requests take turns between servers, starting away from `uri`,
+     * so they come back together.
+     * @param uri The server that just delivered these transactions.
+     */
+    void
+    prefetch(const TxidSet &txids, const std::string &walletId,
+             const std::string &uri, Priority priority);
 
     void
     fetchFeeEstimate(size_t blocks, StratumConnection *sc);
 
     void
     blockHeaderFetch(size_t height, IBitcoinConnection *bc);
+
+    void
+    blockHeaderChunkFetch(size_t chunk, const std::set<size_t> &heights,
+                          StratumConnection *sc);
 };
 
 } // namespace abcd
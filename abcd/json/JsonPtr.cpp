@@ -134,9 +134,15 @@ JsonPtr::load(const std::string &path, DataSlice dataKey)
 
 Status
 JsonPtr::decode(const std::string &data)
+{
+    return decode(data.data(), data.size());
+}
+
+Status
+JsonPtr::decode(const char *data, size_t size)
 {
     json_error_t error;
-    json_t *root = json_loadb(data.data(), data.size(), loadFlags, &error);
+    json_t *root = json_loadb(data, size, loadFlags, &error);
     if (!root)
         return ABC_ERROR(ABC_CC_JSONError, error.text);
     reset(root);
@@ -69,6 +69,12 @@ public:
     Status
     decode(const std::string &data);
 
+    /**
+     * Loads the JSON object from a buffer, without copying it first.
+     */
+    Status
+    decode(const char *data, size_t size);
+
     /**
      * Saves the JSON object to disk.
      */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A lock-free multi-producer, single-consumer queue.
+ */
+
+#ifndef ABCD_UTIL_MPSC_QUEUE_HPP
+#define ABCD_UTIL_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+namespace abcd {
+
+/**
+ * An unbounded queue that any number of threads can push onto,
+ * while a single thread pops items off in order.
+ * Pushing never blocks or takes a lock.
+ *
+ * A push only becomes visible once it completes,
+ * so `pop` can briefly report an empty queue while a push is underway.
+ * Producers should signal the consumer after pushing to cover this.
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+    ~MpscQueue()
+    {
+        T item;
+        while (pop(item))
+            ;
+        delete front_;
+    }
+
+    MpscQueue():
+        back_(new Node()),
+        front_(back_.load())
+    {
+    }
+
+    /**
+     * Adds an item to the back of the queue. Safe from any thread.
+     */
+    void
+    push(T item)
+    {
+        auto *node = new Node(std::move(item));
+        auto *prev = back_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * Removes the item at the front of the queue.
+     * Only the consumer thread may call this.
+     * @return false if the queue is empty.
+     */
+    bool
+    pop(T &result)
+    {
+        auto *next = front_->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+
+        // The next node becomes the new empty placeholder:
+        result = std::move(next->value);
+        next->value = T();
+        delete front_;
+        front_ = next;
+        return true;
+    }
+
+    MpscQueue(const MpscQueue &copy) = delete;
+    MpscQueue &operator=(const MpscQueue &copy) = delete;
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next;
+        T value;
+
+        Node(): next(nullptr) {}
+        explicit Node(T value): next(nullptr), value(std::move(value)) {}
+    };
+
+    std::atomic<Node *> back_; // Producers
+    Node *front_; // Consumer, always an empty placeholder
+};
+
+} // namespace abcd
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "ReceiveBuffer.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace abcd {
+
+ReceiveBuffer::ReceiveBuffer(size_t capacity):
+    buffer_(capacity),
+    begin_(0),
+    end_(0)
+{
+}
+
+DataSlice
+ReceiveBuffer::data() const
+{
+    return DataSlice(buffer_.data() + begin_, buffer_.data() + end_);
+}
+
+uint8_t *
+ReceiveBuffer::prepare(size_t minimum)
+{
+    if (space() < minimum)
+    {
+        const auto used = size();
+        if (minimum <= buffer_.size() - used && used <= begin_)
+        {
+            // Slide the unread bytes back to the start:
+            memmove(buffer_.data(), buffer_.data() + begin_, used);
+        }
+        else
+        {
+            // Grow, copying only the unread bytes:
+            DataChunk bigger(std::max(2 * buffer_.size(), used + minimum));
+            memcpy(bigger.data(), buffer_.data() + begin_, used);
+            buffer_.swap(bigger);
+        }
+        begin_ = 0;
+        end_ = used;
+    }
+
+    return buffer_.data() + end_;
+}
+
+void
+ReceiveBuffer::commit(size_t bytes)
+{
+    end_ = std::min(end_ + bytes, buffer_.size());
+}
+
+void
+ReceiveBuffer::consume(size_t bytes)
+{
+    begin_ = std::min(begin_ + bytes, end_);
+
+    // Rewinding an empty buffer is free:
+    if (begin_ == end_)
+        begin_ = end_ = 0;
+}
+
+} // namespace abcd
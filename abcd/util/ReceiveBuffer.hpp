@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A byte queue for incoming network data.
+ */
+
+#ifndef ABCD_UTIL_RECEIVE_BUFFER_HPP
+#define ABCD_UTIL_RECEIVE_BUFFER_HPP
+
+#include "Data.hpp"
+
+namespace abcd {
+
+/**
+ * Holds bytes between the socket and the parser.
+ *
+ * Data is written at the back and consumed from the front.
+ * Unlike a wrap-around ring, the unread bytes are always contiguous,
+ * so parsers can work on them in place.
+ * The buffer slides its contents back to the start only when
+ * that copies less than it reclaims, so the cost stays linear.
+ */
+class ReceiveBuffer
+{
+public:
+    ReceiveBuffer(size_t capacity=65536);
+
+    /**
+     * The bytes that have been written but not consumed yet.
+     */
+    DataSlice
+    data() const;
+
+    size_t size() const { return end_ - begin_; }
+
+    /**
+     * Makes room for at least `minimum` bytes at the back of the buffer.
+     * @return The place to write the new bytes.
+     * The writable space runs for `space()` bytes.
+     */
+    uint8_t *
+    prepare(size_t minimum);
+
+    size_t space() const { return buffer_.size() - end_; }
+
+    /**
+     * Marks bytes written to the `prepare` area as valid.
+     */
+    void
+    commit(size_t bytes);
+
+    /**
+     * Discards bytes from the front of the buffer.
+     */
+    void
+    consume(size_t bytes);
+
+private:
+    DataChunk buffer_;
+    size_t begin_;
+    size_t end_;
+};
+
+} // namespace abcd
+
+#endif
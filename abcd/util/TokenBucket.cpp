@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "TokenBucket.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace abcd {
+
+TokenBucket::TokenBucket(double rate, double burst, Clock::time_point now)
+{
+    rateSet(rate, burst, now);
+}
+
+void
+TokenBucket::rateSet(double rate, double burst, Clock::time_point now)
+{
+    rate_ = rate;
+    burst_ = std::max(1.0, burst);
+    tokens_ = burst_;
+    last_ = now;
+}
+
+double
+TokenBucket::available(Clock::time_point now)
+{
+    refill(now);
+    return tokens_;
+}
+
+bool
+TokenBucket::take(Clock::time_point now)
+{
+    if (unlimited())
+        return true;
+
+    refill(now);
+    if (tokens_ < 1)
+        return false;
+    tokens_ -= 1;
+    return true;
+}
+
+void
+TokenBucket::borrow(Clock::time_point now)
+{
+    if (unlimited())
+        return;
+
+    refill(now);
+    tokens_ -= 1;
+}
+
+std::chrono::milliseconds
+TokenBucket::wait(double count, Clock::time_point now)
+{
+    refill(now);
+    if (unlimited() || count <= tokens_)
+        return std::chrono::milliseconds(0);
+
+    const auto ms = std::ceil(1000 * (count - tokens_) / rate_);
+    return std::chrono::milliseconds(static_cast<long>(ms));
+}
+
+void
+TokenBucket::refill(Clock::time_point now)
+{
+    if (unlimited())
+    {
+        tokens_ = burst_;
+        return;
+    }
+
+    const std::chrono::duration<double> elapsed = now - last_;
+    if (0 < elapsed.count())
+    {
+        tokens_ = std::min(burst_, tokens_ + rate_ * elapsed.count());
+        last_ = now;
+    }
+}
+
+} // namespace abcd
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A token-bucket rate limiter.
+ */
+
+#ifndef ABCD_UTIL_TOKEN_BUCKET_HPP
+#define ABCD_UTIL_TOKEN_BUCKET_HPP
+
+#include <chrono>
+
+namespace abcd {
+
+/**
+ * Paces events to a steady rate, while allowing short bursts.
+ * Tokens accumulate at `rate` per second, up to `burst` tokens,
+ * and each event spends one.
+ */
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * @param rate Tokens per second. Zero means unlimited.
+     * @param burst The most tokens the bucket can hold.
+     */
+    TokenBucket(double rate=0, double burst=1,
+                Clock::time_point now=Clock::now());
+
+    /**
+     * Changes the limits. The bucket starts out full.
+     */
+    void
+    rateSet(double rate, double burst, Clock::time_point now=Clock::now());
+
+    bool unlimited() const { return !rate_; }
+
+    /**
+     * Returns the number of tokens currently available.
+     */
+    double
+    available(Clock::time_point now=Clock::now());
+
+    /**
+     * Spends a token if one is available.
+     * @return false if the caller needs to wait.
+     */
+    bool
+    take(Clock::time_point now=Clock::now());
+
+    /**
+     * Spends a token even if none is available.
+     * The bucket goes into debt, which later events wait to pay off,
+     * so the average rate still holds.
+     */
+    void
+    borrow(Clock::time_point now=Clock::now());
+
+    /**
+     * Returns the time until `count` tokens will be available,
+     * or zero if they are available now.
+     */
+    std::chrono::milliseconds
+    wait(double count=1, Clock::time_point now=Clock::now());
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    Clock::time_point last_;
+
+    void
+    refill(Clock::time_point now);
+};
+
+} // namespace abcd
+
+#endif
@@ -66,8 +66,11 @@ onReceive(Wallet &wallet, const TxInfo &info,
         Status().toError(async.status, ABC_HERE());
         async.szWalletUUID = wallet.id().c_str();
         async.szTxID = info.txid.c_str();
+        async.aszTxIDs = nullptr;
+        async.countTxIDs = 0;
         async.sweepSatoshi = 0;
-        fCallback(&async);
+        if (fCallback)
+            fCallback(&async);
     }
     else
     {
@@ -80,8 +83,11 @@ onReceive(Wallet &wallet, const TxInfo &info,
         Status().toError(async.status, ABC_HERE());
         async.szWalletUUID = wallet.id().c_str();
         async.szTxID = info.txid.c_str();
+        async.aszTxIDs = nullptr;
+        async.countTxIDs = 0;
         async.sweepSatoshi = 0;
-        fCallback(&async);
+        if (fCallback)
+            fCallback(&async);
     }
 
     return Status();
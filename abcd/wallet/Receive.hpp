@@ -17,6 +17,8 @@ class Wallet;
 
 /**
  * Updates the wallet when a new transaction comes in from the network.
+ * @param fCallback The GUI callback, or null if the caller will
+ * notify the GUI itself (such as when batching events).
  */
 Status
 onReceive(Wallet &wallet, const TxInfo &info,
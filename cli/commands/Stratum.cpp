@@ -6,9 +6,15 @@
  */
 
 #include "../Command.hpp"
+#include "../../abcd/bitcoin/cache/TimestampCheckpoints.hpp"
 #include "../../abcd/bitcoin/network/StratumConnection.hpp"
-#include <zmq.h>
+#include "../../abcd/util/FileIO.hpp"
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 using namespace abcd;
 
@@ -24,7 +30,6 @@ COMMAND(InitLevel::context, CliStratumVersion, "stratum-version",
     // Connect to the server:
     StratumConnection c;
     ABC_CHECK(c.connect(uri));
-    std::cout << "Connection established" << std::endl;
 
     // Send the version command:
     auto onError = [](Status status)
@@ -48,13 +53,100 @@ COMMAND(InitLevel::context, CliStratumVersion, "stratum-version",
         if (1 <= done)
             break;
 
-        zmq_pollitem_t pollitem =
+        auto items = c.pollfds();
+        long timeout = sleep.count() ? sleep.count() : -1;
+        poll(items.data(), items.size(), timeout);
+    }
+
+    return Status();
+}
+
+COMMAND(InitLevel::context, CliHeaderCheckpoints, "header-checkpoints",
+        " <server> <height> <filename>")
+{
+    if (3 != argc)
+        return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const auto uri = argv[0];
+    const size_t height = atol(argv[1]);
+    const auto filename = argv[2];
+
+    StratumConnection c;
+    ABC_CHECK(c.connect(uri));
+
+    // Fetch every chunk below the checkpoint:
+    const size_t chunks = (height + stratumChunkSize - 1) / stratumChunkSize;
+    std::map<size_t, DataChunk> rawChunks;
+    Status error;
+    size_t next = 0;
+    while (rawChunks.size() < chunks && error)
+    {
+        while (next < chunks && !c.queueFull())
         {
-            nullptr, c.pollfd(), ZMQ_POLLIN, ZMQ_POLLOUT
-        };
+            const auto chunk = next++;
+            auto onError = [&error](Status status)
+            {
+                error = status;
+            };
+            auto onReply = [&rawChunks, chunk](DataSlice rawHeaders)
+            {
+                rawChunks[chunk] = DataChunk(rawHeaders.begin(),
+                                             rawHeaders.end());
+            };
+            c.blockHeaderChunkFetch(onError, onReply, chunk);
+        }
+
+        SleepTime sleep;
+        ABC_CHECK(c.wakeup(sleep));
+
+        auto items = c.pollfds();
         long timeout = sleep.count() ? sleep.count() : -1;
-        zmq_poll(&pollitem, 1, timeout);
+        poll(items.data(), items.size(), timeout);
+    }
+    ABC_CHECK(error);
+
+    // Pull out the timestamps:
+    std::vector<uint32_t> timestamps;
+    for (const auto &chunk: rawChunks)
+    {
+        const auto &raw = chunk.second;
+        for (size_t i = 0; i + 80 <= raw.size(); i += 80)
+        {
+            // The timestamp is a little-endian integer at byte 68:
+            const auto *p = raw.data() + i + 68;
+            if (timestamps.size() < height)
+                timestamps.push_back(p[0] | p[1] << 8 | p[2] << 16 |
+                                     uint32_t(p[3]) << 24);
+        }
+    }
+    if (timestamps.size() < height)
+        return ABC_ERROR(ABC_CC_Error, "The server is missing headers");
+
+    // Write the bundle out as source code:
+    DataChunk bundle;
+    ABC_CHECK(TimestampCheckpoints::encode(bundle, timestamps));
+
+    std::stringstream out;
+    out << "/*\n"
+        " * Generated by `abc-cli header-checkpoints`. Do not edit.\n"
+        " *\n"
+        " * Block timestamps for heights 0 to " << height - 1 << ".\n"
+        " */\n\n"
+        "#include <stddef.h>\n"
+        "#include <stdint.h>\n\n"
+        "namespace abcd {\n\n"
+        "extern const size_t timestampBundleSize = " << bundle.size() << ";\n"
+        "extern const uint8_t timestampBundle[] =\n"
+        "{";
+    for (size_t i = 0; i < bundle.size(); ++i)
+    {
+        char byte[8];
+        snprintf(byte, sizeof(byte), "0x%02x,", bundle[i]);
+        out << (i % 12 ? " " : "\n    ") << byte;
     }
+    out << "\n};\n\n} // namespace abcd\n";
+    ABC_CHECK(fileSave(out.str(), filename));
 
+    std::cout << timestamps.size() << " timestamps packed into " <<
+              bundle.size() << " bytes" << std::endl;
     return Status();
 }
@@ -6,6 +6,7 @@
  */
 
 #include "../Command.hpp"
+#include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <iostream>
@@ -32,6 +33,14 @@ eventCallback(const tABC_AsyncBitCoinInfo *pInfo)
     case ABC_AsyncEventType_BlockHeightChange:
         std::cout << "Block height change" << std::endl;
         break;
+    case ABC_AsyncEventType_TransactionUpdate:
+        std::cout << "Transaction update (" << pInfo->countTxIDs << " txids)"
+                  << std::endl;
+        break;
+    case ABC_AsyncEventType_TransactionBatch:
+        std::cout << "Transaction batch (" << pInfo->countTxIDs << " txids)"
+                  << std::endl;
+        break;
     default:
         break;
     }
@@ -53,7 +62,7 @@ public:
     ~WatcherThread();
 
     abcd::Status
-    init(const Session &session);
+    init(const Session &session, unsigned batchMs=0);
 
 private:
     std::string uuid_;
@@ -73,26 +82,30 @@ WatcherThread::~WatcherThread()
 }
 
 Status
-WatcherThread::init(const Session &session)
+WatcherThread::init(const Session &session, unsigned batchMs)
 {
     uuid_ = session.uuid;
     ABC_CHECK_OLD(ABC_WatcherStart(session.username.c_str(),
                                    session.password.c_str(),
                                    session.uuid.c_str(),
                                    &error));
+    if (batchMs)
+        ABC_CHECK_OLD(ABC_WatcherBatchEvents(session.uuid.c_str(), batchMs,
+                                             &error));
     thread_ = new std::thread(watcherThread, session.uuid.c_str());
     ABC_CHECK_OLD(ABC_WatcherConnect(session.uuid.c_str(), &error));
     return Status();
 }
 
 COMMAND(InitLevel::wallet, Watcher, "watcher",
-        "")
+        " [<batch-ms>]")
 {
-    if (argc != 0)
+    if (argc != 0 && argc != 1)
         return ABC_ERROR(ABC_CC_Error, helpString(*this));
+    const unsigned batchMs = argc == 1 ? atoi(argv[0]) : 0;
 
     WatcherThread thread;
-    ABC_CHECK(thread.init(session));
+    ABC_CHECK(thread.init(session, batchMs));
 
     // The command stops with ctrl-c:
     signal(SIGINT, signalCallback);
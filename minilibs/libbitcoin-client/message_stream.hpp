@@ -20,11 +20,17 @@
 #ifndef LIBBITCOIN_CLIENT_MESSAGE_STREAM_HPP
 #define LIBBITCOIN_CLIENT_MESSAGE_STREAM_HPP
 
+#include <vector>
 #include <bitcoin/bitcoin.hpp>
 
 namespace libbitcoin {
 namespace client {
 
+/**
+ * The frames of a multi-part message, pointing into someone else's memory.
+ */
+typedef std::vector<data_slice> data_slice_stack;
+
 /**
  * Represents a stream of multi-part messages.
  *
@@ -41,6 +47,21 @@ public:
      * Sends one multi-part message.
      */
     virtual void write(const data_stack& data) = 0;
+
+    /**
+     * Sends one multi-part message without copying it first.
+     * The frames are only valid until this returns.
+     * Streams that can parse in place should override this,
+     * since the default just copies the frames and calls `write`.
+     */
+    virtual void write_view(const data_slice_stack& data)
+    {
+        data_stack copy;
+        copy.reserve(data.size());
+        for (const auto& frame: data)
+            copy.emplace_back(frame.begin(), frame.end());
+        write(copy);
+    }
 };
 
 } // namespace client
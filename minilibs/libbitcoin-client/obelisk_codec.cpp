@@ -343,7 +343,10 @@ void obelisk_codec::decode_empty(data_deserial& payload,
 void obelisk_codec::decode_fetch_history(data_deserial& payload,
     fetch_history_handler& handler)
 {
+    // Rows have a fixed size, so the list can be sized up front:
+    constexpr size_t row_size = 32 + 4 + 4 + 8 + 32 + 4 + 4;
     history_list history;
+    history.reserve((payload.end() - payload.iterator()) / row_size);
     while (payload.iterator() != payload.end())
     {
         history_row row;
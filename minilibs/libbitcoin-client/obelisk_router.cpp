@@ -69,45 +69,27 @@ uint64_t obelisk_router::outstanding_call_count() const
 
 void obelisk_router::write(const data_stack& data)
 {
-    if (data.size() == 3)
-    {
-        bool success = true;
-        obelisk_message message;
-
-        auto it = data.begin();
-
-        if (success)
-        {
-            // read command
-            message.command = std::string((*it).begin(), (*it).end());
-            it++;
-        }
-
-        if (success)
-        {
-            // read id
-            if ((*it).size() == sizeof(uint32_t))
-            {
-                message.id = from_little_endian_unsafe<uint32_t>(
-                    (*it).begin());
-            }
-            else
-            {
-                success = false;
-            }
+    data_slice_stack view;
+    view.reserve(data.size());
+    for (const auto& frame: data)
+        view.emplace_back(frame);
+    write_view(view);
+}
 
-            it++;
-        }
+void obelisk_router::write_view(const data_slice_stack& data)
+{
+    if (data.size() != 3)
+        return;
 
-        if (success)
-        {
-            // read payload
-            message.payload = (*it);
-            it++;
-        }
+    // The id must be exactly four bytes:
+    if (data[1].size() != sizeof(uint32_t))
+        return;
 
-        receive(message);
-    }
+    obelisk_view message;
+    message.command = std::string(data[0].begin(), data[0].end());
+    message.id = from_little_endian_unsafe<uint32_t>(data[1].begin());
+    message.payload = data[2];
+    receive(message);
 }
 
 period_ms obelisk_router::wakeup()
@@ -115,33 +97,42 @@ period_ms obelisk_router::wakeup()
     period_ms next_wakeup(0);
     auto now = std::chrono::steady_clock::now();
 
-    auto i = pending_requests_.begin();
-    while (i != pending_requests_.end())
+    // Error handlers can send new requests, which would invalidate
+    // our iterators, so find the expired requests first:
+    std::vector<uint32_t> expired;
+    for (auto& i: pending_requests_)
     {
-        auto request = i++;
+        auto& request = i.second;
         auto elapsed = std::chrono::duration_cast<period_ms>(
-            now - request->second.last_action);
+            now - request.last_action);
         if (timeout_ <= elapsed)
         {
-            if (request->second.retries < retries_)
+            if (request.retries < retries_)
             {
                 // Resend:
-                ++request->second.retries;
-                request->second.last_action = now;
+                ++request.retries;
+                request.last_action = now;
                 next_wakeup = min_sleep(next_wakeup, timeout_);
-                send(request->second.message);
+                send(request.message);
             }
             else
-            {
-                // Cancel:
-                auto ec = std::make_error_code(std::errc::timed_out);
-                request->second.on_error(ec);
-                pending_requests_.erase(request);
-            }
+                expired.push_back(i.first);
         }
         else
             next_wakeup = min_sleep(next_wakeup, timeout_ - elapsed);
     }
+
+    // Cancel:
+    for (auto id: expired)
+    {
+        auto i = pending_requests_.find(id);
+        if (i == pending_requests_.end())
+            continue;
+
+        auto on_error = std::move(i->second.on_error);
+        pending_requests_.erase(i);
+        on_error(std::make_error_code(std::errc::timed_out));
+    }
     return next_wakeup;
 }
 
@@ -171,7 +162,7 @@ void obelisk_router::send(const obelisk_message& message)
     }
 }
 
-void obelisk_router::receive(const obelisk_message& message)
+void obelisk_router::receive(const obelisk_view& message)
 {
     if ("address.update" == message.command)
     {
@@ -191,11 +182,15 @@ void obelisk_router::receive(const obelisk_message& message)
         on_unknown_(message.command);
         return;
     }
-    decode_reply(message, i->second.on_error, i->second.on_reply);
+
+    // The handlers can send new requests, so take them out first:
+    auto on_error = std::move(i->second.on_error);
+    auto on_reply = std::move(i->second.on_reply);
     pending_requests_.erase(i);
+    decode_reply(message, on_error, on_reply);
 }
 
-void obelisk_router::decode_update(const obelisk_message& message)
+void obelisk_router::decode_update(const obelisk_view& message)
 {
     data_deserial deserial = make_deserializer(
         message.payload.begin(), message.payload.end());
@@ -219,7 +214,7 @@ void obelisk_router::decode_update(const obelisk_message& message)
     }
 }
 
-void obelisk_router::decode_stealth_update(const obelisk_message& message)
+void obelisk_router::decode_stealth_update(const obelisk_view& message)
 {
     data_deserial deserial = make_deserializer(
         message.payload.begin(), message.payload.end());
@@ -247,7 +242,7 @@ void obelisk_router::decode_stealth_update(const obelisk_message& message)
     }
 }
 
-void obelisk_router::decode_reply(const obelisk_message& message,
+void obelisk_router::decode_reply(const obelisk_view& message,
     error_handler& on_error, decoder& on_reply)
 {
     std::error_code ec;
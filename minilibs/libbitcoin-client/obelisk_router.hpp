@@ -21,7 +21,7 @@
 #define LIBBITCOIN_CLIENT_OBELISK_OBELISK_ROUTER_HPP
 
 #include <functional>
-#include <map>
+#include <unordered_map>
 #include "message_stream.hpp"
 #include "sleeper.hpp"
 
@@ -69,12 +69,14 @@ public:
 
     // message-stream interface:
     virtual void write(const data_stack& data) override;
+    virtual void write_view(const data_slice_stack& data) override;
 
     // sleeper interface:
     virtual period_ms wakeup() override;
 
 protected:
-    typedef deserializer<data_chunk::const_iterator, true> data_deserial;
+    // Replies are parsed in place, straight out of the receive buffer:
+    typedef deserializer<const uint8_t*, true> data_deserial;
 
     /**
      * Decodes a message and calls the appropriate callback.
@@ -99,11 +101,22 @@ protected:
         uint32_t id;
         data_chunk payload;
     };
+
+    /**
+     * An incoming message. The payload points into the receive buffer,
+     * so it is only valid until the message has been handled.
+     */
+    struct obelisk_view
+    {
+        std::string command;
+        uint32_t id;
+        data_slice payload;
+    };
     void send(const obelisk_message& message);
-    void receive(const obelisk_message& message);
-    void decode_update(const obelisk_message& message);
-    void decode_stealth_update(const obelisk_message& message);
-    void decode_reply(const obelisk_message& message,
+    void receive(const obelisk_view& message);
+    void decode_update(const obelisk_view& message);
+    void decode_stealth_update(const obelisk_view& message);
+    void decode_reply(const obelisk_view& message,
         error_handler& on_error, decoder& on_reply);
 
     /**
@@ -122,7 +135,7 @@ protected:
         unsigned retries;
         std::chrono::steady_clock::time_point last_action;
     };
-    std::map<uint32_t, pending_request> pending_requests_;
+    std::unordered_map<uint32_t, pending_request> pending_requests_;
 
     // Timeout parameters:
     period_ms timeout_;
@@ -18,6 +18,7 @@
  */
 #include "zeromq_socket.hpp"
 
+#include <deque>
 #include <zmq_utils.h>
 
 namespace libbitcoin {
@@ -84,23 +85,42 @@ bool zeromq_socket::forward(message_stream& dest)
 
     while (pending())
     {
-        bc::data_stack message;
+        // Hold on to the zeromq buffers while the stream parses them.
+        // A deque never moves its elements, which zeromq requires:
+        std::deque<zmq_msg_t> frames;
         bool more = false;
+        bool success = true;
         do
         {
-            zmq_msg_t msg;
+            frames.emplace_back();
+            zmq_msg_t& msg = frames.back();
             zmq_msg_init(&msg);
 
             if (zmq_msg_recv(&msg, socket_, ZMQ_DONTWAIT) < 0)
-                return false;
-
-            const char* raw = reinterpret_cast<const char*>(zmq_msg_data(&msg));
-            message.emplace_back(raw, raw + zmq_msg_size(&msg));
+            {
+                success = false;
+                break;
+            }
             more = zmq_msg_more(&msg);
-            zmq_msg_close(&msg);
         } while (more);
 
-        dest.write(message);
+        if (success)
+        {
+            data_slice_stack message;
+            message.reserve(frames.size());
+            for (auto& msg: frames)
+            {
+                const auto raw = static_cast<const uint8_t*>(
+                    zmq_msg_data(&msg));
+                message.emplace_back(raw, raw + zmq_msg_size(&msg));
+            }
+            dest.write_view(message);
+        }
+
+        for (auto& msg: frames)
+            zmq_msg_close(&msg);
+        if (!success)
+            return false;
     }
     return true;
 }
@@ -17,6 +17,7 @@
 #include "../abcd/account/AccountSettings.hpp"
 #include "../abcd/account/AccountCategories.hpp"
 #include "../abcd/account/PluginData.hpp"
+#include "../abcd/bitcoin/NetworkEngine.hpp"
 #include "../abcd/bitcoin/Testnet.hpp"
 #include "../abcd/bitcoin/Text.hpp"
 #include "../abcd/bitcoin/cache/Cache.hpp"
@@ -2808,6 +2809,65 @@ exit:
     return cc;
 }
 
+/**
+ * Coalesces the wallet's transaction notifications.
+ * Rather than sending an IncomingBitCoin or BalanceUpdate event
+ * for each transaction, the watcher collects the transactions that arrive
+ * within the given window and reports them all at once with a single
+ * TransactionBatch event. This keeps catch-up syncs from flooding the GUI.
+ *
+ * @param szWalletUUID The wallet watcher to use
+ * @param windowMs     The coalescing window in milliseconds,
+ *                     or 0 to go back to per-transaction events.
+ */
+tABC_CC ABC_WatcherBatchEvents(const char *szWalletUUID,
+                               unsigned int windowMs,
+                               tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    {
+        ABC_GET_WALLET_N();
+        ABC_CHECK_NEW(bridgeWatcherBatch(*wallet, windowMs));
+    }
+
+exit:
+    return cc;
+}
+
+/**
+ * Records the network traffic of every wallet watcher to a file,
+ * for diagnosing slow syncs. The recording can be replayed offline.
+ *
+ * @param szPath The file to write, replacing any earlier recording,
+ *               or nullptr to stop recording.
+ */
+tABC_CC ABC_WatcherRecordTraffic(const char *szPath, tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    gContext->network.record(szPath ? szPath : "");
+
+exit:
+    return cc;
+}
+
+/**
+ * Connects to the bitcoin servers ahead of time,
+ * so wallet watchers can start syncing as soon as they connect.
+ * The connections stay open until shutdown.
+ * Call this once, any time after ABC_Initialize.
+ */
+tABC_CC ABC_WatcherWarmup(tABC_Error *pError)
+{
+    ABC_PROLOG();
+
+    gContext->network.warmup();
+
+exit:
+    return cc;
+}
+
 /**
  * Watch a single address for a wallet.
  * Pass a nullptr address to cancel the priority poll.
@@ -155,6 +155,10 @@ typedef enum eABC_CC
     ABC_CC_InvalidOTP = 37,
     /** Trying to send too little money. */
     ABC_CC_SpendDust = 38,
+    /** The server took too long to answer a request. */
+    ABC_CC_ServerTimeout = 39,
+    /** The request was abandoned because we closed the connection. */
+    ABC_CC_Cancelled = 40,
     /** The server says app is obsolete and needs to be upgraded. */
     ABC_CC_Obsolete = 1000
 } tABC_CC;
@@ -195,6 +199,7 @@ typedef enum eABC_AsyncEventType
     ABC_AsyncEventType_AddressCheckDone,
     ABC_AsyncEventType_IncomingSweep,
     ABC_AsyncEventType_TransactionUpdate,
+    ABC_AsyncEventType_TransactionBatch,
 } tABC_AsyncEventType;
 
 /**
@@ -234,6 +239,12 @@ typedef struct sABC_AsyncBitCoinInfo
 
     /** The amount swept, if this is a sweep. */
     int64_t sweepSatoshi;
+
+    /** If the event involved several transactions, these are their IDs. */
+    const char **aszTxIDs;
+
+    /** The number of entries in aszTxIDs. */
+    unsigned int countTxIDs;
 } tABC_AsyncBitCoinInfo;
 
 /**
@@ -496,6 +507,7 @@ typedef struct sABC_AccountSettings
  * This is the form of the callback that will be called when there is an
  * asynchronous BitCoin event.
  *
+ * Each wallet's events arrive on the thread running its ABC_WatcherLoop.
  */
 typedef void (*tABC_BitCoin_Event_Callback)(const tABC_AsyncBitCoinInfo *pInfo);
 
@@ -1365,6 +1377,14 @@ tABC_CC ABC_WatcherLoop(const char *szWalletUUID,
 
 tABC_CC ABC_WatcherConnect(const char *szWalletUUID, tABC_Error *pError);
 
+tABC_CC ABC_WatcherBatchEvents(const char *szWalletUUID,
+                               unsigned int windowMs,
+                               tABC_Error *pError);
+
+tABC_CC ABC_WatcherRecordTraffic(const char *szPath, tABC_Error *pError);
+
+tABC_CC ABC_WatcherWarmup(tABC_Error *pError);
+
 tABC_CC ABC_PrioritizeAddress(const char *szUserName, const char *szPassword,
                               const char *szWalletUUID, const char *szAddress,
                               tABC_Error *pError);
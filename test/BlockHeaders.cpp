@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/BlockCache.hpp"
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdio.h>
+#include <map>
+
+/**
+ * Returns the hex of a fake header whose timestamp is its height.
+ */
+static std::string
+hexHeader(size_t height)
+{
+    char out[2 * 80 + 1];
+    uint8_t raw[80] = {1};
+    for (int i = 0; i < 4; ++i)
+        raw[68 + i] = height >> (8 * i);
+    for (int i = 0; i < 80; ++i)
+        snprintf(out + 2 * i, 3, "%02x", raw[i]);
+    return out;
+}
+
+/**
+ * Teaches the mock server to serve fake headers.
+ */
+static void
+headerServerSetup(MockStratumServer &server, bool chunks)
+{
+    server.handlerSet("blockchain.block.get_header",
+                      [](abcd::JsonArray params)
+    {
+        const auto height = json_integer_value(params[0].get());
+        const std::string hash(64, '0');
+        return "{\"nonce\": 0, \"version\": 1, \"bits\": 0, "
+               "\"timestamp\": " + std::to_string(height) + ", "
+               "\"prev_block_hash\": \"" + hash + "\", "
+               "\"merkle_root\": \"" + hash + "\"}";
+    });
+
+    if (!chunks)
+        return;
+    server.handlerSet("blockchain.block.get_chunk",
+                      [](abcd::JsonArray params)
+    {
+        const size_t chunk = json_integer_value(params[0].get());
+        std::string hex;
+        for (size_t i = 0; i < abcd::stratumChunkSize; ++i)
+            hex += hexHeader(chunk * abcd::stratumChunkSize + i);
+        return "\"" + hex + "\"";
+    });
+}
+
+TEST_CASE("Block header chunk selection", "[bitcoin][headers]")
+{
+    abcd::BlockCache blocks("");
+    const size_t chunkSize = abcd::stratumChunkSize;
+
+    // Two scattered heights, plus a dense run inside chunk 2:
+    blocks.headerNeededAdd(100);
+    blocks.headerNeededAdd(9000);
+    for (size_t i = 0; i < 30; ++i)
+        blocks.headerNeededAdd(2 * chunkSize + 3 * i);
+
+    size_t chunk;
+    std::set<size_t> heights;
+    REQUIRE(blocks.headerChunkNeeded(chunk, heights, chunkSize, 20));
+    REQUIRE(2 == chunk);
+    REQUIRE(30 == heights.size());
+    REQUIRE(!blocks.headerChunkNeeded(chunk, heights, chunkSize, 20));
+
+    // Raw chunks land at the right heights:
+    abcd::DataChunk raw(3 * 80);
+    raw[80 + 68] = 42;
+    size_t count;
+    REQUIRE(blocks.headersInsert(count, 2 * chunkSize, raw));
+    REQUIRE(3 == count);
+    REQUIRE(blocks.headersInsert(count, 2 * chunkSize, raw));
+    REQUIRE(0 == count);
+    time_t time;
+    REQUIRE(blocks.headerTime(time, 2 * chunkSize + 1));
+    REQUIRE(42 == time);
+
+    // The scattered heights are still available one by one:
+    REQUIRE(100 == blocks.headerNeeded());
+    REQUIRE(9000 == blocks.headerNeeded());
+    REQUIRE(0 == blocks.headerNeeded());
+}
+
+TEST_CASE("Header arrival notifications", "[bitcoin][headers]")
+{
+    abcd::BlockCache blocks("");
+    blocks.headerNeededAdd(100, "wallet-a", "tx-1");
+    blocks.headerNeededAdd(100, "wallet-b", "tx-2");
+    blocks.headerNeededAdd(101, "wallet-a", "tx-3");
+    blocks.headerNeededAdd(200, "wallet-a", "tx-4");
+
+    std::map<std::string, abcd::TxidSet> events;
+    blocks.onHeaderSet([&](const std::string &walletId,
+                           const abcd::TxidSet &txids)
+    {
+        REQUIRE(!events.count(walletId));
+        events[walletId] = txids;
+    });
+
+    // Nothing has arrived yet:
+    blocks.onHeaderInvoke();
+    REQUIRE(events.empty());
+
+    // Each wallet hears about its own transactions, and only those:
+    size_t count;
+    REQUIRE(blocks.headersInsert(count, 100, abcd::DataChunk(2 * 80, 1)));
+    REQUIRE(2 == count);
+    blocks.onHeaderInvoke();
+    REQUIRE(2 == events.size());
+    REQUIRE(abcd::TxidSet({"tx-1", "tx-3"}) == events["wallet-a"]);
+    REQUIRE(abcd::TxidSet({"tx-2"}) == events["wallet-b"]);
+}
+
+TEST_CASE("Block header round trips", "[bitcoin][headers]")
+{
+    const size_t chunkSize = abcd::stratumChunkSize;
+
+    // A restored wallet needs 100 headers in one chunk, plus two loners:
+    abcd::BlockCache blocks("");
+    std::set<size_t> wanted = { 50000, 60000 };
+    for (size_t i = 0; i < 100; ++i)
+        wanted.insert(2 * chunkSize + 7 * i);
+    for (auto height: wanted)
+        blocks.headerNeededAdd(height);
+
+    size_t replies = 0;
+    abcd::Status error;
+    auto onError = [&](abcd::Status s)
+    {
+        error = s;
+        ++replies;
+    };
+
+    SECTION("chunks")
+    {
+        MockStratumServer server;
+        headerServerSetup(server, true);
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        size_t chunk;
+        std::set<size_t> heights;
+        size_t expected = 0;
+        while (blocks.headerChunkNeeded(chunk, heights, chunkSize, 20))
+        {
+            auto onReply = [&, chunk](abcd::DataSlice rawHeaders)
+            {
+                size_t count;
+                REQUIRE(blocks.headersInsert(count, chunk * chunkSize,
+                                             rawHeaders));
+                ++replies;
+            };
+            connection.blockHeaderChunkFetch(onError, onReply, chunk);
+            ++expected;
+        }
+
+        // The rest are pipelined, without waiting for each reply:
+        while (size_t height = blocks.headerNeeded())
+        {
+            auto onReply = [&, height](const bc::block_header_type &header)
+            {
+                REQUIRE(blocks.headerInsert(height, header));
+                ++replies;
+            };
+            connection.blockHeaderFetch(onError, onReply, height);
+            ++expected;
+        }
+
+        REQUIRE(mockDrive(connection, [&]() { return expected <= replies; }));
+        REQUIRE(expected == replies);
+        REQUIRE(error);
+        // One chunk and two single headers, plus the batch probe:
+        REQUIRE(4 == server.requests());
+
+        for (auto height: wanted)
+        {
+            time_t time;
+            REQUIRE(blocks.headerTime(time, height));
+            REQUIRE(height == time);
+        }
+    }
+
+    SECTION("no chunk support")
+    {
+        MockStratumServer server;
+        headerServerSetup(server, false);
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        size_t chunk;
+        std::set<size_t> heights;
+        REQUIRE(blocks.headerChunkNeeded(chunk, heights, chunkSize, 20));
+        connection.blockHeaderChunkFetch(onError,
+                                         [](abcd::DataSlice) {}, chunk);
+
+        REQUIRE(mockDrive(connection, [&]() { return 1 <= replies; }));
+        REQUIRE(ABC_CC_ServerError == error.value());
+    }
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "FaultProxy.hpp"
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+
+std::vector<FaultProfile>
+FaultProfile::standard()
+{
+    std::vector<FaultProfile> out;
+
+    FaultProfile clean;
+    clean.name = "clean";
+    out.push_back(clean);
+
+    FaultProfile slow;
+    slow.name = "slow";
+    slow.seed = 2;
+    slow.latency = std::chrono::milliseconds(80);
+    slow.jitter = std::chrono::milliseconds(40);
+    out.push_back(slow);
+
+    FaultProfile narrow;
+    narrow.name = "narrow";
+    narrow.seed = 3;
+    narrow.latency = std::chrono::milliseconds(20);
+    narrow.bytesPerSecond = 32 * 1024;
+    out.push_back(narrow);
+
+    // Shorter than the stratum timeout, so nothing should give up:
+    FaultProfile stalls;
+    stalls.name = "stalls";
+    stalls.seed = 4;
+    stalls.latency = std::chrono::milliseconds(20);
+    stalls.stallChance = 0.02;
+    stalls.stall = std::chrono::milliseconds(3000);
+    out.push_back(stalls);
+
+    FaultProfile lossy;
+    lossy.name = "lossy";
+    lossy.seed = 5;
+    lossy.latency = std::chrono::milliseconds(20);
+    lossy.truncateChance = 0.01;
+    lossy.disconnectChance = 0.01;
+    out.push_back(lossy);
+
+    return out;
+}
+
+FaultProxy::~FaultProxy()
+{
+    done_ = true;
+    thread_.join();
+    close(listen_);
+}
+
+FaultProxy::FaultProxy(unsigned upstream, const FaultProfile &profile):
+    upstream_(upstream),
+    profile_(profile),
+    random_(profile.seed),
+    connections_(0),
+    faults_(0),
+    done_(false)
+{
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    listen(listen_, 1);
+
+    socklen_t size = sizeof(addr);
+    getsockname(listen_, reinterpret_cast<struct sockaddr *>(&addr), &size);
+    port_ = ntohs(addr.sin_port);
+
+    thread_ = std::thread([this]() { run(); });
+}
+
+std::string
+FaultProxy::uri() const
+{
+    return "stratum://127.0.0.1:" + std::to_string(port_);
+}
+
+bool
+FaultProxy::roll(double chance)
+{
+    if (chance <= 0)
+        return false;
+    return std::uniform_real_distribution<double>(0, 1)(random_) < chance;
+}
+
+bool
+FaultProxy::schedule(Pipe &pipe, std::string data, bool reply)
+{
+    const auto now = Clock::now();
+
+    if (roll(profile_.disconnectChance))
+    {
+        ++faults_;
+        return false;
+    }
+
+    // Only replies get cut short, since that is what clients must parse:
+    bool hangup = false;
+    if (reply && 1 < data.size() && roll(profile_.truncateChance))
+    {
+        ++faults_;
+        data.resize(std::uniform_int_distribution<size_t>(
+                        1, data.size() - 1)(random_));
+        hangup = true;
+    }
+
+    auto delay = profile_.latency;
+    if (profile_.jitter.count())
+        delay += std::chrono::milliseconds(
+                     std::uniform_int_distribution<long>(
+                         0, profile_.jitter.count())(random_));
+    if (roll(profile_.stallChance))
+    {
+        ++faults_;
+        delay += profile_.stall;
+    }
+
+    // The link carries one chunk at a time:
+    auto due = std::max(now + delay, pipe.last);
+    if (profile_.bytesPerSecond)
+        due += std::chrono::microseconds(
+                   1000000 * data.size() / profile_.bytesPerSecond);
+
+    pipe.last = due;
+    pipe.chunks.push_back(Chunk{due, std::move(data), hangup});
+    return true;
+}
+
+bool
+FaultProxy::deliver(Pipe &pipe, Clock::time_point now)
+{
+    while (!pipe.chunks.empty() && pipe.chunks.front().due <= now)
+    {
+        const auto &chunk = pipe.chunks.front();
+        for (size_t sent = 0; sent < chunk.data.size(); )
+        {
+            const auto bytes = send(pipe.fd, chunk.data.data() + sent,
+                                    chunk.data.size() - sent, 0);
+            if (bytes <= 0)
+                return false;
+            sent += bytes;
+        }
+        if (chunk.hangup)
+            return false;
+        pipe.chunks.pop_front();
+    }
+    return true;
+}
+
+void
+FaultProxy::run()
+{
+    while (!done_)
+    {
+        struct pollfd item = { listen_, POLLIN, 0 };
+        if (poll(&item, 1, 10) <= 0)
+            continue;
+
+        const int client = accept(listen_, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        const int server = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(upstream_);
+        if (0 == connect(server, reinterpret_cast<struct sockaddr *>(&addr),
+                         sizeof(addr)))
+        {
+            ++connections_;
+            relay(client, server);
+        }
+        close(server);
+        close(client);
+    }
+}
+
+void
+FaultProxy::relay(int client, int server)
+{
+    Pipe toServer{server, {}, Clock::now()};
+    Pipe toClient{client, {}, Clock::now()};
+
+    while (!done_)
+    {
+        const auto now = Clock::now();
+        if (!deliver(toServer, now) || !deliver(toClient, now))
+            return;
+
+        // Sleep until the next chunk is due, but keep an eye on `done_`:
+        auto wake = now + std::chrono::milliseconds(10);
+        for (const auto *pipe: {&toServer, &toClient})
+            if (!pipe->chunks.empty())
+                wake = std::min(wake, pipe->chunks.front().due);
+        const auto timeout = std::chrono::duration_cast<
+                             std::chrono::milliseconds>(wake - now).count();
+
+        struct pollfd items[] =
+        {
+            { client, POLLIN, 0 },
+            { server, POLLIN, 0 }
+        };
+        if (poll(items, 2, std::max<long>(timeout, 0)) <= 0)
+            continue;
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!items[i].revents)
+                continue;
+
+            char buffer[65536];
+            const auto size = recv(items[i].fd, buffer, sizeof(buffer), 0);
+            if (size <= 0)
+                return;
+
+            const bool reply = server == items[i].fd;
+            if (!schedule(reply ? toClient : toServer,
+                          std::string(buffer, size), reply))
+                return;
+        }
+    }
+}
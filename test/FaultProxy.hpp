@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A loopback proxy that makes a local server look like a bad network.
+ */
+
+#ifndef TEST_FAULT_PROXY_HPP
+#define TEST_FAULT_PROXY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * The network conditions a `FaultProxy` simulates.
+ * Each fault is rolled once for every chunk of data the proxy reads,
+ * using a generator seeded from the profile.
+ */
+struct FaultProfile
+{
+    std::string name;
+    unsigned seed = 1;
+
+    // Delay added to each chunk, plus a random extra up to `jitter`:
+    std::chrono::milliseconds latency{0};
+    std::chrono::milliseconds jitter{0};
+
+    // Link speed in each direction, or zero for no limit:
+    size_t bytesPerSecond = 0;
+
+    // The chance of holding a chunk back for `stall`:
+    double stallChance = 0;
+    std::chrono::milliseconds stall{0};
+
+    // The chance of cutting a reply short and then hanging up:
+    double truncateChance = 0;
+
+    // The chance of dropping a chunk and hanging up:
+    double disconnectChance = 0;
+
+    /**
+     * A clean link, followed by a range of progressively worse ones.
+     */
+    static std::vector<FaultProfile>
+    standard();
+};
+
+/**
+ * Listens on a loopback port and relays each connection to a server
+ * on another loopback port, injecting faults along the way.
+ * Serves one connection at a time, like the mock server.
+ */
+class FaultProxy
+{
+public:
+    ~FaultProxy();
+
+    /**
+     * @param upstream The loopback port to relay connections to.
+     */
+    FaultProxy(unsigned upstream, const FaultProfile &profile);
+
+    /**
+     * Returns the `stratum://` URI for connecting through this proxy.
+     */
+    std::string
+    uri() const;
+
+    size_t connections() const { return connections_; }
+    size_t faults() const { return faults_; }
+
+    FaultProxy(const FaultProxy &copy) = delete;
+    FaultProxy &operator=(const FaultProxy &copy) = delete;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Data waiting to go out one side of the proxy:
+    struct Chunk
+    {
+        Clock::time_point due;
+        std::string data;
+        bool hangup;
+    };
+    struct Pipe
+    {
+        int fd;
+        std::deque<Chunk> chunks;
+        Clock::time_point last; // Chunks never pass each other
+    };
+
+    const unsigned upstream_;
+    const FaultProfile profile_;
+    std::mt19937 random_; // Only touched by the proxy thread
+    std::atomic<size_t> connections_;
+    std::atomic<size_t> faults_;
+    std::atomic<bool> done_;
+    int listen_;
+    unsigned port_;
+    std::thread thread_;
+
+    /**
+     * Returns true with the given probability.
+     */
+    bool
+    roll(double chance);
+
+    /**
+     * Queues data read from one side to go out the other.
+     * @param reply True if the data is coming from the server.
+     * @return false if the connection should drop right away.
+     */
+    bool
+    schedule(Pipe &pipe, std::string data, bool reply);
+
+    /**
+     * Writes out the chunks that are due.
+     * @return false if the connection should drop.
+     */
+    bool
+    deliver(Pipe &pipe, Clock::time_point now);
+
+    void
+    run();
+
+    /**
+     * Relays data between a client and the server until either side,
+     * or an injected fault, closes the connection.
+     */
+    void
+    relay(int client, int server);
+};
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/HeaderStore.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+static abcd::DataChunk
+fakeHeader(uint8_t seed)
+{
+    abcd::DataChunk out(abcd::HeaderStore::recordSize);
+    for (size_t i = 0; i < out.size(); ++i)
+        out[i] = seed + i;
+    return out;
+}
+
+static bool
+sameHeader(const abcd::HeaderStore::Record &a, const abcd::DataChunk &b)
+{
+    return std::equal(a.begin(), a.end(), b.begin());
+}
+
+TEST_CASE("In-memory header store", "[bitcoin][headers]")
+{
+    abcd::HeaderStore store("");
+    abcd::HeaderStore::Record record;
+    REQUIRE(store.open());
+
+    REQUIRE(!store.has(0));
+    REQUIRE(!store.get(record, 100));
+
+    REQUIRE(store.insert(100, fakeHeader(1)));
+    REQUIRE(store.insert(5000, fakeHeader(2)));
+    REQUIRE(store.has(100));
+    REQUIRE(store.has(5000));
+    REQUIRE(!store.has(101));
+    REQUIRE(store.get(record, 100));
+    REQUIRE(sameHeader(record, fakeHeader(1)));
+
+    // Only whole headers are allowed:
+    REQUIRE(!store.insert(7, abcd::DataChunk(79, 1)));
+
+    REQUIRE(store.clear());
+    REQUIRE(!store.has(100));
+}
+
+TEST_CASE("Memory-mapped header store", "[bitcoin][headers]")
+{
+    const std::string path = "/tmp/abc-headers-test.bin";
+    unlink(path.c_str());
+    abcd::HeaderStore::Record record;
+
+    {
+        abcd::HeaderStore store(path);
+        REQUIRE(store.open());
+        REQUIRE(store.insert(420000, fakeHeader(3)));
+        REQUIRE(store.insert(12, fakeHeader(4)));
+    }
+
+    // The headers survive a re-open:
+    {
+        abcd::HeaderStore store(path);
+        REQUIRE(store.open());
+        REQUIRE(store.get(record, 420000));
+        REQUIRE(sameHeader(record, fakeHeader(3)));
+        REQUIRE(store.get(record, 12));
+        REQUIRE(sameHeader(record, fakeHeader(4)));
+        REQUIRE(!store.has(13));
+
+        REQUIRE(store.clear());
+        REQUIRE(!store.has(12));
+        REQUIRE(store.insert(12, fakeHeader(5)));
+        REQUIRE(store.get(record, 12));
+        REQUIRE(sameHeader(record, fakeHeader(5)));
+    }
+
+    unlink(path.c_str());
+}
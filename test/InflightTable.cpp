@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/InflightTable.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("In-flight request merging", "[bitcoin][network]")
+{
+    abcd::InflightTable table;
+
+    // The first wallet to ask sends the request, and the rest wait:
+    REQUIRE(table.join("tx:a", "wallet1"));
+    REQUIRE(!table.join("tx:a", "wallet2"));
+    REQUIRE(!table.join("tx:a", "wallet3"));
+    REQUIRE(table.pending("tx:a"));
+
+    // Asking twice is not a second request:
+    REQUIRE(!table.join("tx:a", "wallet1"));
+
+    // A wallet that leaves doesn't get the reply:
+    table.leave("wallet3");
+
+    const auto waiters = table.finish("tx:a");
+    REQUIRE(2 == waiters.size());
+    REQUIRE(waiters.count("wallet1"));
+    REQUIRE(waiters.count("wallet2"));
+    REQUIRE(!table.pending("tx:a"));
+
+    // Once finished, the next request goes out again:
+    REQUIRE(table.join("tx:a", "wallet1"));
+
+    const auto stats = table.stats();
+    REQUIRE(4 == stats.requests);
+    REQUIRE(2 == stats.sent);
+    REQUIRE(0.5 == stats.ratio());
+}
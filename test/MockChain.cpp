@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "MockChain.hpp"
+#include "MockStratumServer.hpp"
+#include "../abcd/crypto/Encoding.hpp"
+#include "../abcd/spend/Outputs.hpp"
+#include "../abcd/util/Data.hpp"
+#include <stdio.h>
+
+// Somewhere to send the funding outputs:
+static const char otherAddress[] = "1QLbz7JHiBTspS962RLKV8GndWFwi5j6Qr";
+
+// Block timestamps start here, and go up by ten minutes a block:
+constexpr uint32_t genesisTime = 1231006505;
+constexpr uint32_t blockTime = 600;
+
+/**
+ * Returns the raw bytes of a fake header at the given height.
+ */
+static abcd::DataChunk
+rawHeader(size_t height)
+{
+    abcd::DataChunk out(80);
+    out[0] = 1;
+    const uint32_t timestamp = genesisTime + blockTime * height;
+    for (int i = 0; i < 4; ++i)
+        out[68 + i] = timestamp >> (8 * i);
+    return out;
+}
+
+MockChain::MockChain(size_t addressCount, size_t paymentsEach,
+                     size_t height):
+    height_(height)
+{
+    bc::script_type otherReceive;
+    abcd::outputScriptForAddress(otherReceive, otherAddress);
+
+    for (size_t i = 0; i < addressCount; ++i)
+    {
+        // Number the address hashes, rather than doing EC math:
+        bc::short_hash hash{{0xab}};
+        for (int j = 0; j < 4; ++j)
+            hash[16 + j] = i >> (8 * j);
+        const auto address = bc::payment_address(
+                                 bc::payment_address::pubkey_version,
+                                 hash).encoded();
+        addresses_.push_back(address);
+
+        bc::script_type receive;
+        abcd::outputScriptForAddress(receive, address);
+
+        for (size_t k = 0; k < paymentsEach; ++k)
+        {
+            // Spread the payments over the chain, in a scrambled order:
+            const uint32_t n = i * paymentsEach + k;
+            const size_t paymentHeight = 1 + (7919 * n) % (height - 1);
+
+            // The funding transaction spends nothing we know about:
+            bc::transaction_type funding
+            {
+                1, 0,
+                {
+                    {{bc::hash_digest{}, n}, {}, 0xffffffff}
+                },
+                {
+                    {100000, otherReceive}
+                }
+            };
+            const auto fundingId = txAdd(funding);
+
+            bc::transaction_type payment
+            {
+                1, 0,
+                {
+                    {{bc::hash_digest{}, 0}, {}, 0xffffffff}
+                },
+                {
+                    {90000, receive}
+                }
+            };
+            bc::decode_hash(payment.inputs[0].previous_output.hash,
+                            fundingId);
+            const auto paymentId = txAdd(payment);
+
+            payments_.insert(paymentId);
+            paymentHeights_.insert(paymentHeight);
+            histories_[address].push_back(
+                std::make_pair(paymentId, paymentHeight));
+        }
+    }
+}
+
+std::vector<std::string>
+MockChain::broadcasts() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return broadcasts_;
+}
+
+void
+MockChain::serve(MockStratumServer &server)
+{
+    server.handlerSet("blockchain.numblocks.subscribe",
+                      [this](abcd::JsonArray params)
+    {
+        return std::to_string(height_);
+    });
+
+    server.handlerSet("blockchain.address.subscribe",
+                      [this](abcd::JsonArray params)
+    {
+        return addressStatus(json_string_value(params[0].get()));
+    });
+
+    server.handlerSet("blockchain.address.get_history",
+                      [this](abcd::JsonArray params)
+    {
+        std::string out;
+        auto i = histories_.find(json_string_value(params[0].get()));
+        if (histories_.end() != i)
+        {
+            for (const auto &row: i->second)
+                out += std::string(out.empty() ? "" : ", ") +
+                       "{\"tx_hash\": \"" + row.first + "\", "
+                       "\"height\": " + std::to_string(row.second) + "}";
+        }
+        return "[" + out + "]";
+    });
+
+    server.handlerSet("blockchain.transaction.get",
+                      [this](abcd::JsonArray params)
+    {
+        auto i = txs_.find(json_string_value(params[0].get()));
+        if (txs_.end() == i)
+            return std::string();
+        return "\"" + i->second + "\"";
+    });
+
+    server.handlerSet("blockchain.block.get_header",
+                      [this](abcd::JsonArray params)
+    {
+        const size_t height = json_integer_value(params[0].get());
+        if (height_ < height)
+            return std::string();
+
+        const std::string hash(64, '0');
+        return "{\"nonce\": 0, \"version\": 1, \"bits\": 0, "
+               "\"timestamp\": " +
+               std::to_string(genesisTime + blockTime * height) + ", "
+               "\"prev_block_hash\": \"" + hash + "\", "
+               "\"merkle_root\": \"" + hash + "\"}";
+    });
+
+    server.handlerSet("blockchain.block.get_chunk",
+                      [this](abcd::JsonArray params)
+    {
+        const size_t start = abcd::stratumChunkSize *
+                             json_integer_value(params[0].get());
+        if (height_ < start)
+            return std::string();
+
+        abcd::DataChunk raw;
+        for (size_t i = start;
+                i <= height_ && i < start + abcd::stratumChunkSize; ++i)
+        {
+            const auto header = rawHeader(i);
+            raw.insert(raw.end(), header.begin(), header.end());
+        }
+        return "\"" + abcd::base16Encode(raw) + "\"";
+    });
+
+    server.handlerSet("blockchain.estimatefee",
+                      [](abcd::JsonArray params)
+    {
+        // Waiting longer costs less:
+        const auto blocks = json_integer_value(params[0].get());
+        char out[32];
+        snprintf(out, sizeof(out), "%.8f", 0.0005 / (blocks ? blocks : 1));
+        return std::string(out);
+    });
+
+    server.handlerSet("blockchain.transaction.broadcast",
+                      [this](abcd::JsonArray params)
+    {
+        const std::string hex = json_string_value(params[0].get());
+        abcd::DataChunk raw;
+        if (!abcd::base16Decode(raw, hex))
+            return std::string("\"bad transaction\"");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        broadcasts_.push_back(hex);
+        return "\"" + bc::encode_hash(bc::bitcoin_hash(raw)) + "\"";
+    });
+}
+
+std::string
+MockChain::txAdd(const bc::transaction_type &tx)
+{
+    bc::data_chunk raw(satoshi_raw_size(tx));
+    bc::satoshi_save(tx, raw.begin());
+
+    const auto txid = bc::encode_hash(bc::bitcoin_hash(raw));
+    txs_[txid] = abcd::base16Encode(raw);
+    return txid;
+}
+
+std::string
+MockChain::addressStatus(const std::string &address) const
+{
+    auto i = histories_.find(address);
+    if (histories_.end() == i)
+        return "null";
+
+    // Like electrum, hash the history in a known format:
+    std::string history;
+    for (const auto &row: i->second)
+        history += row.first + ":" + std::to_string(row.second) + ":";
+    const bc::data_chunk raw(history.begin(), history.end());
+    return "\"" + bc::encode_hash(bc::bitcoin_hash(raw)) + "\"";
+}
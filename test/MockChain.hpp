@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A deterministic fixture blockchain for the mock stratum server.
+ */
+
+#ifndef TEST_MOCK_CHAIN_HPP
+#define TEST_MOCK_CHAIN_HPP
+
+#include "../abcd/bitcoin/Typedefs.hpp"
+#include <bitcoin/bitcoin.hpp>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class MockStratumServer;
+
+/**
+ * A small, made-up blockchain that pays into a set of wallet addresses.
+ * The same parameters always produce the same addresses,
+ * transactions, and heights, so test runs are repeatable.
+ *
+ * Each payment spends an output of its own funding transaction,
+ * which the chain also serves, since the wallet fetches the inputs
+ * of every transaction it sees.
+ */
+class MockChain
+{
+public:
+    /**
+     * @param addressCount The number of wallet addresses.
+     * @param paymentsEach The number of payments into each address.
+     * @param height The chain height. Payments land below this.
+     */
+    MockChain(size_t addressCount, size_t paymentsEach, size_t height);
+
+    /**
+     * The wallet addresses, in a fixed order.
+     */
+    const std::vector<std::string> &
+    addresses() const { return addresses_; }
+
+    /**
+     * The txids of every payment into the wallet addresses.
+     */
+    const abcd::TxidSet &
+    payments() const { return payments_; }
+
+    /**
+     * The heights of the blocks holding those payments.
+     */
+    const std::set<size_t> &
+    paymentHeights() const { return paymentHeights_; }
+
+    size_t height() const { return height_; }
+
+    /**
+     * The raw transactions clients have broadcast, as hex.
+     */
+    std::vector<std::string>
+    broadcasts() const;
+
+    /**
+     * Teaches a mock server to answer every wallet sync method
+     * from this chain, along with fee estimates and broadcasts.
+     * The chain must outlive the server.
+     */
+    void
+    serve(MockStratumServer &server);
+
+private:
+    typedef std::vector<std::pair<std::string, size_t>> History;
+
+    const size_t height_;
+    std::vector<std::string> addresses_;
+    abcd::TxidSet payments_;
+    std::set<size_t> paymentHeights_;
+    std::map<std::string, std::string> txs_; // Raw hex, by txid
+    std::map<std::string, History> histories_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> broadcasts_;
+
+    /**
+     * Adds a transaction to the chain.
+     * @return The new txid.
+     */
+    std::string
+    txAdd(const bc::transaction_type &tx);
+
+    /**
+     * Answers `blockchain.address.subscribe`,
+     * which is a hash of the address history, or null if there is none.
+     */
+    std::string
+    addressStatus(const std::string &address) const;
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "MockReplay.hpp"
+#include "MockStratumServer.hpp"
+#include "../abcd/json/JsonArray.hpp"
+#include "../abcd/json/JsonObject.hpp"
+#include <limits.h>
+#include <utility>
+
+struct ReplayMessageJson:
+    public abcd::JsonObject
+{
+    ABC_JSON_CONSTRUCTORS(ReplayMessageJson, JsonObject)
+
+    ABC_JSON_INTEGER(id, "id", 0)
+    ABC_JSON_STRING(method, "method", "")
+    ABC_JSON_VALUE(params, "params", abcd::JsonPtr)
+    ABC_JSON_VALUE(result, "result", abcd::JsonPtr)
+};
+
+/**
+ * Encodes any JSON value, including the bare ones jansson rejects.
+ */
+static std::string
+jsonText(abcd::JsonPtr value)
+{
+    if (!value.get())
+        return "null";
+
+    abcd::JsonArray wrapper;
+    wrapper.append(value);
+    const auto out = wrapper.encode(true);
+    return out.substr(1, out.size() - 2);
+}
+
+/**
+ * Splits a message into its parts, if it is a batch.
+ */
+static std::vector<abcd::JsonPtr>
+jsonItems(const std::string &message)
+{
+    std::vector<abcd::JsonPtr> out;
+    abcd::JsonPtr json;
+    if (!json.decode(message))
+        return out;
+
+    if (!json_is_array(json.get()))
+    {
+        out.push_back(json);
+        return out;
+    }
+
+    abcd::JsonArray array(json);
+    for (size_t i = 0; i < array.size(); ++i)
+        out.push_back(array[i]);
+    return out;
+}
+
+MockReplay::MockReplay():
+    misses_(0)
+{
+}
+
+abcd::Status
+MockReplay::load(const std::string &path)
+{
+    using namespace abcd;
+
+    std::vector<TrafficRecorder::Event> events;
+    ABC_CHECK(TrafficRecorder::load(events, path));
+    load(events);
+    return Status();
+}
+
+void
+MockReplay::load(const std::vector<abcd::TrafficRecorder::Event> &events)
+{
+    // The request each reply belongs to, by connection and id:
+    typedef std::pair<std::string, long> RequestId;
+    std::map<RequestId, std::string> requests;
+
+    for (const auto &event: events)
+    {
+        // Every connection numbers its requests from scratch:
+        if (abcd::TrafficRecorder::connected == event.type)
+        {
+            requests.erase(requests.lower_bound(RequestId(event.uri, 0)),
+                           requests.upper_bound(RequestId(event.uri,
+                                                          LONG_MAX)));
+            continue;
+        }
+
+        for (const auto &item: jsonItems(event.message))
+        {
+            ReplayMessageJson json(item);
+            if (!json.idOk())
+                continue;
+            const RequestId id(event.uri, json.id());
+
+            if (abcd::TrafficRecorder::sent == event.type)
+            {
+                const std::string method = json.method();
+                const auto params = json.params();
+                requests[id] = method + " " + jsonText(params);
+                methods_.insert(method);
+
+                if ("blockchain.address.subscribe" == method &&
+                        json_is_array(params.get()))
+                {
+                    abcd::JsonArray array(params);
+                    if (array.size() && json_is_string(array[0].get()))
+                        addresses_.insert(json_string_value(array[0].get()));
+                }
+            }
+            else if (abcd::TrafficRecorder::received == event.type)
+            {
+                auto i = requests.find(id);
+                if (requests.end() == i)
+                    continue;
+
+                // A missing result means the server sent an error:
+                const auto result = json.result();
+                replies_[i->second].push_back(
+                    result.get() ? jsonText(result) : std::string());
+                requests.erase(i);
+            }
+        }
+    }
+}
+
+void
+MockReplay::serve(MockStratumServer &server)
+{
+    for (const auto &method: methods_)
+    {
+        server.handlerSet(method, [this, method](abcd::JsonArray params)
+        {
+            return reply(method + " " + jsonText(params));
+        });
+    }
+}
+
+std::string
+MockReplay::reply(const std::string &key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto i = replies_.find(key);
+    if (replies_.end() == i || i->second.empty())
+    {
+        ++misses_;
+        return std::string();
+    }
+
+    auto &replies = i->second;
+    const auto out = replies.front();
+    if (1 < replies.size())
+        replies.pop_front();
+    return out;
+}
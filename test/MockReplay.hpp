@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * Plays recorded server traffic back through the mock stratum server.
+ */
+
+#ifndef TEST_MOCK_REPLAY_HPP
+#define TEST_MOCK_REPLAY_HPP
+
+#include "../abcd/bitcoin/network/TrafficRecorder.hpp"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class MockStratumServer;
+
+/**
+ * Answers stratum requests with the replies from a traffic recording,
+ * so a real-world sync session can run again offline.
+ *
+ * Requests are matched by method and parameters, not by timing,
+ * so the replay is the same no matter how the client orders things.
+ * Repeated requests get the recorded replies in order,
+ * and then the last one over again.
+ * Libbitcoin traffic and subscription updates are not replayed.
+ */
+class MockReplay
+{
+public:
+    MockReplay();
+
+    /**
+     * Reads a recording from disk.
+     */
+    abcd::Status
+    load(const std::string &path);
+
+    /**
+     * Indexes the replies in a list of recorded events.
+     */
+    void
+    load(const std::vector<abcd::TrafficRecorder::Event> &events);
+
+    /**
+     * The addresses the recorded wallet subscribed to,
+     * so a fresh wallet can watch the same ones.
+     */
+    const std::set<std::string> &
+    addresses() const { return addresses_; }
+
+    /**
+     * The number of requests the recording had no reply for.
+     */
+    size_t misses() const { return misses_; }
+
+    /**
+     * Teaches a mock server to answer from the recording.
+     * The replay must outlive the server.
+     */
+    void
+    serve(MockStratumServer &server);
+
+private:
+    std::mutex mutex_;
+    std::map<std::string, std::deque<std::string>> replies_;
+    std::set<std::string> methods_;
+    std::set<std::string> addresses_;
+    std::atomic<size_t> misses_;
+
+    /**
+     * Answers one request, given its method and parameters.
+     */
+    std::string
+    reply(const std::string &key);
+};
+
+#endif
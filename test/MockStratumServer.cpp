@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "MockStratumServer.hpp"
+#include "../abcd/json/JsonObject.hpp"
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct MockRequestJson:
+    public abcd::JsonObject
+{
+    ABC_JSON_CONSTRUCTORS(MockRequestJson, JsonObject)
+
+    ABC_JSON_INTEGER(id, "id", 0)
+    ABC_JSON_STRING(method, "method", "")
+    ABC_JSON_VALUE(params, "params", abcd::JsonArray)
+};
+
+MockStratumServer::~MockStratumServer()
+{
+    done_ = true;
+    thread_.join();
+    close(listen_);
+}
+
+MockStratumServer::MockStratumServer(bool batches,
+                                     std::chrono::milliseconds delay):
+    batches_(batches),
+    delay_(delay),
+    requests_(0),
+    roundTrips_(0),
+    rejected_(0),
+    done_(false)
+{
+    listen_ = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    listen(listen_, 1);
+
+    socklen_t size = sizeof(addr);
+    getsockname(listen_, reinterpret_cast<struct sockaddr *>(&addr), &size);
+    port_ = ntohs(addr.sin_port);
+
+    handlers_["server.version"] = [](abcd::JsonArray params)
+    {
+        return std::string("\"mock 1.0\"");
+    };
+
+    thread_ = std::thread([this]() { run(); });
+}
+
+std::string
+MockStratumServer::uri() const
+{
+    return "stratum://127.0.0.1:" + std::to_string(port_);
+}
+
+void
+MockStratumServer::handlerSet(const std::string &method,
+                              const Handler &handler)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    handlers_[method] = handler;
+}
+
+MockStratumServer::Handler
+MockStratumServer::handler(const std::string &method)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto i = handlers_.find(method);
+    return handlers_.end() != i ? i->second : Handler();
+}
+
+void
+MockStratumServer::dropSet(const std::string &method)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    drops_.insert(method);
+}
+
+void
+MockStratumServer::rateLimitSet(double perSecond, double burst)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    limit_.rateSet(perSecond, burst);
+}
+
+std::string
+MockStratumServer::reply(abcd::JsonPtr request)
+{
+    ++requests_;
+    MockRequestJson json(request);
+    const auto prefix = "{\"id\": " + std::to_string(json.id()) + ", ";
+
+    Handler handler;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (std::string("server.version") != json.method() &&
+                !limit_.take())
+        {
+            ++rejected_;
+            hangup_ = true;
+            return prefix + "\"error\": \"rate limit exceeded\"}";
+        }
+
+        if (drops_.count(json.method()))
+            return std::string();
+
+        auto i = handlers_.find(json.method());
+        if (handlers_.end() != i)
+            handler = i->second;
+    }
+
+    const auto result = handler ? handler(json.params()) : std::string();
+    if (result.empty())
+        return prefix + "\"error\": \"unknown method\"}";
+    return prefix + "\"result\": " + result + "}";
+}
+
+std::string
+MockStratumServer::replyLine(const std::string &line)
+{
+    ++roundTrips_;
+    abcd::JsonPtr json;
+    if (!json.decode(line))
+        return "{\"id\": null, \"error\": \"parse error\"}\n";
+
+    if (!json_is_array(json.get()))
+    {
+        const auto out = reply(json);
+        return out.empty() ? out : out + "\n";
+    }
+
+    // Old servers reject batches outright:
+    if (!batches_)
+        return "{\"id\": null, \"error\": \"batches not supported\"}\n";
+
+    abcd::JsonArray batch(json);
+    std::string out;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        const auto item = reply(batch[i]);
+        if (!item.empty())
+            out += (out.empty() ? "" : ", ") + item;
+    }
+    return out.empty() ? out : "[" + out + "]\n";
+}
+
+void
+MockStratumServer::run()
+{
+    // Clients that reconnect get served again, one at a time:
+    while (!done_)
+    {
+        struct pollfd item = { listen_, POLLIN, 0 };
+        if (poll(&item, 1, 10) <= 0)
+            continue;
+
+        const int fd = accept(listen_, nullptr, nullptr);
+        if (fd < 0)
+            continue;
+        serve(fd);
+        close(fd);
+    }
+}
+
+void
+MockStratumServer::serve(int fd)
+{
+    std::string incoming;
+    hangup_ = false;
+    while (!done_)
+    {
+        struct pollfd item = { fd, POLLIN, 0 };
+        if (poll(&item, 1, 10) <= 0)
+            continue;
+
+        char buffer[65536];
+        const auto size = recv(fd, buffer, sizeof(buffer), 0);
+        if (size <= 0)
+            break;
+        incoming.append(buffer, size);
+
+        size_t end;
+        while (std::string::npos != (end = incoming.find('\n')))
+        {
+            if (delay_.count())
+                std::this_thread::sleep_for(delay_);
+
+            const auto out = replyLine(incoming.substr(0, end));
+            for (size_t sent = 0; sent < out.size(); )
+            {
+                const auto bytes = send(fd, out.data() + sent,
+                                        out.size() - sent, 0);
+                if (bytes <= 0)
+                    break;
+                sent += bytes;
+            }
+            incoming.erase(0, end + 1);
+        }
+
+        // Abusive clients get cut off:
+        if (hangup_)
+            break;
+    }
+}
+
+abcd::Status
+mockDrive(abcd::StratumConnection &connection,
+          const std::function<bool ()> &done,
+          std::chrono::milliseconds limit)
+{
+    using namespace abcd;
+
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (!done())
+    {
+        if (deadline < std::chrono::steady_clock::now())
+            return ABC_ERROR(ABC_CC_Error, "Timed out");
+
+        SleepTime sleep;
+        ABC_CHECK(connection.wakeup(sleep));
+
+        auto items = connection.pollfds();
+        poll(items.data(), items.size(), 10);
+    }
+
+    // Send anything the callbacks queued up:
+    return connection.flush();
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+/**
+ * @file
+ * A local stand-in for a stratum server, for use in tests.
+ */
+
+#ifndef TEST_MOCK_STRATUM_SERVER_HPP
+#define TEST_MOCK_STRATUM_SERVER_HPP
+
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "../abcd/json/JsonArray.hpp"
+#include "../abcd/util/TokenBucket.hpp"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+/**
+ * Listens on a loopback port, serves one connection at a time,
+ * and answers JSON-RPC requests using per-method handlers.
+ * It counts both the requests it sees and the round trips they took.
+ */
+class MockStratumServer
+{
+public:
+    /**
+     * Produces the JSON text of a method's result,
+     * or an empty string to send back an error instead.
+     */
+    typedef std::function<std::string (abcd::JsonArray params)> Handler;
+
+    ~MockStratumServer();
+
+    /**
+     * @param batches True if the server should accept JSON-RPC batch arrays.
+     * @param delay Simulated network latency for each round trip.
+     */
+    MockStratumServer(bool batches=true,
+                      std::chrono::milliseconds delay=
+                          std::chrono::milliseconds(0));
+
+    /**
+     * Returns the `stratum://` URI for connecting to this server.
+     */
+    std::string
+    uri() const;
+
+    unsigned port() const { return port_; }
+
+    /**
+     * Installs a handler for a method.
+     * `server.version` is handled by default.
+     */
+    void
+    handlerSet(const std::string &method, const Handler &handler);
+
+    /**
+     * Returns the handler for a method, so a test can wrap it.
+     */
+    Handler
+    handler(const std::string &method);
+
+    /**
+     * Makes the server silently ignore all requests for a method.
+     */
+    void
+    dropSet(const std::string &method);
+
+    /**
+     * Makes the server enforce a request rate, like public servers do.
+     * Past the limit, the server answers with an error and hangs up.
+     * `server.version` is exempt, since clients use it as a keepalive.
+     */
+    void
+    rateLimitSet(double perSecond, double burst);
+
+    size_t requests() const { return requests_; }
+    size_t roundTrips() const { return roundTrips_; }
+    size_t rejected() const { return rejected_; }
+
+private:
+    const bool batches_;
+    const std::chrono::milliseconds delay_;
+    std::atomic<size_t> requests_;
+    std::atomic<size_t> roundTrips_;
+    std::atomic<size_t> rejected_;
+    std::atomic<bool> done_;
+    int listen_;
+    unsigned port_;
+
+    std::mutex mutex_;
+    std::map<std::string, Handler> handlers_;
+    std::set<std::string> drops_;
+    abcd::TokenBucket limit_;
+    bool hangup_ = false; // Only touched by the server thread
+    std::thread thread_;
+
+    /**
+     * Answers a single request object,
+     * or returns an empty string if the request should go unanswered.
+     */
+    std::string
+    reply(abcd::JsonPtr request);
+
+    /**
+     * Answers one line of input, which might be a batch.
+     */
+    std::string
+    replyLine(const std::string &line);
+
+    void
+    run();
+
+    /**
+     * Answers requests on one connection until it closes.
+     */
+    void
+    serve(int fd);
+};
+
+/**
+ * Services a connection until `done` returns true.
+ * @return An error if the connection fails or time runs out.
+ */
+abcd::Status
+mockDrive(abcd::StratumConnection &connection,
+          const std::function<bool ()> &done,
+          std::chrono::milliseconds limit=std::chrono::milliseconds(5000));
+
+#endif
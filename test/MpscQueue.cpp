@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/util/MpscQueue.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST_CASE("MPSC queue order", "[util][queue]")
+{
+    abcd::MpscQueue<std::unique_ptr<int>> queue;
+    std::unique_ptr<int> item;
+    REQUIRE(!queue.pop(item));
+
+    queue.push(std::unique_ptr<int>(new int(1)));
+    queue.push(std::unique_ptr<int>(new int(2)));
+    REQUIRE(queue.pop(item));
+    REQUIRE(1 == *item);
+    REQUIRE(queue.pop(item));
+    REQUIRE(2 == *item);
+    REQUIRE(!queue.pop(item));
+
+    // Anything left over gets cleaned up:
+    queue.push(std::unique_ptr<int>(new int(3)));
+}
+
+TEST_CASE("MPSC queue with many producers", "[util][queue]")
+{
+    const size_t producers = 4;
+    const size_t count = 20000;
+    abcd::MpscQueue<std::pair<size_t, size_t>> queue;
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&queue, p, count]()
+        {
+            for (size_t i = 0; i < count; ++i)
+                queue.push(std::make_pair(p, i));
+        });
+    }
+
+    // Each producer's items arrive complete and in order:
+    std::vector<size_t> next(producers, 0);
+    size_t received = 0;
+    bool ordered = true;
+    while (received < producers * count)
+    {
+        std::pair<size_t, size_t> item;
+        if (!queue.pop(item))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        ordered = ordered && next[item.first] == item.second;
+        next[item.first] = item.second + 1;
+        ++received;
+    }
+    for (auto &thread: threads)
+        thread.join();
+
+    REQUIRE(ordered);
+    std::pair<size_t, size_t> item;
+    REQUIRE(!queue.pop(item));
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../minilibs/libbitcoin-client/client.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <chrono>
+#include <iostream>
+
+/**
+ * Remembers the last request the codec sent.
+ */
+struct CaptureStream:
+    public bc::client::message_stream
+{
+    bc::data_stack last;
+
+    void write(const bc::data_stack &data) override
+    {
+        last = data;
+    }
+};
+
+static void
+appendLittleEndian(bc::data_chunk &out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+/**
+ * Builds a successful `blockchain.fetch_history` reply payload.
+ */
+static bc::data_chunk
+historyPayload(size_t rows)
+{
+    bc::data_chunk out;
+    appendLittleEndian(out, 0, 4); // Error code
+    for (size_t i = 0; i < rows; ++i)
+    {
+        out.insert(out.end(), 32, static_cast<uint8_t>(i)); // Output hash
+        appendLittleEndian(out, i, 4); // Output index
+        appendLittleEndian(out, 400000 + i, 4); // Output height
+        appendLittleEndian(out, 1000 * i, 8); // Value
+        out.insert(out.end(), 32, 0xff); // Spend hash
+        appendLittleEndian(out, 0xffffffff, 4); // Spend index
+        appendLittleEndian(out, 0, 4); // Spend height
+    }
+    return out;
+}
+
+/**
+ * Sends a history request and feeds back a reply,
+ * pointing straight at the payload buffer like the socket does.
+ */
+static void
+historyRoundTrip(bc::client::obelisk_codec &codec, CaptureStream &stream,
+                 const bc::data_chunk &payload,
+                 bc::client::obelisk_codec::fetch_history_handler onReply)
+{
+    auto onError = [](const std::error_code &error)
+    {
+        FAIL(error.message());
+    };
+    codec.fetch_history(onError, onReply,
+                        bc::payment_address(0, bc::null_short_hash));
+
+    const bc::client::data_slice_stack reply =
+    {
+        stream.last[0], stream.last[1], payload
+    };
+    codec.write_view(reply);
+}
+
+TEST_CASE("Obelisk history decoding", "[bitcoin][obelisk]")
+{
+    auto stream = std::make_shared<CaptureStream>();
+    bc::client::obelisk_codec codec(stream);
+
+    const auto payload = historyPayload(3);
+    size_t calls = 0;
+    auto onReply = [&](const bc::client::history_list &history)
+    {
+        ++calls;
+        REQUIRE(3 == history.size());
+        REQUIRE(2 == history[2].output.index);
+        REQUIRE(400002 == history[2].output_height);
+        REQUIRE(2000 == history[2].value);
+    };
+    historyRoundTrip(codec, *stream, payload, onReply);
+    REQUIRE(1 == calls);
+    REQUIRE(0 == codec.outstanding_call_count());
+
+    // Replies to unknown requests go nowhere:
+    const bc::data_stack stale = stream->last;
+    codec.write(stale);
+    REQUIRE(1 == calls);
+}
+
+TEST_CASE("Obelisk decoding throughput", "[.][benchmark][obelisk]")
+{
+    auto stream = std::make_shared<CaptureStream>();
+    bc::client::obelisk_codec codec(stream);
+
+    const size_t total = 20000;
+    const auto payload = historyPayload(50);
+    size_t rows = 0;
+    auto onReply = [&](const bc::client::history_list &history)
+    {
+        rows += history.size();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < total; ++i)
+        historyRoundTrip(codec, *stream, payload, onReply);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << "Obelisk: " << total << " history replies, " << rows <<
+              " rows in " << ms << "ms (" <<
+              (ms ? 1000 * total / ms : 0) << " replies/s, " <<
+              (ms ? total * payload.size() / ms / 1000 : 0) << " MB/s)" <<
+              std::endl;
+    const size_t expected = 50 * total;
+    REQUIRE(expected == rows);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/Reactor.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <unistd.h>
+
+typedef std::chrono::milliseconds Ms;
+
+TEST_CASE("Reactor sockets", "[network][reactor]")
+{
+    abcd::Reactor reactor;
+    int a[2];
+    int b[2];
+    REQUIRE(0 == pipe(a));
+    REQUIRE(0 == pipe(b));
+
+    int aCount = 0;
+    int bCount = 0;
+    REQUIRE(reactor.watch(a[0], POLLIN, [&](short) { ++aCount; }));
+    REQUIRE(reactor.watch(b[0], POLLIN, [&](short) { ++bCount; }));
+    REQUIRE(2 == reactor.watchCount());
+
+    // Only the ready descriptor runs:
+    REQUIRE(1 == write(a[1], "x", 1));
+    REQUIRE(reactor.run(Ms(100)));
+    REQUIRE(1 == aCount);
+    REQUIRE(0 == bCount);
+
+    // Handlers can remove other handlers that are also ready:
+    REQUIRE(1 == write(b[1], "x", 1));
+    REQUIRE(reactor.watch(a[0], POLLIN, [&](short)
+    {
+        ++aCount;
+        reactor.unwatch(b[0]);
+    }));
+    REQUIRE(reactor.watch(b[0], POLLIN, [&](short)
+    {
+        ++bCount;
+        reactor.unwatch(a[0]);
+    }));
+    REQUIRE(reactor.run(Ms(100)));
+    const int fired = aCount + bCount - 1;
+    REQUIRE(1 == fired);
+    REQUIRE(1 == reactor.watchCount());
+
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+}
+
+TEST_CASE("Reactor timers", "[network][reactor]")
+{
+    abcd::Reactor reactor;
+    const auto now = abcd::Reactor::Clock::now();
+
+    std::string order;
+    reactor.timerAdd(now + Ms(20), [&]() { order += "b"; });
+    reactor.timerAdd(now + Ms(10), [&]() { order += "a"; });
+    auto cancelled = reactor.timerAdd(now + Ms(15), [&]() { order += "x"; });
+    reactor.timerCancel(cancelled);
+    REQUIRE(2 == reactor.timerCount());
+
+    // With nothing else to do, the reactor sleeps until each timer:
+    while (reactor.timerCount())
+        REQUIRE(reactor.run(Ms(0)));
+    REQUIRE("ab" == order);
+    REQUIRE(Ms(20) <= abcd::Reactor::Clock::now() - now);
+}
+
+TEST_CASE("Reactor timers wake the caller", "[network][reactor]")
+{
+    abcd::Reactor reactor;
+    int p[2];
+    REQUIRE(0 == pipe(p));
+    REQUIRE(reactor.watch(p[0], POLLIN, [](short) {}));
+
+    // A due timer queues work, but no socket ever becomes ready:
+    bool queued = false;
+    reactor.timerAdd(abcd::Reactor::Clock::now(), [&]() { queued = true; });
+
+    // The reactor returns at once, so the caller can do the work:
+    const auto start = abcd::Reactor::Clock::now();
+    REQUIRE(reactor.run(Ms(1000)));
+    const auto elapsed = abcd::Reactor::Clock::now() - start;
+    REQUIRE(queued);
+    REQUIRE(elapsed < Ms(500));
+
+    close(p[0]);
+    close(p[1]);
+}
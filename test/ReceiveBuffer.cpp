@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/util/ReceiveBuffer.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <string.h>
+
+static void
+write(abcd::ReceiveBuffer &buffer, const std::string &text)
+{
+    memcpy(buffer.prepare(text.size()), text.data(), text.size());
+    buffer.commit(text.size());
+}
+
+TEST_CASE("Receive buffer", "[util]")
+{
+    abcd::ReceiveBuffer buffer(8);
+    REQUIRE(buffer.data().empty());
+
+    // Writes and reads come out in order:
+    write(buffer, "hello ");
+    write(buffer, "world");
+    REQUIRE("hello world" == abcd::toString(buffer.data()));
+    buffer.consume(6);
+    REQUIRE("world" == abcd::toString(buffer.data()));
+
+    // Sliding and growing keep the unread bytes contiguous:
+    for (int i = 0; i < 100; ++i)
+    {
+        write(buffer, "0123456789");
+        buffer.consume(10);
+    }
+    REQUIRE("56789" == abcd::toString(buffer.data()));
+    write(buffer, std::string(1000, 'x'));
+    REQUIRE(1005 == buffer.size());
+    REQUIRE("56789x" == abcd::toString(buffer.data()).substr(0, 6));
+
+    // Emptying the buffer rewinds it:
+    buffer.consume(buffer.size());
+    REQUIRE(0 == buffer.size());
+    REQUIRE(buffer.space() >= 1005);
+}
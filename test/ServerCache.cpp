@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/ServerCache.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdio.h>
+#include <unistd.h>
+
+typedef abcd::ServerCache::Ms Ms;
+
+static void
+fill(abcd::ServerCache &servers, const std::string &uri, unsigned latency)
+{
+    for (unsigned i = 0; i < 20; ++i)
+        servers.replied(uri, Ms(latency + i));
+}
+
+TEST_CASE("Server scores", "[bitcoin][servers]")
+{
+    abcd::ServerCache servers("");
+    fill(servers, "fast", 20);
+    fill(servers, "slow", 200);
+    fill(servers, "flaky", 20);
+    for (int i = 0; i < 10; ++i)
+        servers.timedOut("flaky");
+    servers.heightReported("fast", 1000);
+    servers.heightReported("slow", 1000);
+    fill(servers, "behind", 20);
+    servers.heightReported("behind", 990);
+
+    REQUIRE(servers.score("fast") < servers.score("slow"));
+    REQUIRE(servers.score("fast") < servers.score("flaky"));
+    REQUIRE(servers.score("fast") < servers.score("behind"));
+
+    // Unknown servers are neither the best nor the worst:
+    REQUIRE(servers.score("fast") < servers.score("new"));
+    REQUIRE(servers.score("new") < servers.score("flaky"));
+
+    abcd::ServerCache::Stats stats;
+    REQUIRE(servers.stats(stats, "slow"));
+    REQUIRE(Ms(210) == stats.latency50);
+    REQUIRE(Ms(218) == stats.latency90);
+    REQUIRE(!servers.stats(stats, "new"));
+}
+
+TEST_CASE("Server picking", "[bitcoin][servers]")
+{
+    abcd::ServerCache servers("");
+    fill(servers, "fast", 20);
+    fill(servers, "slow", 200);
+
+    // The fast server wins most of the time, but not always:
+    const std::vector<std::string> candidates = { "slow", "fast" };
+    size_t fast = 0;
+    for (int i = 0; i < 1000; ++i)
+        fast += servers.pick(candidates);
+    REQUIRE(800 < fast);
+    REQUIRE(fast < 1000);
+}
+
+TEST_CASE("Server statistics persist", "[bitcoin][servers]")
+{
+    char path[] = "/tmp/ServerCacheXXXXXX";
+    close(mkstemp(path));
+    {
+        abcd::ServerCache servers(path);
+        fill(servers, "fast", 20);
+        servers.connected("fast", Ms(50));
+        REQUIRE(servers.save());
+    }
+
+    abcd::ServerCache servers(path);
+    REQUIRE(servers.load());
+    abcd::ServerCache::Stats stats;
+    REQUIRE(servers.stats(stats, "fast"));
+    REQUIRE(Ms(50) == stats.connectTime);
+    REQUIRE(20 == stats.replies);
+    remove(path);
+}
+
+TEST_CASE("Server heights follow the majority", "[bitcoin][servers]")
+{
+    char path[] = "/tmp/ServerCacheXXXXXX";
+    close(mkstemp(path));
+    {
+        abcd::ServerCache servers(path);
+        fill(servers, "liar", 20);
+        fill(servers, "honest1", 20);
+        fill(servers, "honest2", 20);
+        servers.heightReported("liar", 1000000);
+        servers.heightReported("honest1", 1000);
+        servers.heightReported("honest2", 1000);
+
+        // One inflated height doesn't make the honest servers look behind:
+        REQUIRE(servers.score("honest1") == servers.score("liar"));
+        REQUIRE(servers.score("honest2") == servers.score("liar"));
+        REQUIRE(servers.save());
+    }
+
+    // The inflated height doesn't survive a restart either:
+    abcd::ServerCache servers(path);
+    REQUIRE(servers.load());
+    servers.heightReported("honest1", 1001);
+    servers.heightReported("honest2", 1001);
+    REQUIRE(servers.score("honest1") == servers.score("liar"));
+
+    // A server that really is behind only loses so much:
+    fill(servers, "behind", 20);
+    for (int i = 0; i < 10; ++i)
+        servers.heightReported("behind", 1);
+    REQUIRE(servers.score("honest1") < servers.score("behind"));
+    REQUIRE(servers.score("behind") < servers.score("honest1") + 10000);
+    remove(path);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <iostream>
+
+static void
+historyServerSetup(MockStratumServer &server)
+{
+    server.handlerSet("blockchain.address.get_history",
+                      [](abcd::JsonArray params)
+    {
+        return std::string("[{\"tx_hash\": \"00\", \"height\": 1}]");
+    });
+}
+
+/**
+ * Fetches `total` address histories, keeping the connection as busy
+ * as `queueFull` allows.
+ */
+static void
+fetchHistories(abcd::StratumConnection &connection, size_t total)
+{
+    size_t sent = 0;
+    size_t replies = 0;
+    auto onError = [&](abcd::Status s)
+    {
+        FAIL(s);
+    };
+    auto onReply = [&](const abcd::AddressHistory &history)
+    {
+        ++replies;
+    };
+
+    auto done = [&]()
+    {
+        while (sent < total && !connection.queueFull())
+        {
+            connection.addressHistoryFetch(onError, onReply, "address");
+            ++sent;
+        }
+        return total <= replies;
+    };
+    REQUIRE(mockDrive(connection, done, std::chrono::seconds(60)));
+}
+
+TEST_CASE("Stratum request batching", "[bitcoin][stratum]")
+{
+    SECTION("batches")
+    {
+        MockStratumServer server(true);
+        historyServerSetup(server);
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        // The first few go out alone, while the probe is in flight:
+        fetchHistories(connection, 30);
+        REQUIRE(31 == server.requests());
+        REQUIRE(server.roundTrips() < 20);
+    }
+
+    SECTION("fallback")
+    {
+        MockStratumServer server(false);
+        historyServerSetup(server);
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        fetchHistories(connection, 30);
+        REQUIRE(30 == server.requests());
+        REQUIRE(31 == server.roundTrips());
+    }
+
+    SECTION("silent")
+    {
+        // Some servers never answer a batch at all:
+        MockStratumServer server(true);
+        historyServerSetup(server);
+        server.dropSet("server.version");
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        // Nothing waits on the probe:
+        const auto start = std::chrono::steady_clock::now();
+        fetchHistories(connection, 30);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        REQUIRE(elapsed < std::chrono::seconds(5));
+    }
+
+    SECTION("early requests")
+    {
+        MockStratumServer server(true);
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        // Requests made while connecting wait for the socket:
+        std::string version;
+        connection.version([](abcd::Status s) { FAIL(s.message()); },
+                           [&](const std::string &reply) { version = reply; });
+        REQUIRE(!connection.connected());
+        REQUIRE(connection.flush());
+        REQUIRE(connection.flushNeeded());
+        REQUIRE(mockDrive(connection, [&]() { return !version.empty(); }));
+        REQUIRE("mock 1.0" == version);
+    }
+
+    SECTION("probe timeout")
+    {
+        MockStratumServer server(true);
+        server.dropSet("server.version");
+        abcd::StratumConnection connection;
+        connection.timeoutSet("server.version", std::chrono::milliseconds(50));
+        REQUIRE(connection.connect(server.uri()));
+
+        // A lost probe is not a sign of congestion:
+        const auto end = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(300);
+        REQUIRE(mockDrive(connection, [&]()
+        {
+            return end < std::chrono::steady_clock::now();
+        }));
+        REQUIRE(10 == connection.window());
+    }
+}
+
+static void
+benchmark(bool batches, size_t total)
+{
+    MockStratumServer server(batches, std::chrono::milliseconds(2));
+    historyServerSetup(server);
+    abcd::StratumConnection connection;
+    REQUIRE(connection.connect(server.uri()));
+
+    const auto start = std::chrono::steady_clock::now();
+    fetchHistories(connection, total);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << (batches ? "Batched: " : "Unbatched: ") << total <<
+              " requests in " << server.roundTrips() << " round trips, " <<
+              ms << "ms (" << (ms ? 1000 * total / ms : 0) << " req/s)" <<
+              std::endl;
+}
+
+TEST_CASE("Stratum batching throughput", "[.][benchmark][stratum]")
+{
+    benchmark(false, 2000);
+    benchmark(true, 2000);
+}
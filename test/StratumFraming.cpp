@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdio.h>
+#include <iostream>
+
+/**
+ * Teaches the mock server to return a huge address history.
+ */
+static void
+bigHistorySetup(MockStratumServer &server, size_t count)
+{
+    std::string reply = "[";
+    for (size_t i = 0; i < count; ++i)
+    {
+        char txid[65];
+        snprintf(txid, sizeof(txid), "%064zx", i);
+        reply += std::string(i ? ", " : "") + "{\"tx_hash\": \"" + txid +
+                 "\", \"height\": " + std::to_string(i + 1) + "}";
+    }
+    reply += "]";
+
+    server.handlerSet("blockchain.address.get_history",
+                      [reply](abcd::JsonArray params)
+    {
+        return reply;
+    });
+}
+
+/**
+ * Fetches the history `total` times, returning the number of txids seen.
+ */
+static size_t
+fetchBigHistories(abcd::StratumConnection &connection, size_t total)
+{
+    size_t replies = 0;
+    size_t txids = 0;
+    for (size_t i = 0; i < total; ++i)
+    {
+        connection.addressHistoryFetch([](abcd::Status s) { FAIL(s); },
+                                       [&](const abcd::AddressHistory &history)
+        {
+            txids += history.size();
+            ++replies;
+        }, "address");
+    }
+
+    REQUIRE(mockDrive(connection, [&]() { return total <= replies; },
+                      std::chrono::seconds(60)));
+    return txids;
+}
+
+TEST_CASE("Stratum framing of large replies", "[bitcoin][stratum]")
+{
+    // About 4MB per reply, so each one spans many socket reads:
+    MockStratumServer server;
+    bigHistorySetup(server, 40000);
+    abcd::StratumConnection connection;
+    REQUIRE(connection.connect(server.uri()));
+
+    REQUIRE(120000 == fetchBigHistories(connection, 3));
+}
+
+TEST_CASE("Stratum large reply throughput", "[.][benchmark][stratum]")
+{
+    MockStratumServer server;
+    bigHistorySetup(server, 100000);
+    abcd::StratumConnection connection;
+    REQUIRE(connection.connect(server.uri()));
+
+    const size_t total = 10;
+    const auto start = std::chrono::steady_clock::now();
+    fetchBigHistories(connection, total);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << total << " replies of ~10MB in " << ms << "ms" << std::endl;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+/**
+ * Asks for `total` address histories all at once,
+ * and returns the number that came back.
+ */
+static size_t
+fetchAll(MockStratumServer &server, double rate, double burst, size_t total)
+{
+    server.handlerSet("blockchain.address.get_history",
+                      [](abcd::JsonArray params)
+    {
+        return std::string("[{\"tx_hash\": \"00\", \"height\": 1}]");
+    });
+
+    abcd::StratumConnection connection;
+    connection.paceSet(rate, burst);
+    REQUIRE(connection.connect(server.uri()));
+
+    size_t replies = 0;
+    size_t errors = 0;
+    auto onError = [&](abcd::Status s)
+    {
+        ++errors;
+    };
+    auto onReply = [&](const abcd::AddressHistory &history)
+    {
+        ++replies;
+    };
+    for (size_t i = 0; i < total; ++i)
+        connection.addressHistoryFetch(onError, onReply, "address");
+
+    // A server that hangs up makes this fail, which is fine:
+    auto done = [&]()
+    {
+        return total <= replies + errors;
+    };
+    mockDrive(connection, done);
+    return replies;
+}
+
+TEST_CASE("Stratum request pacing", "[bitcoin][stratum][pacing]")
+{
+    SECTION("unpaced")
+    {
+        MockStratumServer server;
+        server.rateLimitSet(50, 10);
+        REQUIRE(fetchAll(server, 0, 0, 30) < 30);
+        REQUIRE(0 < server.rejected());
+    }
+
+    SECTION("paced")
+    {
+        MockStratumServer server;
+        server.rateLimitSet(50, 10);
+        REQUIRE(30 == fetchAll(server, 40, 10, 30));
+        REQUIRE(0 == server.rejected());
+    }
+}
+
+TEST_CASE("Stratum interactive requests", "[bitcoin][stratum][pacing]")
+{
+    MockStratumServer server;
+    server.handlerSet("blockchain.address.get_history",
+                      [](abcd::JsonArray params)
+    {
+        return std::string("[{\"tx_hash\": \"00\", \"height\": 1}]");
+    });
+
+    abcd::StratumConnection connection;
+    connection.paceSet(2, 1);
+    REQUIRE(connection.connect(server.uri()));
+    REQUIRE(mockDrive(connection, [&]()
+    {
+        return connection.connected();
+    }));
+
+    size_t background = 0;
+    size_t interactive = 0;
+    auto onError = [&](abcd::Status s) {};
+
+    SECTION("reserved room")
+    {
+        // Nothing gets sent here, so these all stay queued:
+        auto onReply = [&](const libbitcoin::transaction_type &tx) {};
+        while (!connection.queueFull())
+            connection.txDataFetch(onError, onReply, "00");
+        REQUIRE(!connection.queueFull(abcd::Priority::interactive));
+    }
+
+    SECTION("skips the pacing queue")
+    {
+        auto onBackground = [&](const abcd::AddressHistory &history)
+        {
+            ++background;
+        };
+        auto onInteractive = [&](const abcd::AddressHistory &history)
+        {
+            ++interactive;
+        };
+
+        for (int i = 0; i < 5; ++i)
+            connection.addressHistoryFetch(onError, onBackground, "address");
+        connection.addressHistoryFetch(onError, onInteractive, "address",
+                                       abcd::Priority::interactive);
+
+        REQUIRE(mockDrive(connection, [&]()
+        {
+            return 0 < interactive;
+        }, std::chrono::milliseconds(400)));
+        REQUIRE(background <= 1);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("Stratum request timeouts", "[bitcoin][stratum]")
+{
+    MockStratumServer server;
+    server.dropSet("blockchain.address.get_history");
+    abcd::StratumConnection connection;
+    connection.timeoutSet("blockchain.address.get_history",
+                          std::chrono::milliseconds(200));
+    REQUIRE(connection.connect(server.uri()));
+    const auto window = connection.window();
+
+    // The lost request fails on its own:
+    abcd::Status error;
+    bool failed = false;
+    connection.addressHistoryFetch([&](abcd::Status s)
+    {
+        error = s;
+        failed = true;
+    }, [](const abcd::AddressHistory &) {}, "address");
+    REQUIRE(mockDrive(connection, [&]() { return failed; }));
+    REQUIRE(ABC_CC_ServerTimeout == error.value());
+    REQUIRE(connection.window() < window);
+
+    // The socket is still good for other work:
+    std::string version;
+    connection.version([](abcd::Status s) { FAIL(s); },
+                       [&](const std::string &reply) { version = reply; });
+    REQUIRE(mockDrive(connection, [&]() { return !version.empty(); }));
+    REQUIRE("mock 1.0" == version);
+}
+
+TEST_CASE("Stratum congestion window", "[bitcoin][stratum]")
+{
+    MockStratumServer server(false);
+    abcd::StratumConnection connection;
+    REQUIRE(connection.connect(server.uri()));
+    const auto window = connection.window();
+
+    // Prompt replies open the window up:
+    size_t replies = 0;
+    for (size_t i = 0; i < 100; ++i)
+    {
+        connection.version([](abcd::Status s) { FAIL(s); },
+                           [&](const std::string &) { ++replies; });
+    }
+    REQUIRE(mockDrive(connection, [&]() { return 100 <= replies; }));
+    REQUIRE(window < connection.window());
+}
+
+TEST_CASE("Closing a connection cancels its requests", "[bitcoin][stratum]")
+{
+    MockStratumServer server;
+    server.dropSet("blockchain.address.get_history");
+    abcd::Status error;
+    {
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+        connection.addressHistoryFetch([&](abcd::Status s) { error = s; },
+                                       [](const abcd::AddressHistory &) {},
+                                       "address");
+        REQUIRE(mockDrive(connection, [&]()
+        {
+            return !connection.flushNeeded();
+        }));
+    }
+    REQUIRE(ABC_CC_Cancelled == error.value());
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/network/TcpConnection.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+typedef std::chrono::milliseconds Ms;
+
+/**
+ * A loopback listening socket.
+ * In blackhole mode, the accept queue is kept full,
+ * so the kernel silently drops any new connection attempts.
+ */
+class LocalEndpoint
+{
+public:
+    ~LocalEndpoint()
+    {
+        if (0 <= filler_)
+            close(filler_);
+        close(listen_);
+    }
+
+    LocalEndpoint(bool blackhole=false):
+        filler_(-1)
+    {
+        listen_ = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(listen_, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr));
+        listen(listen_, 0);
+
+        socklen_t size = sizeof(addr);
+        getsockname(listen_, reinterpret_cast<struct sockaddr *>(&addr),
+                    &size);
+        port_ = ntohs(addr.sin_port);
+
+        if (blackhole)
+        {
+            filler_ = socket(AF_INET, SOCK_STREAM, 0);
+            ::connect(filler_, reinterpret_cast<struct sockaddr *>(&addr),
+                      sizeof(addr));
+        }
+    }
+
+    /**
+     * Stops dropping connection attempts.
+     */
+    void
+    open()
+    {
+        close(::accept(listen_, nullptr, nullptr));
+    }
+
+    /**
+     * Takes the next incoming connection, in non-blocking mode.
+     */
+    int
+    accept()
+    {
+        const int fd = ::accept(listen_, nullptr, nullptr);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        return fd;
+    }
+
+    unsigned port() const { return port_; }
+
+private:
+    int listen_;
+    int filler_;
+    unsigned port_;
+};
+
+/**
+ * Services a connection until it connects or fails.
+ */
+static abcd::Status
+drive(abcd::TcpConnection &connection, Ms limit=Ms(5000))
+{
+    using namespace abcd;
+
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (!connection.connected())
+    {
+        if (deadline < std::chrono::steady_clock::now())
+            return ABC_ERROR(ABC_CC_Error, "Test timed out");
+
+        Ms sleep(0);
+        ABC_CHECK(connection.wakeup(sleep));
+        if (connection.connected())
+            break;
+
+        auto items = connection.pollfds();
+        poll(items.data(), items.size(), sleep.count() ? sleep.count() : -1);
+    }
+
+    return Status();
+}
+
+static Ms
+since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<Ms>(
+               std::chrono::steady_clock::now() - start);
+}
+
+TEST_CASE("Asynchronous TCP connect", "[network]")
+{
+    SECTION("healthy")
+    {
+        LocalEndpoint endpoint;
+        abcd::TcpConnection connection;
+        REQUIRE(connection.connect("127.0.0.1", endpoint.port()));
+        REQUIRE(drive(connection));
+        REQUIRE(connection.send(std::string("ping")));
+    }
+
+    SECTION("both address families")
+    {
+        // Whichever family goes first, the IPv4 listener wins:
+        LocalEndpoint endpoint;
+        abcd::TcpConnection connection;
+        REQUIRE(connection.connect("localhost", endpoint.port()));
+        REQUIRE(drive(connection));
+    }
+
+    SECTION("refused")
+    {
+        unsigned port;
+        {
+            LocalEndpoint closed;
+            port = closed.port();
+        }
+        abcd::TcpConnection connection;
+        REQUIRE(connection.connect("127.0.0.1", port));
+        REQUIRE(ABC_CC_ServerError == drive(connection).value());
+    }
+
+    SECTION("blackholed")
+    {
+        LocalEndpoint endpoint(true);
+        abcd::TcpConnection connection;
+
+        // Starting the connection never blocks:
+        const auto start = std::chrono::steady_clock::now();
+        REQUIRE(connection.connect("127.0.0.1", endpoint.port(), Ms(300)));
+        REQUIRE(since(start) < Ms(100));
+
+        REQUIRE(ABC_CC_ServerError == drive(connection).value());
+        REQUIRE(Ms(300) <= since(start));
+    }
+
+    SECTION("slow")
+    {
+        LocalEndpoint endpoint(true);
+        abcd::TcpConnection connection;
+        REQUIRE(connection.connect("127.0.0.1", endpoint.port()));
+        Ms sleep(0);
+        REQUIRE(connection.wakeup(sleep));
+        REQUIRE(!connection.connected());
+
+        // The kernel retries the handshake once there is room:
+        endpoint.open();
+        REQUIRE(drive(connection));
+    }
+}
+
+TEST_CASE("Racing TCP connects", "[network]")
+{
+    // A dead server doesn't hold up a live one:
+    LocalEndpoint dead(true);
+    LocalEndpoint live;
+    abcd::TcpConnection a;
+    abcd::TcpConnection b;
+    REQUIRE(a.connect("127.0.0.1", dead.port()));
+    REQUIRE(b.connect("127.0.0.1", live.port()));
+
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE(drive(b));
+    REQUIRE(since(start) < Ms(1000));
+
+    Ms sleep(0);
+    REQUIRE(a.wakeup(sleep));
+    REQUIRE(!a.connected());
+}
+
+TEST_CASE("TCP sends never block", "[network]")
+{
+    LocalEndpoint endpoint;
+    abcd::TcpConnection connection;
+    REQUIRE(connection.connect("127.0.0.1", endpoint.port()));
+    REQUIRE(drive(connection));
+    const int peer = endpoint.accept();
+
+    // The peer isn't reading yet, so most of this has to wait:
+    const std::string data(16 * 1024 * 1024, 'x');
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE(connection.send(data));
+    REQUIRE(since(start) < Ms(1000));
+    const bool waiting = connection.pollfds()[0].events & POLLOUT;
+    REQUIRE(waiting);
+
+    // Once the peer reads, the rest goes out:
+    size_t received = 0;
+    char buffer[65536];
+    while (received < data.size() && since(start) < Ms(5000))
+    {
+        const auto bytes = recv(peer, buffer, sizeof(buffer), 0);
+        if (0 < bytes)
+            received += bytes;
+
+        Ms sleep(0);
+        REQUIRE(connection.wakeup(sleep));
+    }
+    REQUIRE(data.size() == received);
+    const bool drained = !(connection.pollfds()[0].events & POLLOUT);
+    REQUIRE(drained);
+    close(peer);
+}
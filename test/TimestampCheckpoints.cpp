@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/BlockCache.hpp"
+#include "../abcd/bitcoin/cache/TimestampCheckpoints.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+TEST_CASE("Timestamp bundle round trip", "[bitcoin][checkpoints]")
+{
+    // Block timestamps can go backwards:
+    const std::vector<uint32_t> timestamps =
+    {
+        1231006505, 1231469665, 1231469744, 1231470173, 1231470000,
+        1231470988, 1231471428, 1231471789, 1231472369, 1231472743
+    };
+
+    abcd::DataChunk bundle;
+    REQUIRE(abcd::TimestampCheckpoints::encode(bundle, timestamps));
+
+    abcd::TimestampCheckpoints checkpoints;
+    REQUIRE(checkpoints.decode(bundle));
+    REQUIRE(timestamps.size() == checkpoints.size());
+    for (size_t i = 0; i < timestamps.size(); ++i)
+    {
+        time_t time;
+        REQUIRE(checkpoints.time(time, i));
+        REQUIRE(timestamps[i] == time);
+    }
+
+    // Damaged bundles are rejected:
+    bundle.resize(bundle.size() / 2);
+    REQUIRE(!checkpoints.decode(bundle));
+}
+
+TEST_CASE("Block cache checkpoints", "[bitcoin][checkpoints]")
+{
+    std::vector<uint32_t> timestamps;
+    for (uint32_t i = 0; i < 100; ++i)
+        timestamps.push_back(1000 + 600 * i);
+
+    abcd::DataChunk bundle;
+    REQUIRE(abcd::TimestampCheckpoints::encode(bundle, timestamps));
+    abcd::TimestampCheckpoints checkpoints;
+    REQUIRE(checkpoints.decode(bundle));
+
+    abcd::BlockCache blocks("");
+    blocks.checkpointsSet(checkpoints);
+
+    // Covered heights never hit the network:
+    blocks.headerNeededAdd(50);
+    blocks.headerNeededAdd(150);
+    REQUIRE(150 == blocks.headerNeeded());
+    REQUIRE(0 == blocks.headerNeeded());
+
+    time_t time;
+    REQUIRE(blocks.headerTime(time, 50));
+    REQUIRE(timestamps[50] == time);
+
+    // Fetched headers must agree with the checkpoints:
+    abcd::DataChunk raw(2 * 80);
+    raw[68] = 0xff;
+    size_t count;
+    REQUIRE(!blocks.headersInsert(count, 98, raw));
+    REQUIRE(0 == count);
+
+    for (int j = 0; j < 2; ++j)
+        for (int i = 0; i < 4; ++i)
+            raw[80 * j + 68 + i] = timestamps[98 + j] >> (8 * i);
+    REQUIRE(blocks.headersInsert(count, 98, raw));
+    REQUIRE(2 == count);
+
+    // So must headers fetched one at a time:
+    libbitcoin::block_header_type header {};
+    header.timestamp = timestamps[97] + 1;
+    REQUIRE(!blocks.headerInsert(97, header));
+    header.timestamp = timestamps[97];
+    REQUIRE(blocks.headerInsert(97, header));
+}
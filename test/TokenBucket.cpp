@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/util/TokenBucket.hpp"
+#include "../minilibs/catch/catch.hpp"
+
+typedef abcd::TokenBucket::Clock Clock;
+typedef std::chrono::milliseconds Ms;
+
+TEST_CASE("Token bucket pacing", "[util][pacing]")
+{
+    const auto start = Clock::now();
+    abcd::TokenBucket bucket(10, 3, start);
+
+    // The bucket starts full, so a burst goes out right away:
+    REQUIRE(bucket.take(start));
+    REQUIRE(bucket.take(start));
+    REQUIRE(bucket.take(start));
+    REQUIRE(!bucket.take(start));
+    REQUIRE(Ms(100) == bucket.wait(1, start));
+    REQUIRE(Ms(200) == bucket.wait(2, start));
+
+    // Tokens come back at the configured rate:
+    REQUIRE(!bucket.take(start + Ms(50)));
+    REQUIRE(bucket.take(start + Ms(100)));
+    REQUIRE(!bucket.take(start + Ms(100)));
+
+    // But never more than the burst size:
+    const auto later = start + std::chrono::seconds(10);
+    REQUIRE(3 == bucket.available(later));
+    REQUIRE(Ms(0) == bucket.wait(3, later));
+}
+
+TEST_CASE("Token bucket debt", "[util][pacing]")
+{
+    const auto start = Clock::now();
+    abcd::TokenBucket bucket(10, 1, start);
+
+    // Borrowing works on an empty bucket, but must be paid back:
+    REQUIRE(bucket.take(start));
+    bucket.borrow(start);
+    bucket.borrow(start);
+    REQUIRE(-2 == bucket.available(start));
+    REQUIRE(Ms(300) == bucket.wait(1, start));
+    REQUIRE(!bucket.take(start + Ms(200)));
+    REQUIRE(bucket.take(start + Ms(300)));
+}
+
+TEST_CASE("Token bucket without a limit", "[util][pacing]")
+{
+    abcd::TokenBucket bucket;
+    REQUIRE(bucket.unlimited());
+    for (int i = 0; i < 1000; ++i)
+        REQUIRE(bucket.take());
+    REQUIRE(Ms(0) == bucket.wait(1000));
+}
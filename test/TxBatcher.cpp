@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/TxBatcher.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <iostream>
+
+TEST_CASE("Transaction batch window", "[bitcoin][batcher]")
+{
+    const std::chrono::milliseconds window(500);
+    abcd::TxBatcher batcher(window);
+    abcd::TxBatcher::TxidList txids;
+    const auto start = abcd::TxBatcher::Clock::now();
+
+    // Nothing pending:
+    REQUIRE(!batcher.flush(txids, start));
+    REQUIRE(0 == batcher.nextWakeup(start).count());
+
+    // The first txid opens the window, and duplicates are dropped:
+    REQUIRE(batcher.insert("a", start));
+    REQUIRE(!batcher.insert("b", start + std::chrono::milliseconds(100)));
+    REQUIRE(!batcher.insert("a", start + std::chrono::milliseconds(200)));
+    REQUIRE(0 < batcher.nextWakeup(start).count());
+
+    // Still inside the window:
+    REQUIRE(!batcher.flush(txids, start + std::chrono::milliseconds(499)));
+
+    // The window closes:
+    REQUIRE(batcher.flush(txids, start + window));
+    REQUIRE(2 == txids.size());
+    REQUIRE("a" == txids[0]);
+    REQUIRE("b" == txids[1]);
+    REQUIRE(!batcher.flush(txids, start + window));
+
+    // A forced flush ignores the window:
+    REQUIRE(batcher.insert("a", start + window));
+    REQUIRE(batcher.flush(txids, start + window, true));
+    REQUIRE(1 == txids.size());
+}
+
+TEST_CASE("Synthetic catch-up sync", "[bitcoin][batcher]")
+{
+    // 1000 transactions trickle in over two seconds,
+    // which would be 1000 separate GUI events without batching:
+    const size_t total = 1000;
+    abcd::TxBatcher batcher(std::chrono::milliseconds(250));
+    auto now = abcd::TxBatcher::Clock::now();
+
+    size_t events = 0;
+    size_t delivered = 0;
+    abcd::TxBatcher::TxidList txids;
+    for (size_t i = 0; i < total; ++i)
+    {
+        batcher.insert(std::to_string(i), now);
+        if (batcher.flush(txids, now))
+        {
+            ++events;
+            delivered += txids.size();
+        }
+        now += std::chrono::milliseconds(2);
+    }
+    if (batcher.flush(txids, now, true))
+    {
+        ++events;
+        delivered += txids.size();
+    }
+
+    REQUIRE(total == delivered);
+    REQUIRE(events <= 9);
+}
+
+TEST_CASE("Transaction batch throughput", "[.][benchmark][batcher]")
+{
+    const size_t total = 1000000;
+    abcd::TxBatcher batcher(std::chrono::milliseconds(250));
+    const auto start = abcd::TxBatcher::Clock::now();
+
+    size_t delivered = 0;
+    abcd::TxBatcher::TxidList txids;
+    for (size_t i = 0; i < total; ++i)
+    {
+        batcher.insert(std::to_string(i), start);
+        if (0 == i % 10000 && batcher.flush(txids, start, true))
+            delivered += txids.size();
+    }
+    if (batcher.flush(txids, start, true))
+        delivered += txids.size();
+
+    const auto elapsed = abcd::TxBatcher::Clock::now() - start;
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << total << " txids batched in " << ms << "ms" << std::endl;
+    REQUIRE(total == delivered);
+}
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2016, Airbitz, Inc.
+ * All rights reserved.
+ *
+ * See the LICENSE file for more information.
+ */
+
+#include "../abcd/bitcoin/cache/Cache.hpp"
+#include "../abcd/bitcoin/cache/ServerCache.hpp"
+#include "../abcd/bitcoin/cache/TimestampCheckpoints.hpp"
+#include "../abcd/bitcoin/network/Reactor.hpp"
+#include "../abcd/bitcoin/network/StratumConnection.hpp"
+#include "../abcd/bitcoin/network/TxUpdater.hpp"
+#include "FaultProxy.hpp"
+#include "MockChain.hpp"
+#include "MockReplay.hpp"
+#include "MockStratumServer.hpp"
+#include "../minilibs/catch/catch.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+/**
+ * Runs an updater until `done` returns true.
+ * @return An error if the reactor fails or time runs out.
+ */
+static abcd::Status
+updaterDrive(abcd::TxUpdater &txu, abcd::Reactor &reactor,
+             const std::function<bool ()> &done,
+             std::chrono::milliseconds limit)
+{
+    using namespace abcd;
+
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (!done())
+    {
+        if (deadline < std::chrono::steady_clock::now())
+            return ABC_ERROR(ABC_CC_Error, "Timed out");
+
+        // Keep the loop turning, even if the updater wants to sleep:
+        auto sleep = txu.wakeup();
+        if (!sleep.count() || std::chrono::milliseconds(10) < sleep)
+            sleep = std::chrono::milliseconds(10);
+        ABC_CHECK(reactor.run(sleep));
+    }
+
+    return Status();
+}
+
+/**
+ * Runs a full wallet sync against the server at `uri`,
+ * until every address has synced and every transaction has arrived.
+ * @param chain If provided, the sync must also match the chain,
+ * down to the block headers.
+ * @param recorder Receives the traffic, if provided.
+ */
+static abcd::Status
+walletSync(const std::vector<std::string> &addresses, const MockChain *chain,
+           const std::string &uri, std::chrono::milliseconds limit,
+           std::shared_ptr<abcd::TrafficRecorder> recorder)
+{
+    using namespace abcd;
+
+    // Nothing is built in, so every header comes from the server:
+    TimestampCheckpoints checkpoints;
+    BlockCache blocks("");
+    blocks.checkpointsSet(checkpoints);
+    ServerCache servers("");
+    Cache cache("", blocks, servers, "wallet");
+    for (const auto &address: addresses)
+        cache.addresses.insert(address);
+
+    // The local server has no rate limit, so neither do we:
+    Reactor reactor;
+    TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.paceSet(0, 0);
+    txu.serverListSet({uri});
+    txu.recorderSet(recorder);
+    txu.walletAdd("wallet", cache);
+    ABC_CHECK(txu.connect());
+
+    auto done = [&]()
+    {
+        const auto txids = cache.addresses.txids();
+        const auto progress = cache.addresses.progress();
+        if (progress.first != progress.second ||
+                !cache.txs.missingTxids(txids).empty())
+            return false;
+        if (!chain)
+            return true;
+
+        if (chain->payments() != txids || chain->height() != blocks.height())
+            return false;
+        for (auto height: chain->paymentHeights())
+        {
+            time_t time;
+            if (!blocks.headerTime(time, height))
+                return false;
+        }
+        return true;
+    };
+
+    const auto s = updaterDrive(txu, reactor, done, limit);
+    txu.walletRemove("wallet");
+    txu.disconnect();
+    return s;
+}
+
+static abcd::Status
+walletSync(const MockChain &chain, const std::string &uri,
+           std::chrono::milliseconds limit=std::chrono::milliseconds(10000),
+           std::shared_ptr<abcd::TrafficRecorder> recorder=nullptr)
+{
+    return walletSync(chain.addresses(), &chain, uri, limit, recorder);
+}
+
+TEST_CASE("Mock chain", "[bitcoin][sync]")
+{
+    MockChain chain(4, 2, 100);
+    MockStratumServer server;
+    chain.serve(server);
+
+    SECTION("is deterministic")
+    {
+        MockChain again(4, 2, 100);
+        REQUIRE(chain.addresses() == again.addresses());
+        REQUIRE(chain.payments() == again.payments());
+        REQUIRE(4 == chain.addresses().size());
+        REQUIRE(8 == chain.payments().size());
+    }
+
+    SECTION("estimates fees and takes broadcasts")
+    {
+        abcd::StratumConnection connection;
+        REQUIRE(connection.connect(server.uri()));
+
+        double fee = 0;
+        bool sent = false;
+        auto onError = [](abcd::Status s)
+        {
+            FAIL(s.message());
+        };
+        auto onFee = [&](double value)
+        {
+            fee = value;
+        };
+        auto onSent = [&](abcd::Status s)
+        {
+            REQUIRE(s);
+            sent = true;
+        };
+        connection.feeEstimateFetch(onError, onFee, 2);
+        connection.sendTx(onSent, abcd::DataChunk{1, 2, 3});
+
+        REQUIRE(mockDrive(connection, [&]() { return fee && sent; }));
+        REQUIRE(0.00025 == fee);
+        REQUIRE(1 == chain.broadcasts().size());
+        REQUIRE("010203" == chain.broadcasts()[0]);
+    }
+}
+
+TEST_CASE("Wallet sync against a local server", "[bitcoin][sync]")
+{
+    MockChain chain(20, 3, 500);
+    MockStratumServer server;
+    chain.serve(server);
+
+    REQUIRE(walletSync(chain, server.uri()));
+    REQUIRE(0 < server.requests());
+}
+
+TEST_CASE("Wallet sync spreads inputs across servers", "[bitcoin][sync]")
+{
+    MockChain chain(1, 4, 100);
+    MockStratumServer a;
+    MockStratumServer b;
+    chain.serve(a);
+    chain.serve(b);
+
+    // Count the input requests each server sees:
+    std::mutex mutex;
+    std::map<unsigned, size_t> inputs;
+    for (auto *server: {&a, &b})
+    {
+        const auto port = server->port();
+        const auto txGet = server->handler("blockchain.transaction.get");
+        server->handlerSet("blockchain.transaction.get",
+                           [&, port, txGet](abcd::JsonArray params)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!chain.payments().count(json_string_value(params[0].get())))
+                ++inputs[port];
+            return txGet(params);
+        });
+    }
+
+    abcd::TimestampCheckpoints checkpoints;
+    abcd::BlockCache blocks("");
+    blocks.checkpointsSet(checkpoints);
+    abcd::ServerCache servers("");
+    abcd::Reactor reactor;
+    abcd::TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.paceSet(0, 0);
+    txu.hedgeBudgetSet(0);
+    txu.serverListSet({a.uri(), b.uri()});
+
+    // Get both servers on the line before the wallet shows up:
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        return 0 < a.requests() && 0 < b.requests();
+    }, std::chrono::milliseconds(5000)));
+
+    abcd::Cache cache("", blocks, servers, "wallet");
+    for (const auto &address: chain.addresses())
+        cache.addresses.insert(address);
+    txu.walletAdd("wallet", cache);
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        const auto txids = cache.addresses.txids();
+        return chain.payments() == txids &&
+               cache.txs.missingTxids(txids).empty();
+    }, std::chrono::milliseconds(5000)));
+    txu.walletRemove("wallet");
+    txu.disconnect();
+
+    // Left to the address statuses, every input would go to the server
+    // with the address history. Instead, each input goes out as soon as
+    // its transaction arrives, starting with the other server:
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(0 < inputs[a.port()]);
+    REQUIRE(0 < inputs[b.port()]);
+}
+
+TEST_CASE("Wallets attach to a warm connection pool", "[bitcoin][sync]")
+{
+    MockChain chain(4, 2, 100);
+    MockStratumServer server;
+    chain.serve(server);
+    FaultProxy proxy(server.port(), FaultProfile());
+
+    abcd::TimestampCheckpoints checkpoints;
+    abcd::BlockCache blocks("");
+    blocks.checkpointsSet(checkpoints);
+    abcd::ServerCache servers("");
+    abcd::Reactor reactor;
+    abcd::TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.serverListSet({proxy.uri()});
+
+    // Connect with no wallets, and wait for the chain height:
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        return chain.height() == blocks.height();
+    }, std::chrono::milliseconds(5000)));
+    REQUIRE(1 == txu.connectionCount());
+
+    // The wallet syncs over the open connection:
+    abcd::Cache cache("", blocks, servers, "wallet");
+    for (const auto &address: chain.addresses())
+        cache.addresses.insert(address);
+    txu.walletAdd("wallet", cache);
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        return chain.payments() == cache.addresses.txids();
+    }, std::chrono::milliseconds(5000)));
+    REQUIRE(1 == proxy.connections());
+
+    txu.walletRemove("wallet");
+    txu.disconnect();
+}
+
+TEST_CASE("Disconnecting doesn't count against servers", "[bitcoin][sync]")
+{
+    MockChain chain(4, 2, 100);
+    MockStratumServer server;
+    chain.serve(server);
+    server.dropSet("blockchain.address.subscribe");
+
+    abcd::BlockCache blocks("");
+    abcd::ServerCache servers("");
+    abcd::Reactor reactor;
+    abcd::TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.serverListSet({server.uri()});
+    abcd::Cache cache("", blocks, servers, "wallet");
+    for (const auto &address: chain.addresses())
+        cache.addresses.insert(address);
+    txu.walletAdd("wallet", cache);
+
+    // Leave the subscriptions hanging when we hang up:
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        return chain.height() == blocks.height();
+    }, std::chrono::milliseconds(5000)));
+    txu.walletRemove("wallet");
+    txu.disconnect();
+
+    abcd::ServerCache::Stats stats;
+    REQUIRE(servers.stats(stats, server.uri()));
+    REQUIRE(0 == stats.errors);
+    REQUIRE(0 == stats.timeouts);
+}
+
+TEST_CASE("Short header chunks keep their heights", "[bitcoin][sync]")
+{
+    const size_t chunkSize = abcd::stratumChunkSize;
+    MockChain chain(1, 1, 3 * chunkSize);
+    MockStratumServer server;
+    chain.serve(server);
+
+    // The first chunk stops halfway, like a server that is catching up:
+    std::atomic<bool> truncated(false);
+    const auto getChunk = server.handler("blockchain.block.get_chunk");
+    server.handlerSet("blockchain.block.get_chunk",
+                      [&](abcd::JsonArray params)
+    {
+        auto out = getChunk(params);
+        if (!truncated.exchange(true))
+            out = out.substr(0, 1 + 80 * chunkSize) + "\"";
+        return out;
+    });
+
+    abcd::BlockCache blocks("");
+    abcd::ServerCache servers("");
+    abcd::Reactor reactor;
+    abcd::TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.serverListSet({server.uri()});
+
+    // Enough heights across the whole chunk to fetch it in one go:
+    std::vector<size_t> wanted;
+    for (size_t i = 0; i < 40; ++i)
+        wanted.push_back(chunkSize + 50 * i);
+    for (auto height: wanted)
+        blocks.headerNeededAdd(height);
+
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        time_t time;
+        for (auto height: wanted)
+            if (!blocks.headerTime(time, height))
+                return false;
+        return true;
+    }, std::chrono::milliseconds(5000)));
+    REQUIRE(truncated);
+
+    txu.disconnect();
+}
+
+TEST_CASE("Failed header fetches keep their heights", "[bitcoin][sync]")
+{
+    MockChain chain(1, 1, 100);
+    MockStratumServer server;
+    chain.serve(server);
+
+    // The first header request fails:
+    std::atomic<bool> failed(false);
+    const auto getHeader = server.handler("blockchain.block.get_header");
+    server.handlerSet("blockchain.block.get_header",
+                      [&](abcd::JsonArray params)
+    {
+        if (!failed.exchange(true))
+            return std::string();
+        return getHeader(params);
+    });
+
+    abcd::BlockCache blocks("");
+    abcd::ServerCache servers("");
+    abcd::Reactor reactor;
+    abcd::TxUpdater txu(blocks, servers, nullptr, reactor);
+    txu.serverListSet({server.uri()});
+
+    // Too few heights for a chunk, so they go one by one:
+    const std::vector<size_t> wanted = { 10, 20, 30 };
+    for (auto height: wanted)
+        blocks.headerNeededAdd(height);
+
+    REQUIRE(txu.connect());
+    REQUIRE(updaterDrive(txu, reactor, [&]()
+    {
+        time_t time;
+        for (auto height: wanted)
+            if (!blocks.headerTime(time, height))
+                return false;
+        return true;
+    }, std::chrono::milliseconds(5000)));
+    REQUIRE(failed);
+
+    txu.disconnect();
+}
+
+TEST_CASE("Wallet sync replays from a recording", "[bitcoin][sync][replay]")
+{
+    const std::string path = "/tmp/abc-traffic-test.log";
+    MockChain chain(20, 3, 500);
+    {
+        MockStratumServer server;
+        chain.serve(server);
+
+        auto recorder = std::make_shared<abcd::TrafficRecorder>();
+        REQUIRE(recorder->open(path));
+        REQUIRE(walletSync(chain, server.uri(),
+                           std::chrono::milliseconds(10000), recorder));
+    }
+
+    // The recording is enough to sync a fresh wallet, with no chain:
+    MockReplay replay;
+    REQUIRE(replay.load(path));
+    REQUIRE(chain.addresses().size() == replay.addresses().size());
+
+    MockStratumServer server;
+    replay.serve(server);
+    REQUIRE(walletSync(chain, server.uri()));
+    remove(path.c_str());
+}
+
+TEST_CASE("Wallet sync over a faulty network", "[bitcoin][sync][faults]")
+{
+    MockChain chain(20, 3, 500);
+    MockStratumServer server;
+    chain.serve(server);
+
+    FaultProfile profile;
+    profile.seed = 7;
+    profile.jitter = std::chrono::milliseconds(5);
+    profile.truncateChance = 0.05;
+    profile.disconnectChance = 0.05;
+    FaultProxy proxy(server.port(), profile);
+
+    REQUIRE(walletSync(chain, proxy.uri(), std::chrono::milliseconds(30000)));
+    REQUIRE(0 < proxy.faults());
+    REQUIRE(1 < proxy.connections());
+}
+
+TEST_CASE("Wallet sync throughput", "[.][benchmark][sync]")
+{
+    MockChain chain(1000, 5, 4000);
+    MockStratumServer server;
+    chain.serve(server);
+
+    const auto start = std::chrono::steady_clock::now();
+    REQUIRE(walletSync(chain, server.uri(),
+                       std::chrono::milliseconds(120000)));
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << "Sync: " << chain.addresses().size() << " addresses, " <<
+              chain.payments().size() << " payments in " << ms << "ms (" <<
+              server.requests() << " requests, " <<
+              server.roundTrips() << " round trips, " <<
+              (ms ? 1000 * server.requests() / ms : 0) << " requests/s)" <<
+              std::endl;
+}
+
+TEST_CASE("Wallet sync under network faults", "[.][benchmark][sync][faults]")
+{
+    for (const auto &profile: FaultProfile::standard())
+    {
+        MockChain chain(200, 3, 2000);
+        MockStratumServer server;
+        chain.serve(server);
+        FaultProxy proxy(server.port(), profile);
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto s = walletSync(chain, proxy.uri(),
+                                  std::chrono::milliseconds(120000));
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        const auto ms = std::chrono::duration_cast<
+                        std::chrono::milliseconds>(elapsed).count();
+        std::cout << "Sync (" << profile.name << "): " <<
+                  (s ? "done" : s.message()) << " in " << ms << "ms (" <<
+                  server.requests() << " requests, " <<
+                  server.roundTrips() << " round trips, " <<
+                  proxy.connections() << " connections, " <<
+                  proxy.faults() << " faults)" << std::endl;
+        CHECK(s);
+    }
+}
+
+TEST_CASE("Wallet sync replay throughput", "[.][benchmark][sync][replay]")
+{
+    // Replays a recording from the field if one is provided,
+    // or makes a synthetic one otherwise:
+    const char *recording = getenv("ABC_REPLAY_FILE");
+    const std::string path = recording ? recording :
+                             "/tmp/abc-traffic-bench.log";
+    if (!recording)
+    {
+        MockChain chain(1000, 5, 4000);
+        MockStratumServer server;
+        chain.serve(server);
+
+        auto recorder = std::make_shared<abcd::TrafficRecorder>();
+        REQUIRE(recorder->open(path));
+        REQUIRE(walletSync(chain, server.uri(),
+                           std::chrono::milliseconds(120000), recorder));
+    }
+
+    MockReplay replay;
+    REQUIRE(replay.load(path));
+    MockStratumServer server;
+    replay.serve(server);
+
+    const std::vector<std::string> addresses(replay.addresses().begin(),
+                                             replay.addresses().end());
+    const auto start = std::chrono::steady_clock::now();
+    const auto s = walletSync(addresses, nullptr, server.uri(),
+                              std::chrono::milliseconds(120000), nullptr);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        elapsed).count();
+    std::cout << "Replay: " << addresses.size() << " addresses in " <<
+              ms << "ms (" << server.requests() << " requests, " <<
+              server.roundTrips() << " round trips, " <<
+              replay.misses() << " misses)" << std::endl;
+    CHECK(s);
+    if (!recording)
+        remove(path.c_str());
+}